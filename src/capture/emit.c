@@ -0,0 +1,123 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include "../include/netfilter_capture.h"
+#include "../include/packet.h"
+#include <string.h>
+
+// What processing produced for a queued packet leaves two ways. The
+// packet itself, as it came or edited in place (whatever its new size),
+// is always handed back in the verdict message: it keeps its route, its
+// marks and its place in netfilter, with no extra socket and no copy.
+// Packets queued with emit_packet() (fakes, fragments, local answers) go
+// out in one injected batch first, so they reach the wire ahead of it.
+
+#define EMIT_MAX_PACKETS 32
+#define EMIT_ARENA_SIZE (64 * 1024)
+
+static uint8_t emit_arena[EMIT_ARENA_SIZE];
+static size_t emit_arena_used = 0;
+static const uint8_t *emit_packets[EMIT_MAX_PACKETS];
+static size_t emit_lengths[EMIT_MAX_PACKETS];
+static size_t emit_count = 0;
+
+// Queue a crafted packet to go out ahead of the packet being processed.
+// The data is copied. Returns 0 on success, -1 if the batch is full.
+int emit_packet(const uint8_t *data, size_t len)
+{
+    if (!data || len == 0) {
+        return -1;
+    }
+    
+    if (emit_count == EMIT_MAX_PACKETS || len > EMIT_ARENA_SIZE - emit_arena_used) {
+        log_warning("Too many packets to emit, %zu bytes dropped", len);
+        return -1;
+    }
+    
+    uint8_t *copy = emit_arena + emit_arena_used;
+    memcpy(copy, data, len);
+    emit_arena_used += len;
+    
+    emit_packets[emit_count] = copy;
+    emit_lengths[emit_count] = len;
+    emit_count++;
+    return 0;
+}
+
+// Queue payload bytes [off, off + len) of a TCP packet as segments with
+// its headers and the matching sequence numbers, each carrying at most
+// packet->max_segment bytes (0: a single segment). Returns 0 on success,
+// -1 if the batch is full.
+int emit_tcp_segments(const packet_t *packet, size_t off, size_t len)
+{
+    static uint8_t segment[UINT16_MAX];
+    size_t headers_len = packet->headers_len;
+    size_t max = packet->max_segment ? packet->max_segment : len;
+    uint32_t seq;
+    
+    if (!packet->raw_packet || !packet->payload || off + len > packet->payload_len ||
+        max > sizeof(segment) - headers_len || packet_get_tcp_seq(packet, &seq, NULL) < 0) {
+        return -1;
+    }
+    
+    struct tcphdr *tcp_hdr = (struct tcphdr *)(segment + packet->l4_offset);
+    memcpy(segment, packet->raw_packet, headers_len);
+    
+    for (size_t end = off + len; off < end; off += max) {
+        size_t chunk = end - off < max ? end - off : max;
+        
+        memcpy(segment + headers_len, packet->payload + off, chunk);
+        tcp_hdr->seq = htonl(seq + (uint32_t)off);
+        packet_finalize_tcp(segment, headers_len + chunk, packet->l4_offset, packet->is_ipv6);
+        if (emit_packet(segment, headers_len + chunk) < 0) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// Forget the queued packets
+static void emit_reset(void)
+{
+    emit_count = 0;
+    emit_arena_used = 0;
+}
+
+// Send the verdict for a processed packet, with its new contents if it
+// was modified. A mark to remember goes with NF_REPEAT (see
+// firewall_setup_passthrough).
+static int emit_verdict(netfilter_context_t *ctx, const packet_t *packet, bool modified)
+{
+    const uint8_t *data = NULL;
+    size_t data_len = 0;
+    
+    if (modified && packet->raw_packet && packet->raw_packet_len > 0) {
+        data = packet->raw_packet;
+        data_len = packet->raw_packet_len;
+    }
+    
+    if (packet->mark) {
+        return netfilter_send_verdict_mark(ctx, packet->nfqueue_id, NF_REPEAT, packet->mark,
+                                           data, data_len);
+    }
+    return netfilter_send_verdict(ctx, packet->nfqueue_id, NF_ACCEPT, data, data_len);
+}
+
+// Send what processing produced for a queued packet and settle it.
+// Returns the verdict given.
+int netfilter_emit(netfilter_context_t *ctx, const packet_t *packet, bool modified)
+{
+    // The batch is sent before the verdict, so it goes out first
+    if (emit_count > 0) {
+        send_raw_packets(emit_packets, emit_lengths, emit_count, packet->is_ipv6);
+        emit_reset();
+    }
+    
+    if (packet->drop) {
+        netfilter_send_verdict(ctx, packet->nfqueue_id, NF_DROP, NULL, 0);
+        return NF_DROP;
+    }
+    
+    emit_verdict(ctx, packet, modified);
+    return packet->mark ? NF_REPEAT : NF_ACCEPT;
+}
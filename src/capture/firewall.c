@@ -0,0 +1,408 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include "../include/config.h"
+#include "../include/quic.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+// Firewall rule installed by us, remembered for removal on shutdown
+typedef struct {
+    const char *tool;   // "iptables" or "ip6tables"
+    char table[16];
+    char chain[32];
+    char spec[384];
+} firewall_rule_t;
+
+#define MAX_FIREWALL_RULES 64
+
+static firewall_rule_t installed_rules[MAX_FIREWALL_RULES];
+static size_t installed_count = 0;
+static bool ipv6_rules = false;    // ip6tables works: rules cover IPv6 too
+
+// Helper function to execute system commands safely
+static int execute_command(const char *cmd)
+{
+    int ret = system(cmd);
+    if (ret == -1) {
+        log_error("Failed to execute: %s (errno=%d: %s)", cmd, errno, strerror(errno));
+        return -1;
+    }
+    if (WIFEXITED(ret) && WEXITSTATUS(ret) != 0) {
+        log_debug("Command exited with status %d: %s", WEXITSTATUS(ret), cmd);
+        return -1;
+    }
+    return 0;
+}
+
+// Remove a rule, ignoring errors (best effort)
+static void firewall_delete_rule(const firewall_rule_t *rule)
+{
+    char cmd[512];
+    
+    snprintf(cmd, sizeof(cmd), "%s -t %s -D %s %s 2>/dev/null",
+             rule->tool, rule->table, rule->chain, rule->spec);
+    execute_command(cmd);
+}
+
+// Insert a rule at the top of table/chain and remember it for cleanup
+int firewall_insert_rule(const char *tool, const char *table, const char *chain,
+                         const char *fmt, ...)
+{
+    firewall_rule_t rule;
+    char cmd[512];
+    va_list args;
+    
+    if (installed_count >= MAX_FIREWALL_RULES) {
+        log_error("Too many firewall rules");
+        return -1;
+    }
+    
+    memset(&rule, 0, sizeof(rule));
+    rule.tool = tool;
+    safe_string_copy(rule.table, table, sizeof(rule.table));
+    safe_string_copy(rule.chain, chain, sizeof(rule.chain));
+    
+    va_start(args, fmt);
+    vsnprintf(rule.spec, sizeof(rule.spec), fmt, args);
+    va_end(args);
+    
+    // Remove a stale copy left behind by an unclean shutdown
+    firewall_delete_rule(&rule);
+    
+    snprintf(cmd, sizeof(cmd), "%s -t %s -I %s %s",
+             rule.tool, rule.table, rule.chain, rule.spec);
+    if (execute_command(cmd) < 0) {
+        return -1;
+    }
+    
+    installed_rules[installed_count++] = rule;
+    log_debug("Installed firewall rule: %s", cmd);
+    return 0;
+}
+
+// Insert a rule for IPv4 and, where ip6tables works, the same rule for
+// IPv6, so both families are queued and let through alike
+static int firewall_insert_rule_all(const char *table, const char *chain, const char *fmt, ...)
+{
+    char spec[sizeof(((firewall_rule_t *)0)->spec)];
+    va_list args;
+    
+    va_start(args, fmt);
+    vsnprintf(spec, sizeof(spec), fmt, args);
+    va_end(args);
+    
+    if (firewall_insert_rule("iptables", table, chain, "%s", spec) < 0) {
+        return -1;
+    }
+    if (ipv6_rules && firewall_insert_rule("ip6tables", table, chain, "%s", spec) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Install DNS redirection for one address family: kernel DNAT when
+// possible, otherwise queue queries and responses for userspace rewriting
+static int firewall_setup_dns(bool ipv6)
+{
+    const char *tool = ipv6 ? "ip6tables" : "iptables";
+    const char *server = ipv6 ? config.dns_server_v6 : config.dns_server_v4;
+    uint16_t port = ipv6 ? config.dns_port_v6 : config.dns_port_v4;
+    // Local stub resolvers (e.g. systemd-resolved on 127.0.0.53) talk
+    // over loopback and must be left alone; they forward to the network
+    // themselves, and those queries are redirected
+    const char *loopback = ipv6 ? "::1/128" : "127.0.0.0/8";
+    
+    // Kernel DNAT never shows us the responses the cache feeds on
+    if (config.dns_redirect_offload && !config.dns_cache) {
+        char target[INET6_ADDRSTRLEN + 16];
+        
+        if (ipv6) {
+            snprintf(target, sizeof(target), "[%s]:%u", server, port);
+        } else {
+            snprintf(target, sizeof(target), "%s:%u", server, port);
+        }
+        
+        // Queries already addressed to the server are rewritten too,
+        // which only changes their port
+        if (firewall_insert_rule(tool, "nat", "OUTPUT",
+                                 "-p udp --dport 53 ! -o lo ! -d %s -j DNAT --to-destination %s",
+                                 loopback, target) == 0) {
+            log_info("  - DNS %s: kernel DNAT -> %s", ipv6 ? "IPv6" : "IPv4", target);
+            return 0;
+        }
+        
+        log_warning("Kernel DNAT unavailable for %s DNS, using userspace redirection",
+                    ipv6 ? "IPv6" : "IPv4");
+    }
+    
+    if (firewall_insert_rule(tool, "filter", "OUTPUT",
+                             "-p udp --dport 53 ! -o lo ! -d %s -j NFQUEUE --queue-num %u",
+                             loopback, config.nfqueue_num) < 0 ||
+        firewall_insert_rule(tool, "filter", "INPUT",
+                             "-p udp -s %s --sport %u -j NFQUEUE --queue-num %u",
+                             server, port, config.nfqueue_num) < 0) {
+        log_error("Failed to add %s DNS redirection rules", ipv6 ? "IPv6" : "IPv4");
+        return -1;
+    }
+    
+    log_info("  - DNS %s: udp 53 -> NFQUEUE:%u (userspace rewrite)",
+             ipv6 ? "IPv6" : "IPv4", config.nfqueue_num);
+    return 0;
+}
+
+// Let decided flows bypass the queue. Packets of a flow we are done with
+// come back from the queue (NF_REPEAT) with PASSTHROUGH_MARK set; the
+// first rule copies that into the connmark and the second then accepts
+// every packet of the connection before it reaches NFQUEUE. Rules are
+// inserted at the top, so they are added bottom-up.
+static int firewall_setup_passthrough(void)
+{
+    static const char *chains[] = { "OUTPUT", "INPUT" };
+    
+    for (size_t i = 0; i < sizeof(chains) / sizeof(chains[0]); i++) {
+        if (firewall_insert_rule_all("filter", chains[i],
+                                     "-m connmark --mark 0x%x/0x%x -j ACCEPT",
+                                     PASSTHROUGH_MARK, PASSTHROUGH_MARK) < 0 ||
+            firewall_insert_rule_all("filter", chains[i],
+                                     "-m mark --mark 0x%x/0x%x -j CONNMARK --save-mark "
+                                     "--nfmask 0x%x --ctmask 0x%x",
+                                     PASSTHROUGH_MARK, PASSTHROUGH_MARK,
+                                     PASSTHROUGH_MARK, PASSTHROUGH_MARK) < 0) {
+            return -1;
+        }
+    }
+    
+    log_info("  - Handled connections: connmark 0x%x -> ACCEPT", PASSTHROUGH_MARK);
+    return 0;
+}
+
+// Let our own injected packets (marked through SO_MARK by raw_socket.c)
+// skip every rule below, so none of them is queued again
+static int firewall_setup_inject_mark(void)
+{
+    static const char *chains[] = { "OUTPUT", "INPUT" };
+    
+    for (size_t i = 0; i < sizeof(chains) / sizeof(chains[0]); i++) {
+        if (firewall_insert_rule_all("filter", chains[i],
+                                     "-m mark --mark 0x%x/0x%x -j ACCEPT",
+                                     config.inject_mark, config.inject_mark) < 0) {
+            return -1;
+        }
+    }
+    
+    log_info("  - Injected packets: mark 0x%x -> ACCEPT", config.inject_mark);
+    return 0;
+}
+
+// Block outgoing QUIC for one address family. A rejected datagram fails
+// the browser's QUIC attempt at once, a dropped one only after its
+// handshake timer, so DROP is only the fallback where REJECT is missing.
+static int firewall_block_quic(const char *tool, const char *reject_with)
+{
+    const char *family = strcmp(tool, "ip6tables") == 0 ? "IPv6" : "IPv4";
+    
+    if (firewall_insert_rule(tool, "filter", "OUTPUT",
+                             "-p udp --dport 443 -j REJECT --reject-with %s", reject_with) == 0) {
+        log_info("  - OUTPUT: udp dport 443 -> REJECT (QUIC blocking, %s)", family);
+        return 0;
+    }
+    
+    if (firewall_insert_rule(tool, "filter", "OUTPUT", "-p udp --dport 443 -j DROP") == 0) {
+        log_info("  - OUTPUT: udp dport 443 -> DROP (QUIC blocking, %s)", family);
+        return 0;
+    }
+    
+    return -1;
+}
+
+// Block QUIC so browsers fall back to TCP. Without a per-host policy a
+// plain kernel rule does it and no packet reaches userspace; otherwise
+// Initials are queued so their SNI can be checked. QUIC is only ever
+// dropped, so responses need not be queued.
+static int firewall_setup_quic(void)
+{
+    if (blackwhitelist_enabled() && quic_decryption_available()) {
+        if (firewall_insert_rule_all("filter", "OUTPUT",
+                                     "-p udp --dport 443 -j NFQUEUE --queue-num %u",
+                                     config.nfqueue_num) < 0) {
+            return -1;
+        }
+        
+        log_info("  - OUTPUT: udp dport 443 -> NFQUEUE:%u (QUIC blocking by host)", config.nfqueue_num);
+        return 0;
+    }
+    
+    if (blackwhitelist_enabled()) {
+        log_warning("Built without libcrypto: QUIC is blocked for every host");
+    }
+    
+    if (firewall_block_quic("iptables", "icmp-port-unreachable") < 0) {
+        return -1;
+    }
+    if (ipv6_rules && firewall_block_quic("ip6tables", "icmp6-port-unreachable") < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Queue TCP to and from a list of ports, in iptables syntax
+static int firewall_queue_tcp_ports(const char *ports, bool multiport)
+{
+    const char *dport = multiport ? "-m multiport --dports" : "--dport";
+    const char *sport = multiport ? "-m multiport --sports" : "--sport";
+    
+    // Outgoing requests
+    if (firewall_insert_rule_all("filter", "OUTPUT",
+                                 "-p tcp %s %s -j NFQUEUE --queue-num %u",
+                                 dport, ports, config.nfqueue_num) < 0) {
+        log_error("Failed to add OUTPUT rule for ports %s", ports);
+        return -1;
+    }
+    
+    // Incoming responses
+    if (firewall_insert_rule_all("filter", "INPUT",
+                                 "-p tcp %s %s -j NFQUEUE --queue-num %u",
+                                 sport, ports, config.nfqueue_num) < 0) {
+        log_error("Failed to add INPUT rule for ports %s", ports);
+        return -1;
+    }
+    
+    log_info("  - OUTPUT/INPUT: tcp port %s -> NFQUEUE:%u", ports, config.nfqueue_num);
+    return 0;
+}
+
+// Queue the HTTP and TLS ports, so traffic on other ports never reaches
+// us. A multiport match takes 15 ports, a range counting as two, so
+// longer lists take several rules.
+static int firewall_setup_tcp(void)
+{
+    port_range_t ranges[2 * MAX_PORT_RANGES];
+    size_t count = 0;
+    
+    for (size_t i = 0; i < config.http_ports.count; i++) {
+        ranges[count++] = config.http_ports.ranges[i];
+    }
+    for (size_t i = 0; i < config.tls_ports.count; i++) {
+        const port_range_t *range = &config.tls_ports.ranges[i];
+        bool duplicate = false;
+        
+        for (size_t j = 0; j < config.http_ports.count; j++) {
+            if (ranges[j].first == range->first && ranges[j].last == range->last) {
+                duplicate = true;
+            }
+        }
+        if (!duplicate) {
+            ranges[count++] = *range;
+        }
+    }
+    
+    for (size_t i = 0; i < count;) {
+        port_set_t chunk;
+        unsigned int slots = 0;
+        char ports[128];
+        
+        chunk.count = 0;
+        while (i < count && chunk.count < MAX_PORT_RANGES) {
+            unsigned int need = ranges[i].first == ranges[i].last ? 1 : 2;
+            if (slots + need > 15) {
+                break;
+            }
+            slots += need;
+            chunk.ranges[chunk.count++] = ranges[i++];
+        }
+        
+        config_format_ports(&chunk, ':', ports, sizeof(ports));
+        if (firewall_queue_tcp_ports(ports, chunk.count > 1) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Queue the first packets of every outgoing TCP connection, for TLS on
+// other ports (see packet_is_https). Packet 1 is the SYN; the ClientHello
+// follows the handshake's ACK, possibly over a few segments. Later
+// packets are never queued. This puts every new TCP connection through
+// the daemon, so the queue is bypassed when it is not running.
+static int firewall_setup_tls_any_port(void)
+{
+    if (firewall_insert_rule_all("filter", "OUTPUT",
+                                 "-p tcp -m connbytes --connbytes 2:5 --connbytes-dir original "
+                                 "--connbytes-mode packets -j NFQUEUE --queue-num %u --queue-bypass",
+                                 config.nfqueue_num) < 0) {
+        return -1;
+    }
+    
+    log_info("  - OUTPUT: tcp packets 2-5 of each connection -> NFQUEUE:%u (TLS on any port)",
+             config.nfqueue_num);
+    return 0;
+}
+
+// Initialize netfilter with iptables rules
+int firewall_setup(void)
+{
+    log_info("Setting up firewall rules");
+    
+    // Every rule but the per-family DNS ones is installed for both
+    // families, or for IPv4 only if ip6tables is missing
+    ipv6_rules = execute_command("ip6tables -t filter -S OUTPUT >/dev/null 2>&1") == 0;
+    if (!ipv6_rules) {
+        log_warning("ip6tables unavailable, IPv6 traffic is not handled");
+    }
+    
+    if (firewall_setup_tcp() < 0) {
+        log_error("Make sure iptables is installed and you have root privileges");
+        firewall_cleanup();
+        return -1;
+    }
+    
+    if (config.tls_any_port && firewall_setup_tls_any_port() < 0) {
+        log_warning("connbytes match unavailable, TLS only found on the TLS ports");
+        config.tls_any_port = false;
+    }
+    
+    if (config.block_quic && firewall_setup_quic() < 0) {
+        log_error("Failed to add OUTPUT rule for QUIC");
+        firewall_cleanup();
+        return -1;
+    }
+    
+    // Without both rules a marked, repeated packet would be queued again
+    if (config.connmark_passthrough && firewall_setup_passthrough() < 0) {
+        log_warning("connmark/CONNMARK matches unavailable, handled connections stay queued");
+        config.connmark_passthrough = false;
+        firewall_cleanup();
+        return firewall_setup();
+    }
+    
+    if ((config.dns_redirect_ipv4 && firewall_setup_dns(false) < 0) ||
+        (config.dns_redirect_ipv6 && firewall_setup_dns(true) < 0)) {
+        firewall_cleanup();
+        return -1;
+    }
+    
+    // Inserted last so that it comes first
+    if (config.inject_mark && firewall_setup_inject_mark() < 0) {
+        log_warning("mark match unavailable, injected packets may be queued again");
+        config.inject_mark = 0;
+    }
+    
+    log_info("Firewall rules configured successfully");
+    return 0;
+}
+
+// Remove every rule we installed, newest first
+int firewall_cleanup(void)
+{
+    log_info("Cleaning up firewall rules");
+    
+    while (installed_count > 0) {
+        firewall_delete_rule(&installed_rules[--installed_count]);
+    }
+    
+    log_info("Firewall rules cleaned up");
+    return 0;
+}
@@ -147,31 +147,31 @@ int netfilter_cleanup(netfilter_context_t *ctx)
 int netfilter_receive_packet(netfilter_context_t *ctx)
 {
     int len;
-    char buf[4096];
     
     if (!ctx || !ctx->initialized) {
         printf("Netfilter not initialized\n");
         return -1;
     }
     
-    len = recv(ctx->fd, buf, sizeof(buf), 0);
+    // Whole packets are copied (NFQNL_COPY_PACKET), so the buffer must
+    // hold the largest one with its netlink headers
+    len = recv(ctx->fd, ctx->buffer, sizeof(ctx->buffer), 0);
     if (len < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return 0;  // No data available
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;  // No data available or interrupted by a signal
         }
-        printf("recv failed: %s\n", strerror(errno));
+        log_error("recv failed: %s", strerror(errno));
         return -1;
     }
     
     ctx->buffer_len = len;
     
     // Process the message
-    if (nfq_handle_packet(ctx->nfq_handle, buf, len) < 0) {
-        printf("nfq_handle_packet failed: %s\n", strerror(errno));
+    if (nfq_handle_packet(ctx->nfq_handle, ctx->buffer, len) < 0) {
+        log_error("nfq_handle_packet failed: %s", strerror(errno));
         return -1;
     }
     
-    printf("Received %d bytes from netfilter\n", len);
     return len;
 }
 
@@ -183,13 +183,27 @@ int netfilter_send_verdict(netfilter_context_t *ctx, uint32_t packet_id,
         return -1;
     }
     
-    int result = nfq_set_verdict(ctx->queue_handle, packet_id, verdict, data_len, data);
-    if (result < 0) {
-        printf("nfq_set_verdict failed: %s\n", strerror(errno));
+    if (nfq_set_verdict(ctx->queue_handle, packet_id, verdict, data_len, data) < 0) {
+        log_error("nfq_set_verdict failed: %s", strerror(errno));
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Send verdict and set the packet mark
+int netfilter_send_verdict_mark(netfilter_context_t *ctx, uint32_t packet_id, int verdict,
+                                uint32_t mark, const uint8_t *data, size_t data_len)
+{
+    if (!ctx || !ctx->initialized) {
+        return -1;
+    }
+    
+    if (nfq_set_verdict2(ctx->queue_handle, packet_id, verdict, mark, data_len, data) < 0) {
+        log_error("nfq_set_verdict2 failed: %s", strerror(errno));
         return -1;
     }
     
-    printf("Sent verdict: id=%u, verdict=%d, data_len=%zu\n", packet_id, verdict, data_len);
     return 0;
 }
 
@@ -231,6 +245,22 @@ int netfilter_get_packet_metadata(struct nfq_data *nfa, uint32_t *packet_id,
     return 0;
 }
 
+// Get the netfilter hook the packet was queued from
+int netfilter_get_packet_hook(struct nfq_data *nfa, uint8_t *hook)
+{
+    if (!nfa || !hook) {
+        return -1;
+    }
+    
+    struct nfqnl_msg_packet_hdr *ph = nfq_get_msg_packet_hdr(nfa);
+    if (!ph) {
+        return -1;
+    }
+    
+    *hook = ph->hook;
+    return 0;
+}
+
 // Print error
 void netfilter_print_error(const char *operation, int err)
 {
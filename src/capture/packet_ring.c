@@ -0,0 +1,323 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <net/route.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <ifaddrs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+// AF_PACKET TX ring (TPACKET_V3) for injected packets, used only with
+// --inject-backend ring: packets are copied into a ring shared with the
+// kernel and a single sendto() hands all of them to the device. The
+// socket is cooked (SOCK_DGRAM), so the kernel adds the link-layer
+// header; on Ethernet every packet goes to the default gateway's MAC,
+// read from /proc. Packets leave below netfilter and routing, so they
+// never come back through the queue, but nothing routes them either:
+// only packets sent from the interface's own address to a destination
+// off its subnet are taken, everything else (local answers, LAN hosts,
+// traffic routed through another interface such as a VPN) stays on the
+// raw sockets. IPv6 over Ethernet would need the neighbour table and
+// stays on the raw socket too.
+
+#define RING_FRAME_SIZE 2048
+#define RING_FRAME_COUNT 256
+#define RING_BLOCK_SIZE (RING_FRAME_SIZE * 32)
+#define RING_DATA_OFFSET TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+#define RING_MAX_ADDRS6 8
+
+static int ring_fd = -1;
+static uint8_t *ring_map = NULL;
+static size_t ring_map_len = 0;
+static unsigned int ring_head = 0;      // Next frame to fill
+static struct sockaddr_ll ring_dst;     // Link-layer next hop
+static bool ring_headerless = false;    // No link-layer header: IPv6 too
+static struct in_addr ring_addr4;       // The interface's address and subnet
+static struct in_addr ring_mask4;
+static struct in6_addr ring_addrs6[RING_MAX_ADDRS6];
+static size_t ring_addr6_count = 0;
+
+// Frame n of the ring, counted from the start and wrapping around
+static uint8_t *ring_frame(size_t n)
+{
+    return ring_map + (n % RING_FRAME_COUNT) * RING_FRAME_SIZE;
+}
+
+// Find the MAC of the default gateway of an Ethernet interface
+static int ring_gateway_mac(const char *interface, uint8_t mac[ETH_ALEN])
+{
+    char line[256];
+    char name[IFNAMSIZ];
+    unsigned int dest, gateway, flags;
+    uint32_t gw_addr = 0;
+    
+    FILE *fp = fopen("/proc/net/route", "r");
+    if (!fp) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%15s %x %x %x", name, &dest, &gateway, &flags) == 4 &&
+            dest == 0 && (flags & RTF_GATEWAY) && strcmp(name, interface) == 0) {
+            gw_addr = gateway;  // Printed in network byte order
+            break;
+        }
+    }
+    fclose(fp);
+    
+    if (gw_addr == 0) {
+        return -1;
+    }
+    
+    char gw_str[INET_ADDRSTRLEN];
+    struct in_addr in = { .s_addr = gw_addr };
+    inet_ntop(AF_INET, &in, gw_str, sizeof(gw_str));
+    
+    fp = fopen("/proc/net/arp", "r");
+    if (!fp) {
+        return -1;
+    }
+    
+    int result = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        char ip[INET_ADDRSTRLEN + 1];
+        unsigned int type, arp_flags;
+        
+        if (sscanf(line, "%16s %x %x %hhx:%hhx:%hhx:%hhx:%hhx:%hhx %*s %15s", ip, &type, &arp_flags,
+                   &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5], name) == 10 &&
+            strcmp(ip, gw_str) == 0 && strcmp(name, interface) == 0 && (arp_flags & ATF_COM)) {
+            result = 0;
+            break;
+        }
+    }
+    fclose(fp);
+    return result;
+}
+
+// Record the interface's addresses: only packets sent from them are
+// taken by the ring
+static int ring_read_addresses(const char *interface)
+{
+    struct ifaddrs *addrs;
+    
+    if (getifaddrs(&addrs) < 0) {
+        return -1;
+    }
+    
+    ring_addr4.s_addr = 0;
+    ring_addr6_count = 0;
+    for (struct ifaddrs *ifa = addrs; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || strcmp(ifa->ifa_name, interface) != 0) {
+            continue;
+        }
+        
+        if (ifa->ifa_addr->sa_family == AF_INET && ring_addr4.s_addr == 0 && ifa->ifa_netmask) {
+            ring_addr4 = ((const struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+            ring_mask4 = ((const struct sockaddr_in *)ifa->ifa_netmask)->sin_addr;
+        } else if (ifa->ifa_addr->sa_family == AF_INET6 && ring_addr6_count < RING_MAX_ADDRS6) {
+            ring_addrs6[ring_addr6_count++] = ((const struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
+        }
+    }
+    freeifaddrs(addrs);
+    
+    return ring_addr4.s_addr != 0 || ring_addr6_count > 0 ? 0 : -1;
+}
+
+// Check whether a packet is one the ring may send: from the interface's
+// address, to a host reached through the gateway (or over a headerless
+// link, where there is no next hop to get wrong)
+static bool ring_takes_packet(const uint8_t *data, size_t len, bool is_ipv6)
+{
+    if (is_ipv6) {
+        if (len < sizeof(struct ip6_hdr)) {
+            return false;
+        }
+        
+        const struct ip6_hdr *ip6 = (const struct ip6_hdr *)data;
+        for (size_t i = 0; i < ring_addr6_count; i++) {
+            if (memcmp(&ip6->ip6_src, &ring_addrs6[i], sizeof(struct in6_addr)) == 0) {
+                return !IN6_IS_ADDR_LOOPBACK(&ip6->ip6_dst) &&
+                       memcmp(&ip6->ip6_dst, &ring_addrs6[i], sizeof(struct in6_addr)) != 0;
+            }
+        }
+        return false;
+    }
+    
+    if (len < sizeof(struct iphdr)) {
+        return false;
+    }
+    
+    const struct iphdr *ip = (const struct iphdr *)data;
+    if (ring_addr4.s_addr == 0 || ip->saddr != ring_addr4.s_addr || ip->daddr == ring_addr4.s_addr ||
+        (ntohl(ip->daddr) >> 24) == 127) {
+        return false;
+    }
+    return ring_headerless || (ip->daddr & ring_mask4.s_addr) != (ring_addr4.s_addr & ring_mask4.s_addr);
+}
+
+// Work out where the ring's packets go on the interface
+static int ring_set_destination(const char *interface)
+{
+    struct ifreq ifr;
+    
+    memset(&ifr, 0, sizeof(ifr));
+    safe_string_copy(ifr.ifr_name, interface, sizeof(ifr.ifr_name));
+    if (ioctl(ring_fd, SIOCGIFHWADDR, &ifr) < 0) {
+        log_debug("TX ring: no hardware address for %s: %s", interface, strerror(errno));
+        return -1;
+    }
+    
+    memset(&ring_dst, 0, sizeof(ring_dst));
+    ring_dst.sll_family = AF_PACKET;
+    ring_dst.sll_ifindex = (int)if_nametoindex(interface);
+    if (ring_dst.sll_ifindex == 0) {
+        return -1;
+    }
+    
+    switch (ifr.ifr_hwaddr.sa_family) {
+        case ARPHRD_ETHER:
+            if (ring_gateway_mac(interface, ring_dst.sll_addr) < 0) {
+                log_debug("TX ring: gateway of %s not resolved", interface);
+                return -1;
+            }
+            ring_dst.sll_halen = ETH_ALEN;
+            ring_headerless = false;
+            return 0;
+            
+        case ARPHRD_NONE:   // tun, WireGuard
+        case ARPHRD_PPP:
+        case ARPHRD_RAWIP:
+            ring_headerless = true;
+            return 0;
+            
+        default:
+            log_debug("TX ring: unsupported link type %u on %s", ifr.ifr_hwaddr.sa_family, interface);
+            return -1;
+    }
+}
+
+// Set up the TX ring on an interface. Returns 0 on success, -1 if the
+// ring cannot be used there.
+int packet_ring_init(const char *interface)
+{
+    int version = TPACKET_V3;
+    int loss = 1;
+    struct tpacket_req3 req;
+    
+    if (!interface || interface[0] == '\0') {
+        return -1;
+    }
+    
+    // Protocol 0: the socket only transmits, nothing is queued to it
+    ring_fd = socket(AF_PACKET, SOCK_DGRAM, 0);
+    if (ring_fd < 0) {
+        log_debug("TX ring: socket failed: %s", strerror(errno));
+        return -1;
+    }
+    
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = RING_BLOCK_SIZE;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr = RING_FRAME_COUNT;
+    req.tp_block_nr = RING_FRAME_COUNT * RING_FRAME_SIZE / RING_BLOCK_SIZE;
+    
+    // PACKET_LOSS: the kernel skips a malformed frame instead of stopping
+    // at it, so its position in the ring stays in step with ring_head
+    if (setsockopt(ring_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+        setsockopt(ring_fd, SOL_PACKET, PACKET_LOSS, &loss, sizeof(loss)) < 0 ||
+        setsockopt(ring_fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+        log_debug("TX ring: TPACKET_V3 TX ring unsupported: %s", strerror(errno));
+        packet_ring_cleanup();
+        return -1;
+    }
+    
+    ring_map_len = (size_t)req.tp_block_size * req.tp_block_nr;
+    ring_map = mmap(NULL, ring_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+    if (ring_map == MAP_FAILED) {
+        log_debug("TX ring: mmap failed: %s", strerror(errno));
+        ring_map = NULL;
+        packet_ring_cleanup();
+        return -1;
+    }
+    ring_head = 0;
+    
+    if (ring_set_destination(interface) < 0 || ring_read_addresses(interface) < 0) {
+        packet_ring_cleanup();
+        return -1;
+    }
+    
+    log_info("TX ring on %s: %u frames (%s)", interface, RING_FRAME_COUNT,
+             ring_headerless ? "IPv4 and IPv6" : "IPv4");
+    return 0;
+}
+
+// Check if the ring carries packets of a family
+bool packet_ring_ready(bool is_ipv6)
+{
+    return ring_map != NULL && (!is_ipv6 || ring_headerless);
+}
+
+// Queue packets on the ring and send them with one sendto(). Returns 0
+// once all were sent, 1 if the ring cannot take them (the caller falls
+// back to the raw socket), -1 on error.
+int packet_ring_send(const uint8_t *const *packets, const size_t *lengths, size_t count, bool is_ipv6)
+{
+    if (!packet_ring_ready(is_ipv6) || count > RING_FRAME_COUNT) {
+        return 1;
+    }
+    
+    // Sends block until the kernel is done with every frame, so the next
+    // frames are normally free again
+    for (size_t i = 0; i < count; i++) {
+        const struct tpacket3_hdr *hdr = (const struct tpacket3_hdr *)ring_frame(ring_head + i);
+        if (lengths[i] > RING_FRAME_SIZE - RING_DATA_OFFSET ||
+            !ring_takes_packet(packets[i], lengths[i], is_ipv6) ||
+            __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+            return 1;
+        }
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *frame = ring_frame(ring_head + i);
+        struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)frame;
+        
+        memcpy(frame + RING_DATA_OFFSET, packets[i], lengths[i]);
+        hdr->tp_len = (uint32_t)lengths[i];
+        hdr->tp_next_offset = 0;
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    }
+    ring_head = (ring_head + (unsigned int)count) % RING_FRAME_COUNT;
+    
+    ring_dst.sll_protocol = htons(is_ipv6 ? ETH_P_IPV6 : ETH_P_IP);
+    if (sendto(ring_fd, NULL, 0, 0, (struct sockaddr *)&ring_dst, sizeof(ring_dst)) < 0) {
+        log_error("Failed to send from TX ring: %s", strerror(errno));
+        return -1;
+    }
+    
+    log_debug("Sent %zu packets from TX ring", count);
+    return 0;
+}
+
+// Release the TX ring
+void packet_ring_cleanup(void)
+{
+    if (ring_map) {
+        munmap(ring_map, ring_map_len);
+        ring_map = NULL;
+    }
+    
+    if (ring_fd >= 0) {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+}
@@ -4,8 +4,11 @@
 #include "../include/packet.h"
 #include "../include/logging.h"
 #include "../include/config.h"
+#include "../include/http_parser.h"
+#include "../include/tls_parser.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <netinet/ip.h>
 #include <netinet/ip6.h>
@@ -53,82 +56,57 @@ void packet_free(packet_t *packet)
     packet_init(packet);
 }
 
-// Parse IPv4 packet
-int packet_parse_ipv4(const uint8_t *data, size_t len, packet_t *packet)
+// Parse TCP/UDP header at l4_offset and fill ports, payload and headers
+static int packet_parse_transport(const uint8_t *data, size_t len, size_t l4_offset,
+                                  uint8_t protocol, packet_t *packet)
 {
-    struct iphdr *ip_hdr;
-    struct tcphdr *tcp_hdr;
-    struct udphdr *udp_hdr;
-    uint8_t *payload;
-    size_t payload_len;
-    
-    if (!data || len < sizeof(struct iphdr)) {
-        return -1;
-    }
-    
-    ip_hdr = (struct iphdr *)data;
+    size_t headers_len = l4_offset;
     
-    if (ip_hdr->version != 4) {
-        return -1;  // Not IPv4
-    }
-    
-    // Initialize packet structure
-    packet_init(packet);
-    packet->is_ipv6 = false;
-    packet->direction = DIRECTION_UNKNOWN;
-    packet->ttl = ip_hdr->ttl;
-    
-    // Extract IP addresses
-    packet->src_ip[0] = ip_hdr->saddr;
-    packet->dst_ip[0] = ip_hdr->daddr;
-    
-    // Set direction based on comparison with local interfaces (simplified)
-    // In a real implementation, you'd check against actual interface IPs
-    packet->is_outbound = (ntohl(ip_hdr->saddr) < ntohl(ip_hdr->daddr));
-    
-    // Handle transport layer
-    if (ip_hdr->protocol == IPPROTO_TCP) {
-        if (len < (sizeof(struct iphdr) + sizeof(struct tcphdr))) {
+    if (protocol == IPPROTO_TCP) {
+        if (len < l4_offset + sizeof(struct tcphdr)) {
+            return -1;
+        }
+        
+        const struct tcphdr *tcp_hdr = (const struct tcphdr *)(data + l4_offset);
+        size_t tcp_len = tcp_hdr->doff * 4;
+        if (tcp_len < sizeof(struct tcphdr) || len < l4_offset + tcp_len) {
             return -1;
         }
         
-        tcp_hdr = (struct tcphdr *)(data + ip_hdr->ihl * 4);
         packet->src_port = ntohs(tcp_hdr->source);
         packet->dst_port = ntohs(tcp_hdr->dest);
+        headers_len += tcp_len;
         
-        payload = (uint8_t *)tcp_hdr + tcp_hdr->doff * 4;
-        payload_len = len - ip_hdr->ihl * 4 - tcp_hdr->doff * 4;
-        
-        if (payload_len > 0) {
-            packet->type = PACKET_IPV4_TCP_DATA;
-            packet->payload = malloc(payload_len);
-            if (packet->payload) {
-                memcpy(packet->payload, payload, payload_len);
-                packet->payload_len = payload_len;
-            }
+        if (len > headers_len) {
+            packet->type = packet->is_ipv6 ? PACKET_IPV6_TCP_DATA : PACKET_IPV4_TCP_DATA;
         } else {
-            packet->type = PACKET_IPV4_TCP;
+            packet->type = packet->is_ipv6 ? PACKET_IPV6_TCP : PACKET_IPV4_TCP;
         }
     }
-    else if (ip_hdr->protocol == IPPROTO_UDP) {
-        if (len < (sizeof(struct iphdr) + sizeof(struct udphdr))) {
+    else if (protocol == IPPROTO_UDP) {
+        if (len < l4_offset + sizeof(struct udphdr)) {
             return -1;
         }
         
-        udp_hdr = (struct udphdr *)(data + ip_hdr->ihl * 4);
+        const struct udphdr *udp_hdr = (const struct udphdr *)(data + l4_offset);
         packet->src_port = ntohs(udp_hdr->source);
         packet->dst_port = ntohs(udp_hdr->dest);
+        headers_len += sizeof(struct udphdr);
         
-        payload = (uint8_t *)udp_hdr + sizeof(struct udphdr);
-        payload_len = len - ip_hdr->ihl * 4 - sizeof(struct udphdr);
-        
-        if (payload_len > 0) {
-            packet->type = PACKET_IPV4_UDP_DATA;
-            packet->payload = malloc(payload_len);
-            if (packet->payload) {
-                memcpy(packet->payload, payload, payload_len);
-                packet->payload_len = payload_len;
-            }
+        if (len > headers_len) {
+            packet->type = packet->is_ipv6 ? PACKET_IPV6_UDP_DATA : PACKET_IPV4_UDP_DATA;
+        }
+    }
+    
+    packet->l4_offset = l4_offset;
+    
+    // Copy payload
+    size_t payload_len = len - headers_len;
+    if (payload_len > 0 && packet->type != PACKET_UNKNOWN) {
+        packet->payload = malloc(payload_len);
+        if (packet->payload) {
+            memcpy(packet->payload, data + headers_len, payload_len);
+            packet->payload_len = payload_len;
         }
     }
     
@@ -140,14 +118,6 @@ int packet_parse_ipv4(const uint8_t *data, size_t len, packet_t *packet)
     }
     
     // Store headers
-    size_t headers_len = ip_hdr->ihl * 4;
-    if (ip_hdr->protocol == IPPROTO_TCP) {
-        struct tcphdr *tcp_hdr = (struct tcphdr *)(data + headers_len);
-        headers_len += tcp_hdr->doff * 4;
-    } else if (ip_hdr->protocol == IPPROTO_UDP) {
-        headers_len += sizeof(struct udphdr);
-    }
-    
     packet->headers_len = headers_len;
     packet->headers = malloc(headers_len);
     if (packet->headers) {
@@ -157,23 +127,96 @@ int packet_parse_ipv4(const uint8_t *data, size_t len, packet_t *packet)
     return 0;
 }
 
-// Parse IPv6 packet (placeholder - would need full implementation)
+// Parse IPv4 packet
+int packet_parse_ipv4(const uint8_t *data, size_t len, packet_t *packet)
+{
+    const struct iphdr *ip_hdr;
+    
+    if (!data || len < sizeof(struct iphdr)) {
+        return -1;
+    }
+    
+    ip_hdr = (const struct iphdr *)data;
+    
+    if (ip_hdr->version != 4 || ip_hdr->ihl < 5 || len < (size_t)ip_hdr->ihl * 4) {
+        return -1;  // Not IPv4
+    }
+    
+    // Initialize packet structure
+    packet_init(packet);
+    packet->is_ipv6 = false;
+    packet->direction = DIRECTION_UNKNOWN;
+    packet->ttl = ip_hdr->ttl;
+    
+    // Extract IP addresses
+    packet->src_ip[0] = ip_hdr->saddr;
+    packet->dst_ip[0] = ip_hdr->daddr;
+    
+    // Fallback direction guess; the queue callback overrides it with the
+    // netfilter hook the packet was queued from
+    packet->is_outbound = (ntohl(ip_hdr->saddr) < ntohl(ip_hdr->daddr));
+    
+    // Non-first fragments carry no transport header
+    if (ntohs(ip_hdr->frag_off) & IP_OFFMASK) {
+        return packet_parse_transport(data, len, ip_hdr->ihl * 4, 0, packet);
+    }
+        
+    return packet_parse_transport(data, len, ip_hdr->ihl * 4, ip_hdr->protocol, packet);
+}
+        
+// Parse IPv6 packet, skipping the common extension headers
 int packet_parse_ipv6(const uint8_t *data, size_t len, packet_t *packet)
 {
-    // Simplified IPv6 parsing - would need full implementation
+    const struct ip6_hdr *ip6_hdr;
+        
+    if (!data || len < sizeof(struct ip6_hdr)) {
+        return -1;
+    }
+    
+    ip6_hdr = (const struct ip6_hdr *)data;
+    
+    if ((data[0] >> 4) != 6) {
+        return -1;  // Not IPv6
+    }
+    
     packet_init(packet);
     packet->is_ipv6 = true;
     packet->direction = DIRECTION_UNKNOWN;
-    packet->type = PACKET_IPV6_TCP;  // Simplified
+    packet->ttl = ip6_hdr->ip6_hlim;
+    
+    memcpy(packet->src_ip, &ip6_hdr->ip6_src, sizeof(packet->src_ip));
+    memcpy(packet->dst_ip, &ip6_hdr->ip6_dst, sizeof(packet->dst_ip));
+    
+    uint8_t next_header = ip6_hdr->ip6_nxt;
+    size_t offset = sizeof(struct ip6_hdr);
+    
+    // Walk hop-by-hop, routing, fragment and destination options headers
+    for (int i = 0; i < 8; i++) {
+        if (next_header == IPPROTO_HOPOPTS || next_header == IPPROTO_ROUTING ||
+            next_header == IPPROTO_DSTOPTS) {
+            if (len < offset + 8) return -1;
+            uint8_t ext_next = data[offset];
+            offset += ((size_t)data[offset + 1] + 1) * 8;
+            next_header = ext_next;
+        } else if (next_header == IPPROTO_FRAGMENT) {
+            if (len < offset + 8) return -1;
+            const struct ip6_frag *frag = (const struct ip6_frag *)(data + offset);
+            next_header = frag->ip6f_nxt;
+            offset += sizeof(struct ip6_frag);
+            if (ntohs(frag->ip6f_offlg) & IP6F_OFF_MASK) {
+                next_header = 0;  // Non-first fragment, no transport header
+                break;
+            }
+        } else {
+            break;
+        }
+    }
     
-    // Store raw packet data
-    packet->raw_packet_len = len;
-    packet->raw_packet = malloc(len);
-    if (packet->raw_packet) {
-        memcpy(packet->raw_packet, data, len);
+    if (offset > len) {
+        return -1;
     }
     
-    return 0;
+    return packet_parse_transport(data, len, offset, next_header, packet);
 }
 
 // Main packet parsing function
@@ -219,31 +262,213 @@ bool packet_is_udp(const packet_t *packet)
             packet->type == PACKET_IPV6_UDP_DATA);
 }
 
+// Port classes, indexed by port: deciding what a packet may be is one
+// load. Built once the configuration is known (see port_class_init).
+static uint8_t port_classes[65536];
+
+// Request methods we recognize, by their first four bytes ("GET ",
+// "POST", ...), placed by http_method_slot()
+static uint32_t http_methods[8];
+
+// Read four bytes as a big-endian word
+static uint32_t load_be32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+           ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+// Slot of a method word in http_methods; collision free for the methods
+// listed in port_class_init()
+static unsigned int http_method_slot(uint32_t word)
+{
+    return (word * 49u) >> 29;
+}
+
+// Give every port of a set a class
+static void port_class_add(const port_set_t *set, uint8_t port_class)
+{
+    for (size_t i = 0; i < set->count; i++) {
+        for (uint32_t port = set->ranges[i].first; port <= set->ranges[i].last; port++) {
+            port_classes[port] |= port_class;
+        }
+    }
+}
+
+// Build the port class table and the method set
+void port_class_init(void)
+{
+    static const char *const methods[] = { "GET ", "POST", "HEAD", "PUT ", "DELE" };
+    
+    memset(port_classes, 0, sizeof(port_classes));
+    port_class_add(&config.http_ports, PORT_CLASS_HTTP);
+    port_class_add(&config.tls_ports, PORT_CLASS_TLS);
+    port_classes[443] |= PORT_CLASS_QUIC;
+    
+    // Queries go to 53, redirected responses come from the server's port
+    port_classes[53] |= PORT_CLASS_DNS;
+    port_classes[config.dns_port_v4] |= PORT_CLASS_DNS;
+    port_classes[config.dns_port_v6] |= PORT_CLASS_DNS;
+    
+    memset(http_methods, 0, sizeof(http_methods));
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        uint32_t word = load_be32((const uint8_t *)methods[i]);
+        http_methods[http_method_slot(word)] = word;
+    }
+}
+
+// Return the classes of a packet's server port (the destination of
+// outgoing packets, the source of incoming ones) that apply to its
+// protocol; 0 if it carries nothing we handle
+uint8_t packet_port_class(const packet_t *packet)
+{
+    uint16_t port = packet->is_outbound ? packet->dst_port : packet->src_port;
+    
+    if (packet_is_tcp(packet)) {
+        return port_classes[port] & (PORT_CLASS_HTTP | PORT_CLASS_TLS);
+    }
+    if (packet_is_udp(packet)) {
+        return port_classes[port] & (PORT_CLASS_DNS | PORT_CLASS_QUIC);
+    }
+    return 0;
+}
+
 // Check if packet is HTTP
 bool packet_is_http(const packet_t *packet)
 {
-    if (!packet || !packet_is_tcp(packet) || !packet->payload) {
+    if (!packet || !packet_is_tcp(packet) || !packet->payload || packet->payload_len < 4 ||
+        !(port_classes[packet->dst_port] & PORT_CLASS_HTTP)) {
         return false;
     }
     
-    // Check for common HTTP methods
-    return (packet->dst_port == 80 && 
-            (packet->payload_len >= 3 &&
-             (strncmp((char*)packet->payload, "GET", 3) == 0 ||
-              strncmp((char*)packet->payload, "POST", 4) == 0 ||
-              strncmp((char*)packet->payload, "HEAD", 4) == 0 ||
-              strncmp((char*)packet->payload, "PUT", 3) == 0 ||
-              strncmp((char*)packet->payload, "DELETE", 6) == 0)));
+    uint32_t word = load_be32(packet->payload);
+    return http_methods[http_method_slot(word)] == word;
 }
 
-// Check if packet is HTTPS
+// Check if packet is HTTPS: sent to a TLS port, or with --tls-any-port
+// starting a ClientHello on any port
 bool packet_is_https(const packet_t *packet)
 {
     if (!packet || !packet_is_tcp(packet)) {
         return false;
     }
     
-    return (packet->dst_port == 443);
+    if (port_classes[packet->dst_port] & PORT_CLASS_TLS) {
+        return true;
+    }
+    return config.tls_any_port && tls_is_client_hello(packet->payload, packet->payload_len);
+}
+
+// Read the TCP sequence and acknowledgment numbers of a packet (ack may
+// be NULL)
+int packet_get_tcp_seq(const packet_t *packet, uint32_t *seq, uint32_t *ack)
+{
+    if (!packet_is_tcp(packet) || !packet->raw_packet ||
+        packet->l4_offset + sizeof(struct tcphdr) > packet->raw_packet_len) {
+        return -1;
+    }
+    
+    const struct tcphdr *tcp_hdr = (const struct tcphdr *)((const uint8_t *)packet->raw_packet +
+                                                           packet->l4_offset);
+    *seq = ntohl(tcp_hdr->seq);
+    if (ack) {
+        *ack = ntohl(tcp_hdr->ack_seq);
+    }
+    return 0;
+}
+
+// Return the window scale announced by a SYN or SYN-ACK, -1 if the packet
+// is not one or announces none
+int packet_get_tcp_wscale(const packet_t *packet)
+{
+    if (!packet_is_tcp(packet) || !packet->raw_packet ||
+        packet->l4_offset + sizeof(struct tcphdr) > packet->raw_packet_len) {
+        return -1;
+    }
+    
+    const uint8_t *raw = packet->raw_packet;
+    const struct tcphdr *tcp_hdr = (const struct tcphdr *)(raw + packet->l4_offset);
+    size_t end = packet->l4_offset + tcp_hdr->doff * 4;
+    
+    if (!tcp_hdr->syn || end > packet->raw_packet_len) {
+        return -1;
+    }
+    
+    size_t pos = packet->l4_offset + sizeof(struct tcphdr);
+    while (pos < end && raw[pos] != 0) {
+        if (raw[pos] == 1) {
+            pos++;
+            continue;
+        }
+        if (pos + 1 >= end || raw[pos + 1] < 2 || pos + raw[pos + 1] > end) {
+            break;
+        }
+        if (raw[pos] == 3 && raw[pos + 1] == 3) {
+            return raw[pos + 2] > 14 ? 14 : raw[pos + 2];  // RFC 7323 caps it at 14
+        }
+        pos += raw[pos + 1];
+    }
+    
+    return -1;
+}
+
+// Lower the TCP window of a packet to at most window (in the units of the
+// header, i.e. before scaling). Returns 1 if the packet was changed, 0 if
+// its window was small enough already, -1 on error.
+int packet_clamp_tcp_window(packet_t *packet, uint16_t window)
+{
+    if (!packet_is_tcp(packet) || !packet->raw_packet ||
+        packet->l4_offset + sizeof(struct tcphdr) > packet->raw_packet_len) {
+        return -1;
+    }
+    
+    uint8_t *raw = packet->raw_packet;
+    struct tcphdr *tcp_hdr = (struct tcphdr *)(raw + packet->l4_offset);
+    
+    if (ntohs(tcp_hdr->window) <= window) {
+        return 0;
+    }
+    
+    // Computed afresh: a packet merged by GRO carries the first segment's checksum
+    tcp_hdr->window = htons(window);
+    tcp_hdr->check = 0;
+    tcp_hdr->check = l4_checksum(raw, packet->raw_packet_len, packet->l4_offset,
+                                 packet->is_ipv6, IPPROTO_TCP);
+    return 1;
+}
+
+// Extract the Host header value of an HTTP request, without any port.
+// Only complete header lines inside the payload are considered.
+int packet_get_http_host(const packet_t *packet, char *host, size_t host_len)
+{
+    if (!packet || !packet->payload || !host || host_len == 0) {
+        return -1;
+    }
+    
+    http_request_t req;
+    if (http_parse_request(packet->payload, packet->payload_len, &req) < 0 || !req.host.found) {
+        return -1;
+    }
+    
+    const char *value = (const char *)packet->payload + req.host.value_off;
+    const char *value_end = value + req.host.value_len;
+    
+    // Drop ":port" (bracketed IPv6 literals keep their colons)
+    const char *colon = value_end;
+    while (colon > value && colon[-1] >= '0' && colon[-1] <= '9') {
+        colon--;
+    }
+    if (colon > value && colon < value_end && colon[-1] == ':') {
+        value_end = colon - 1;
+    }
+    
+    size_t len = value_end - value;
+    if (len == 0 || len >= host_len) {
+        return -1;
+    }
+    
+    memcpy(host, value, len);
+    host[len] = '\0';
+    return 0;
 }
 
 // Copy packet structure
@@ -342,3 +567,110 @@ int packet_set_ttl(packet_t *packet, uint8_t ttl) {
 
     return -1;
 }
+
+
+// Fold a 32-bit one's complement sum into 16 bits
+static uint16_t checksum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)sum;
+}
+
+// One's complement sum of a buffer, in the byte order it is stored
+static uint32_t checksum_add(uint32_t sum, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    uint16_t word;
+    
+    while (len > 1) {
+        memcpy(&word, bytes, sizeof(word));
+        sum += word;
+        bytes += 2;
+        len -= 2;
+    }
+    
+    if (len == 1) {
+        word = 0;
+        memcpy(&word, bytes, 1);
+        sum += word;
+    }
+    
+    return (sum & 0xFFFF) + (sum >> 16);
+}
+
+// IPv4 header checksum (store the result as is)
+uint16_t ip_checksum(const void *data, size_t len)
+{
+    return (uint16_t)~checksum_fold(checksum_add(0, data, len));
+}
+
+// TCP/UDP checksum over the pseudo-header and the segment at l4_offset.
+// The checksum field itself must be zero.
+uint16_t l4_checksum(const uint8_t *raw, size_t raw_len, size_t l4_offset,
+                     bool is_ipv6, uint8_t protocol)
+{
+    uint32_t sum = 0;
+    size_t l4_len = raw_len - l4_offset;
+    
+    if (is_ipv6) {
+        sum = checksum_add(sum, raw + 8, 32);            // Source + destination
+        sum += htons((uint16_t)(l4_len >> 16)) + htons((uint16_t)l4_len);
+    } else {
+        sum = checksum_add(sum, raw + 12, 8);            // Source + destination
+        sum += htons((uint16_t)l4_len);
+    }
+    sum += htons(protocol);
+    sum = checksum_add(sum, raw + l4_offset, l4_len);
+    
+    return (uint16_t)~checksum_fold(sum);
+}
+
+// Fix the IP length field and the IPv4 and TCP checksums after a TCP
+// packet was rebuilt with a different payload
+void packet_finalize_tcp(uint8_t *raw, size_t raw_len, size_t l4_offset, bool is_ipv6)
+{
+    if (is_ipv6) {
+        struct ip6_hdr *ip6_hdr = (struct ip6_hdr *)raw;
+        ip6_hdr->ip6_plen = htons((uint16_t)(raw_len - sizeof(struct ip6_hdr)));
+    } else {
+        struct iphdr *ip_hdr = (struct iphdr *)raw;
+        ip_hdr->tot_len = htons((uint16_t)raw_len);
+        ip_hdr->check = 0;
+        ip_hdr->check = ip_checksum(ip_hdr, ip_hdr->ihl * 4);
+    }
+    
+    struct tcphdr *tcp_hdr = (struct tcphdr *)(raw + l4_offset);
+    tcp_hdr->check = 0;
+    tcp_hdr->check = l4_checksum(raw, raw_len, l4_offset, is_ipv6, IPPROTO_TCP);
+}
+
+// Incrementally update a checksum for a changed 16-bit word (RFC 1624, eqn. 3)
+uint16_t checksum_update_16(uint16_t csum, uint16_t old_val, uint16_t new_val)
+{
+    uint32_t sum = (uint16_t)~csum;
+    sum += (uint16_t)~old_val;
+    sum += new_val;
+    return (uint16_t)~checksum_fold(sum);
+}
+
+// Incrementally update a checksum for a changed 32-bit value (network order)
+uint16_t checksum_update_32(uint16_t csum, uint32_t old_val, uint32_t new_val)
+{
+    csum = checksum_update_16(csum, (uint16_t)(old_val >> 16), (uint16_t)(new_val >> 16));
+    return checksum_update_16(csum, (uint16_t)(old_val & 0xFFFF), (uint16_t)(new_val & 0xFFFF));
+}
+
+// Incrementally update a checksum for a changed IPv4 or IPv6 address
+uint16_t checksum_update_addr(uint16_t csum, const uint32_t *old_addr,
+                              const uint32_t *new_addr, bool is_ipv6)
+{
+    int words = is_ipv6 ? 4 : 1;
+    
+    for (int i = 0; i < words; i++) {
+        csum = checksum_update_32(csum, old_addr[i], new_addr[i]);
+    }
+    
+    return csum;
+}
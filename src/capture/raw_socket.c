@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "../include/goodbyedpi.h"
 #include "../include/logging.h"
 #include <sys/socket.h>
@@ -6,6 +7,10 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+
+#define RAW_BATCH_MAX 16  // Packets per sendmmsg() call
 
 // Raw socket for packet capture and injection
 static int raw_socket_fd = -1;
@@ -14,15 +19,16 @@ static int raw_socket_ipv6_fd = -1;
 // Initialize raw socket
 int setup_raw_socket(void)
 {
-    // Create IPv4 raw socket
-    raw_socket_fd = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
+    // Create IPv4 raw socket (IPPROTO_RAW implies IP_HDRINCL: we supply
+    // complete packets, headers included)
+    raw_socket_fd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
     if (raw_socket_fd < 0) {
         log_error("Failed to create IPv4 raw socket: %s", strerror(errno));
         return -1;
     }
     
     // Create IPv6 raw socket
-    raw_socket_ipv6_fd = socket(AF_INET6, SOCK_RAW, IPPROTO_TCP);
+    raw_socket_ipv6_fd = socket(AF_INET6, SOCK_RAW, IPPROTO_RAW);
     if (raw_socket_ipv6_fd < 0) {
         log_error("Failed to create IPv6 raw socket: %s", strerror(errno));
         close(raw_socket_fd);
@@ -32,21 +38,51 @@ int setup_raw_socket(void)
     
     // Set socket options for better performance
     int sock_buf_size = 1024 * 1024; // 1MB buffer
-    if (setsockopt(raw_socket_fd, SOL_SOCKET, SO_RCVBUF, &sock_buf_size, sizeof(sock_buf_size)) < 0) {
+    if (setsockopt(raw_socket_fd, SOL_SOCKET, SO_SNDBUF, &sock_buf_size, sizeof(sock_buf_size)) < 0) {
         log_warning("Failed to set IPv4 socket buffer size: %s", strerror(errno));
     }
     
-    if (setsockopt(raw_socket_ipv6_fd, SOL_SOCKET, SO_RCVBUF, &sock_buf_size, sizeof(sock_buf_size)) < 0) {
+    if (setsockopt(raw_socket_ipv6_fd, SOL_SOCKET, SO_SNDBUF, &sock_buf_size, sizeof(sock_buf_size)) < 0) {
         log_warning("Failed to set IPv6 socket buffer size: %s", strerror(errno));
     }
     
+    // Packets sent here pass OUTPUT again; the mark lets the firewall
+    // rules wave them through instead of queueing them (see firewall.c)
+    if (config.inject_mark &&
+        (setsockopt(raw_socket_fd, SOL_SOCKET, SO_MARK, &config.inject_mark, sizeof(config.inject_mark)) < 0 ||
+         setsockopt(raw_socket_ipv6_fd, SOL_SOCKET, SO_MARK, &config.inject_mark, sizeof(config.inject_mark)) < 0)) {
+        log_warning("Failed to mark injected packets: %s", strerror(errno));
+        config.inject_mark = 0;
+    }
+    
     log_info("Raw sockets initialized successfully");
+    
+    // The raw sockets stay open for what the TX ring cannot carry. The
+    // ring bypasses routing, so it is only used when asked for.
+    if (config.inject_backend == INJECT_RING) {
+        char interface[sizeof(config.interface)];
+        
+        if (config.interface[0] != '\0') {
+            safe_string_copy(interface, config.interface, sizeof(interface));
+        } else if (get_default_interface(interface, sizeof(interface)) < 0) {
+            interface[0] = '\0';
+        }
+        
+        if (packet_ring_init(interface) < 0) {
+            log_warning("TX ring unavailable on %s, injecting through raw sockets",
+                        interface[0] ? interface : "(no interface)");
+        }
+    }
+    
+    log_info("Packet injection: %s", packet_ring_ready(false) ? "AF_PACKET TX ring" : "raw sockets");
     return 0;
 }
 
 // Close raw sockets
 void cleanup_raw_socket(void)
 {
+    packet_ring_cleanup();
+    
     if (raw_socket_fd >= 0) {
         close(raw_socket_fd);
         raw_socket_fd = -1;
@@ -60,27 +96,88 @@ void cleanup_raw_socket(void)
     log_info("Raw sockets cleaned up");
 }
 
+// Fill in the destination address of a raw packet from its IP header
+static int raw_packet_destination(const uint8_t *packet_data, size_t packet_len, bool is_ipv6,
+                                  struct sockaddr_storage *dst, socklen_t *dst_len)
+{
+    memset(dst, 0, sizeof(*dst));
+    if (is_ipv6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)dst;
+        if (packet_len < sizeof(struct ip6_hdr)) return -1;
+        sin6->sin6_family = AF_INET6;
+        memcpy(&sin6->sin6_addr, &((const struct ip6_hdr *)packet_data)->ip6_dst, sizeof(sin6->sin6_addr));
+        *dst_len = sizeof(*sin6);
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *)dst;
+        if (packet_len < sizeof(struct iphdr)) return -1;
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = ((const struct iphdr *)packet_data)->daddr;
+        *dst_len = sizeof(*sin);
+    }
+    return 0;
+}
+
 // Send raw packet
 int send_raw_packet(const uint8_t *packet_data, size_t packet_len, bool is_ipv6)
+{
+    return send_raw_packets(&packet_data, &packet_len, 1, is_ipv6);
+}
+
+// Send raw packets in order, through the TX ring when it is set up and
+// can take them, otherwise with as few sendmmsg() calls as possible (one
+// per RAW_BATCH_MAX packets). Returns 0 once all were sent, -1 otherwise.
+int send_raw_packets(const uint8_t *const *packets, const size_t *lengths, size_t count, bool is_ipv6)
 {
     int sock_fd = is_ipv6 ? raw_socket_ipv6_fd : raw_socket_fd;
+    struct mmsghdr msgs[RAW_BATCH_MAX];
+    struct iovec iov[RAW_BATCH_MAX];
+    struct sockaddr_storage dst[RAW_BATCH_MAX];
+    
+    int ring_result = packet_ring_send(packets, lengths, count, is_ipv6);
+    if (ring_result <= 0) {
+        return ring_result;
+    }
     
     if (sock_fd < 0) {
         log_error("Raw socket not initialized for %s", is_ipv6 ? "IPv6" : "IPv4");
         return -1;
     }
     
-    ssize_t sent = send(sock_fd, packet_data, packet_len, 0);
-    if (sent < 0) {
-        log_error("Failed to send raw packet: %s", strerror(errno));
-        return -1;
-    }
+    // Raw sockets are unconnected: address each packet to its IP destination
+    size_t done = 0;
+    while (done < count) {
+        size_t batch = count - done < RAW_BATCH_MAX ? count - done : RAW_BATCH_MAX;
     
-    if ((size_t)sent != packet_len) {
-        log_warning("Packet sent partially: %zd/%zu bytes", sent, packet_len);
+        memset(msgs, 0, sizeof(msgs[0]) * batch);
+        for (size_t i = 0; i < batch; i++) {
+            socklen_t dst_len;
+            if (raw_packet_destination(packets[done + i], lengths[done + i], is_ipv6,
+                                       &dst[i], &dst_len) < 0) {
+                return -1;
+            }
+            iov[i].iov_base = (void *)packets[done + i];
+            iov[i].iov_len = lengths[done + i];
+            msgs[i].msg_hdr.msg_name = &dst[i];
+            msgs[i].msg_hdr.msg_namelen = dst_len;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        
+        int sent = sendmmsg(sock_fd, msgs, (unsigned int)batch, 0);
+        if (sent <= 0) {
+            log_error("Failed to send raw packet: %s", sent < 0 ? strerror(errno) : "nothing sent");
+            return -1;
+        }
+        
+        for (int i = 0; i < sent; i++) {
+            if (msgs[i].msg_len != lengths[done + i]) {
+                log_warning("Packet sent partially: %u/%zu bytes", msgs[i].msg_len, lengths[done + i]);
+            }
+        }
+        done += (size_t)sent;
     }
     
-    log_debug("Sent raw packet: %zu bytes via %s", packet_len, is_ipv6 ? "IPv6" : "IPv4");
+    log_debug("Sent %zu raw packets via %s", count, is_ipv6 ? "IPv6" : "IPv4");
     return 0;
 }
 
@@ -49,6 +49,7 @@ int config_init(goodbyedpi_config_t *cfg)
     // Header manipulation defaults
     cfg->host_uppercase = false;
     cfg->host_lowercase_mixed = false;
+    cfg->host_reorder = false;
     
     // DNS defaults
     cfg->dns_redirect_ipv4 = false;
@@ -57,6 +58,9 @@ int config_init(goodbyedpi_config_t *cfg)
     strncpy(cfg->dns_server_v6, DEFAULT_DNS_SERVER_V6, sizeof(cfg->dns_server_v6) - 1);
     cfg->dns_port_v4 = DEFAULT_DNS_PORT;
     cfg->dns_port_v6 = DEFAULT_DNS_PORT;
+    cfg->dns_redirect_offload = true;
+    cfg->dns_cache = false;
+    cfg->dns_cache_size = DEFAULT_DNS_CACHE_SIZE;
     
     // General defaults
     cfg->daemon_mode = false;
@@ -65,6 +69,7 @@ int config_init(goodbyedpi_config_t *cfg)
     cfg->verbose_mode = false;
     cfg->block_quic = false;
     cfg->max_payload_size = DEFAULT_MAX_PAYLOAD_SIZE;
+    cfg->reassembly_buffers = DEFAULT_REASSEMBLY_BUFFERS;
     
     // File paths
     strncpy(cfg->pid_file, DEFAULT_PID_FILE, sizeof(cfg->pid_file) - 1);
@@ -72,6 +77,13 @@ int config_init(goodbyedpi_config_t *cfg)
     
     // Network interface (empty = all interfaces)
     cfg->interface[0] = '\0';
+    cfg->inject_backend = INJECT_RAW;
+    cfg->inject_mark = DEFAULT_INJECT_MARK;
+    cfg->inject_rate = DEFAULT_INJECT_RATE;
+    cfg->inject_flow_rate = DEFAULT_INJECT_FLOW_RATE;
+    config_parse_ports(DEFAULT_HTTP_PORTS, &cfg->http_ports);
+    config_parse_ports(DEFAULT_TLS_PORTS, &cfg->tls_ports);
+    cfg->tls_any_port = false;
     
     return 0;
 }
@@ -129,6 +141,90 @@ int config_parse_line(const char *line, config_line_t *config_line)
     return 0;
 }
 
+// Parse an injection backend name: raw or ring
+int config_parse_inject_backend(const char *value, inject_backend_t *backend)
+{
+    if (strcmp(value, "raw") == 0) {
+        *backend = INJECT_RAW;
+    } else if (strcmp(value, "ring") == 0) {
+        *backend = INJECT_RING;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Parse a port set: comma-separated ports and first-last ranges, e.g.
+// "80,8080-8089". Returns 0 on success, -1 if the list is invalid.
+int config_parse_ports(const char *value, port_set_t *set)
+{
+    port_set_t parsed;
+    const char *p = value;
+    
+    memset(&parsed, 0, sizeof(parsed));
+    while (*p != '\0') {
+        char *end;
+        unsigned long first = strtoul(p, &end, 10);
+        unsigned long last = first;
+        
+        if (end == p) {
+            return -1;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+            if (end == p) {
+                return -1;
+            }
+        }
+        if (first == 0 || last > 65535 || first > last || parsed.count == MAX_PORT_RANGES) {
+            return -1;
+        }
+        
+        parsed.ranges[parsed.count].first = (uint16_t)first;
+        parsed.ranges[parsed.count].last = (uint16_t)last;
+        parsed.count++;
+        
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        p = end;
+    }
+    
+    if (parsed.count == 0) {
+        return -1;
+    }
+    *set = parsed;
+    return 0;
+}
+
+// Write a port set as a list, ranges joined by range_sep ('-' as in the
+// configuration, ':' for iptables). Returns -1 if it does not fit.
+int config_format_ports(const port_set_t *set, char range_sep, char *buf, size_t buf_len)
+{
+    size_t used = 0;
+    
+    buf[0] = '\0';
+    for (size_t i = 0; i < set->count; i++) {
+        const port_range_t *range = &set->ranges[i];
+        int n;
+        
+        if (range->first == range->last) {
+            n = snprintf(buf + used, buf_len - used, "%s%u", i ? "," : "", range->first);
+        } else {
+            n = snprintf(buf + used, buf_len - used, "%s%u%c%u", i ? "," : "",
+                         range->first, range_sep, range->last);
+        }
+        if (n < 0 || (size_t)n >= buf_len - used) {
+            return -1;
+        }
+        used += (size_t)n;
+    }
+    return 0;
+}
+
 // Set configuration value
 int config_set_value(goodbyedpi_config_t *cfg, const char *key, const char *value)
 {
@@ -144,12 +240,18 @@ int config_set_value(goodbyedpi_config_t *cfg, const char *key, const char *valu
         cfg->native_fragmentation = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
     } else if (strcmp(key, "reverse_fragmentation") == 0) {
         cfg->reverse_fragmentation = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(key, "fragment_http_persistent") == 0) {
+        cfg->fragment_http_persistent = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(key, "fragment_http_persistent_nowait") == 0) {
+        cfg->fragment_http_persistent_nowait = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
     } else if (strcmp(key, "host_mixedcase") == 0) {
         cfg->host_mixedcase = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
     } else if (strcmp(key, "additional_space") == 0) {
         cfg->additional_space = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
     } else if (strcmp(key, "host_removespace") == 0) {
         cfg->host_removespace = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(key, "host_reorder") == 0) {
+        cfg->host_reorder = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
     } else if (strcmp(key, "wrong_checksum") == 0) {
         cfg->wrong_checksum = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
     } else if (strcmp(key, "wrong_sequence") == 0) {
@@ -166,6 +268,49 @@ int config_set_value(goodbyedpi_config_t *cfg, const char *key, const char *valu
         cfg->dns_redirect_ipv4 = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
     } else if (strcmp(key, "dns_redirect_ipv6") == 0) {
         cfg->dns_redirect_ipv6 = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(key, "dns_redirect_offload") == 0) {
+        cfg->dns_redirect_offload = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(key, "blacklist") == 0) {
+        safe_string_copy(cfg->blacklist_file, value, sizeof(cfg->blacklist_file));
+        cfg->enable_blacklist = (value[0] != '\0');
+    } else if (strcmp(key, "whitelist") == 0) {
+        safe_string_copy(cfg->whitelist_file, value, sizeof(cfg->whitelist_file));
+        cfg->enable_whitelist = (value[0] != '\0');
+    } else if (strcmp(key, "profiles") == 0) {
+        safe_string_copy(cfg->profiles_file, value, sizeof(cfg->profiles_file));
+    } else if (strcmp(key, "connmark_passthrough") == 0) {
+        cfg->connmark_passthrough = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(key, "reassembly_buffers") == 0) {
+        cfg->reassembly_buffers = (unsigned int)atoi(value);
+    } else if (strcmp(key, "block_quic") == 0) {
+        cfg->block_quic = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(key, "allow_no_sni") == 0) {
+        cfg->allow_no_sni = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(key, "dns_cache") == 0) {
+        cfg->dns_cache = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(key, "dns_cache_size") == 0) {
+        cfg->dns_cache_size = atoi(value);
+    } else if (strcmp(key, "interface") == 0) {
+        safe_string_copy(cfg->interface, value, sizeof(cfg->interface));
+    } else if (strcmp(key, "inject_backend") == 0) {
+        if (config_parse_inject_backend(value, &cfg->inject_backend) < 0) {
+            log_error("Invalid inject_backend: %s (raw or ring)", value);
+            return -1;
+        }
+    } else if (strcmp(key, "http_ports") == 0 || strcmp(key, "tls_ports") == 0) {
+        port_set_t *set = strcmp(key, "http_ports") == 0 ? &cfg->http_ports : &cfg->tls_ports;
+        if (config_parse_ports(value, set) < 0) {
+            log_error("Invalid %s: %s (e.g. 80,8080-8089)", key, value);
+            return -1;
+        }
+    } else if (strcmp(key, "tls_any_port") == 0) {
+        cfg->tls_any_port = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+    } else if (strcmp(key, "inject_mark") == 0) {
+        cfg->inject_mark = (uint32_t)strtoul(value, NULL, 0);
+    } else if (strcmp(key, "inject_rate") == 0) {
+        cfg->inject_rate = (unsigned int)atoi(value);
+    } else if (strcmp(key, "inject_flow_rate") == 0) {
+        cfg->inject_flow_rate = (unsigned int)atoi(value);
     } else if (strcmp(key, "debug") == 0) {
         cfg->debug_mode = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
     } else if (strcmp(key, "verbose") == 0) {
@@ -277,9 +422,12 @@ void config_print(void)
     log_info("Fragmentation: HTTP=%u, HTTPS=%u", config.http_fragment_size, config.https_fragment_size);
     log_info("Native fragmentation: %s", config.native_fragmentation ? "yes" : "no");
     log_info("Reverse fragmentation: %s", config.reverse_fragmentation ? "yes" : "no");
+    log_info("HTTP persistent fragmentation: %s", !config.fragment_http_persistent ? "no" :
+             config.fragment_http_persistent_nowait ? "nowait" : "wait");
     log_info("Host mixed case: %s", config.host_mixedcase ? "yes" : "no");
     log_info("Additional space: %s", config.additional_space ? "yes" : "no");
     log_info("Host remove space: %s", config.host_removespace ? "yes" : "no");
+    log_info("Host reorder: %s", config.host_reorder ? "yes" : "no");
     log_info("Wrong checksum: %s", config.wrong_checksum ? "yes" : "no");
     log_info("Wrong sequence: %s", config.wrong_sequence ? "yes" : "no");
     log_info("Auto TTL: %s", config.auto_ttl ? "yes" : "no");
@@ -288,6 +436,29 @@ void config_print(void)
     log_info("Debug mode: %s", config.debug_mode ? "yes" : "no");
     log_info("Daemon mode: %s", config.daemon_mode ? "yes" : "no");
     log_info("Max payload size: %u", config.max_payload_size);
+    log_info("Connmark passthrough: %s", config.connmark_passthrough ? "yes" : "no");
+    log_info("Reassembly buffers: %u", config.reassembly_buffers);
+    log_info("Injection: %s on %s",
+             config.inject_backend == INJECT_RING ? "ring" : "raw",
+             config.interface[0] != '\0' ? config.interface : "default route");
+    char http_ports[256], tls_ports[256];
+    config_format_ports(&config.http_ports, '-', http_ports, sizeof(http_ports));
+    config_format_ports(&config.tls_ports, '-', tls_ports, sizeof(tls_ports));
+    log_info("Ports: HTTP %s, TLS %s%s", http_ports, tls_ports,
+             config.tls_any_port ? " and any port by content" : "");
+    log_info("Injected packet mark: %#x", config.inject_mark);
+    log_info("Injection limit: %u/s, %u/s per flow (0: none)", config.inject_rate, config.inject_flow_rate);
+    
+    if (config.enable_blacklist) {
+        log_info("Blacklist: %s (allow no SNI: %s)", config.blacklist_file,
+                 config.allow_no_sni ? "yes" : "no");
+    }
+    if (config.enable_whitelist) {
+        log_info("Whitelist: %s", config.whitelist_file);
+    }
+    if (config.profiles_file[0] != '\0') {
+        log_info("Strategy profiles: %s", config.profiles_file);
+    }
     
     if (config.dns_redirect_ipv4) {
         log_info("DNS IPv4 redirection: %s:%u", config.dns_server_v4, config.dns_port_v4);
@@ -295,6 +466,10 @@ void config_print(void)
     if (config.dns_redirect_ipv6) {
         log_info("DNS IPv6 redirection: %s:%u", config.dns_server_v6, config.dns_port_v6);
     }
+    if (config.dns_redirect_ipv4 || config.dns_redirect_ipv6) {
+        log_info("DNS kernel offload: %s", config.dns_redirect_offload && !config.dns_cache ? "yes" : "no");
+        log_info("DNS cache: %s", config.dns_cache ? "yes" : "no");
+    }
     
     log_info("================================");
 }
@@ -2,86 +2,386 @@
 #include "../include/logging.h"
 #include "../include/config.h"
 #include "../include/packet.h"
+#include "../include/tls_parser.h"
+#include "../include/quic.h"
+#include "../include/http_parser.h"
 
-// Helper function to find Host header in HTTP payload
-static char *find_host_header(uint8_t *payload, size_t payload_len)
+// Tell what a new request is from its first segment. With --tls-any-port
+// this is the one sniff for a ClientHello on other ports; the flow keeps
+// the result while the rest of the request is gathered.
+static request_kind_t request_kind_of(const packet_t *packet, bool follow_up)
 {
-    if (!payload || payload_len < 6) return NULL;
+    if (packet_is_http(packet)) {
+        return REQUEST_HTTP;
+    }
+    if (packet_is_https(packet)) {
+        return REQUEST_TLS;
+    }
+    
+    // A keep-alive request split in front of its method's end
+    return follow_up ? REQUEST_HTTP : REQUEST_NONE;
+}
+
+// Find the request's Host header or TLS SNI. Returns 0 if one was found.
+static int find_request_hostname(const packet_t *packet, request_kind_t kind,
+                                 char *hostname, size_t hostname_len)
+{
+    if (kind == REQUEST_HTTP) {
+        return packet_get_http_host(packet, hostname, hostname_len);
+    }
+    
+    if (kind == REQUEST_TLS && packet->payload) {
+        return evasion_extract_sni(packet->payload, packet->payload_len, hostname, hostname_len);
+    }
     
-    char *payload_str = (char *)payload;
-    char *host_pos = stristr(payload_str, "Host:");
+    return -1;
+}
+
+// Check whether a request is cut short, so its Host/SNI may follow in
+// the next segment
+static bool request_incomplete(const packet_t *packet, request_kind_t kind)
+{
+    const uint8_t *data = packet->payload;
+    size_t len = packet->payload_len;
+    
+    if (kind == REQUEST_TLS) {
+        // ClientHello record longer than what arrived
+        tls_client_hello_t hello;
+        return tls_parse_client_hello(data, len, &hello) == TLS_PARSE_INCOMPLETE;
+    }
+    
+    // HTTP headers not terminated yet
+    http_request_t req;
+    return http_parse_request(data, len, &req) < 0 || req.headers_end == 0;
+}
+
+// Check whether keep-alive requests are split by the client, by shrinking
+// the window the server advertises (--frag-http-persistent without nowait)
+static bool http_persistent_wait(void)
+{
+    return config.fragment_http_persistent && !config.fragment_http_persistent_nowait;
+}
+
+// Check whether data could be the start of a request method, for a
+// request the client split in front of the method's end
+static bool http_method_prefix(const uint8_t *data, size_t len)
+{
+    if (len == 0 || len > 7) {
+        return false;
+    }
     
-    return host_pos;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] < 'A' || data[i] > 'Z') {
+            return false;
+        }
+    }
+    return true;
 }
 
-// Helper function to mix case in Host header value
-static int apply_host_mixedcase(uint8_t *payload, size_t payload_len)
+// Remember where the request after this one starts on a persistent HTTP
+// flow; data holds the request so far, ending with this packet's payload.
+// Chunked bodies and pipelined requests leave the flow sniffing for
+// methods instead.
+static void http_track_request(conntrack_entry_t *flow, const packet_t *packet,
+                               const uint8_t *data, size_t len)
 {
-    char *host_pos = find_host_header(payload, payload_len);
-    if (!host_pos) return -1;
+    http_request_t req;
+    uint64_t body;
+    uint32_t seq;
     
-    // Find start of host value (after "Host:")
-    char *value_start = host_pos + 5;
+    flow->next_request_known = false;
     
-    // Skip whitespace
-    while (*value_start && (*value_start == ' ' || *value_start == '\t')) {
-        value_start++;
+    if (!config.fragment_http_persistent ||
+        http_parse_request(data, len, &req) < 0 || req.headers_end == 0 ||
+        http_body_length(data, &req, &body) < 0 || body > UINT32_MAX ||
+        req.headers_end + body < len || packet_get_tcp_seq(packet, &seq, NULL) < 0) {
+        return;
     }
     
-    // Find end of line
-    char *value_end = value_start;
-    while (*value_end && *value_end != '\r' && *value_end != '\n') {
-        value_end++;
+    flow->next_request = seq + (uint32_t)packet->payload_len + (uint32_t)(req.headers_end + body - len);
+    flow->next_request_known = true;
+}
+
+// Check whether a segment of a persistent HTTP flow starts a new request.
+// Bodies of known length are skipped by sequence number, so only the
+// segment at the next request's start is looked at.
+static bool http_request_starts(const packet_t *packet, conntrack_entry_t *flow)
+{
+    uint32_t seq;
+    
+    if (flow->next_request_known && packet_get_tcp_seq(packet, &seq, NULL) == 0) {
+        int32_t diff = (int32_t)(seq - flow->next_request);
+        if (diff < 0) {
+            return false;
+        }
+        if (diff == 0) {
+            return packet_is_http(packet) || http_method_prefix(packet->payload, packet->payload_len);
+        }
+        
+        // Data went missing from our view; fall back to sniffing
+        flow->next_request_known = false;
     }
     
-    size_t value_len = value_end - value_start;
-    if (value_len > 0) {
-        mix_case(value_start, value_len);
-        log_debug("Applied mixed case to Host header value");
+    return packet_is_http(packet);
+}
+
+// Shrink the window in the server's acknowledgment of a whole request to
+// the fragment size, so the client sends the start of its next request in
+// a segment of its own (the window size trick, repeated per request)
+static int http_persistent_clamp(packet_t *packet, conntrack_entry_t *flow)
+{
+    const strategy_profile_t *profile = flow->profile ? flow->profile : strategy_default();
+    uint32_t seq, ack;
+    
+    if (!http_persistent_wait() || profile->http_fragment_size == 0 ||
+        flow->state != FLOW_EVADED || !flow->next_request_known ||
+        packet_get_tcp_seq(packet, &seq, &ack) < 0 || ack != flow->next_request) {
         return 0;
     }
     
-    return -1;
+    // The field is scaled by what the server announced in its SYN-ACK
+    uint32_t window = profile->http_fragment_size >> flow->server_wscale;
+    if (window == 0) {
+        window = 1;
+    }
+    
+    return packet_clamp_tcp_window(packet, window > UINT16_MAX ? UINT16_MAX : (uint16_t)window) > 0;
 }
 
-// Helper function to remove space after Host:
-static int apply_host_removespace(uint8_t *payload, size_t payload_len)
+// A request gathered from segments held back while its flow was in
+// FLOW_HANDSHAKE; it is processed and sent in their place
+typedef struct {
+    packet_t packet;        // The whole request, from its first byte
+    bool valid;
+} gathered_request_t;
+
+// Make a gathered request one packet, with the addressing of the segment
+// that completed it and the sequence number of its first byte. It is
+// sent in segments no larger than the ones it arrived in.
+static int request_build(const packet_t *segment, const conntrack_entry_t *flow,
+                         const uint8_t *data, size_t len, gathered_request_t *gathered)
 {
-    char *host_pos = find_host_header(payload, payload_len);
-    if (!host_pos) return -1;
+    uint32_t base_seq;
+    size_t segment_size;
+    
+    if (!segment->raw_packet || reassembly_held(flow, &base_seq, &segment_size) < 0) {
+        return -1;
+    }
+    
+    size_t raw_len = segment->headers_len + len;
+    uint8_t *raw = malloc(raw_len);
+    uint8_t *payload = malloc(len);
+    if (!raw || !payload) {
+        free(raw);
+        free(payload);
+        return -1;
+    }
+    
+    memcpy(raw, segment->raw_packet, segment->headers_len);
+    memcpy(raw + segment->headers_len, data, len);
+    struct tcphdr *tcp_hdr = (struct tcphdr *)(raw + segment->l4_offset);
+    tcp_hdr->seq = htonl(base_seq);
+    packet_finalize_tcp(raw, raw_len, segment->l4_offset, segment->is_ipv6);
+    memcpy(payload, data, len);
     
-    // Check if there's a space after "Host:"
-    char *after_colon = host_pos + 5;
-    if (*after_colon == ' ') {
-        // Shift the rest left by one character
-        memmove(after_colon, after_colon + 1, strlen(after_colon + 1) + 1);
-        log_debug("Removed space after Host:");
+    packet_t *request = &gathered->packet;
+    *request = *segment;
+    request->headers = NULL;
+    request->raw_packet = raw;
+    request->raw_packet_len = raw_len;
+    request->payload = payload;
+    request->payload_len = len;
+    request->drop = false;
+    request->mark = 0;
+    request->max_segment = segment_size;
+    gathered->valid = true;
+    return 0;
+}
+
+// Send a gathered request, as its chain left it. The segment that
+// completed it is dropped: its data is the request's tail.
+static void request_send(packet_t *packet, gathered_request_t *gathered)
+{
+    if (!gathered->valid) {
+        return;
+    }
+    
+    if (emit_tcp_segments(&gathered->packet, 0, gathered->packet.payload_len) == 0) {
+        packet->drop = true;
+    }
+    
+    packet_free(&gathered->packet);
+    gathered->valid = false;
+}
+
+// Add a segment to the flow's partial request and look for the hostname
+// in everything gathered. Returns 0 while more data is needed; the
+// segment is then held back (dropped, its data kept in the flow's
+// buffer), so nothing of the request leaves before the flow is decided.
+// Returns 1 once the flow can be decided (*host is set if a hostname was
+// found), with the whole request in gathered if segments were held.
+static int gather_request(packet_t *packet, conntrack_entry_t *flow,
+                          char *hostname, size_t hostname_len, const char **host,
+                          gathered_request_t *gathered)
+{
+    const uint8_t *data;
+    size_t len;
+    bool holding = flow->reasm != NULL;
+    
+    if (reassembly_add(flow, packet, &data, &len) < 0) {
+        // Reassembly unavailable or failed: decide without the hostname.
+        // Segments held are lost with the buffer, but nothing acknowledged
+        // them, so the client sends them again.
+        return 1;
+    }
+    
+    // View of the gathered request with this packet's addressing
+    packet_t request = *packet;
+    request.payload = (uint8_t *)data;
+    request.payload_len = len;
+    
+    if (find_request_hostname(&request, flow->request_kind, hostname, hostname_len) == 0) {
+        log_debug("Reassembled %zu bytes to find host %s", len, hostname);
+        *host = hostname;
+    } else if (request_incomplete(&request, flow->request_kind)) {
+        packet->drop = true;
         return 0;
     }
     
-    return -1;
+    if (holding && request_build(packet, flow, data, len, gathered) < 0) {
+        log_debug("Failed to build the gathered request");
+    }
+    return 1;
+}
+
+// Check whether later packets of a flow can skip inspection
+static bool flow_is_decided(const conntrack_entry_t *flow)
+{
+    return flow->state == FLOW_PASSTHROUGH ||
+           (flow->state == FLOW_EVADED && !flow->persistent);
+}
+
+// Record the decision for a flow; once decided, the packet carries the
+// passthrough mark so the kernel stops queueing the connection
+static void flow_decide(packet_t *packet, conntrack_entry_t *flow, flow_state_t state)
+{
+    if (!flow) {
+        return;
+    }
+    
+    reassembly_release(flow);
+    
+    // Persistent HTTP flows stay evaded between requests
+    if (flow->state != FLOW_EVADED) {
+        flow->state = state;
+        flow->persistent = state == FLOW_EVADED && config.fragment_http_persistent &&
+                           (packet_port_class(packet) & PORT_CLASS_HTTP);
+    }
+    
+    if (flow_is_decided(flow) && config.connmark_passthrough) {
+        packet->mark = PASSTHROUGH_MARK;
+    }
 }
 
-// Helper function to add additional space
-static int apply_additional_space(uint8_t *payload, size_t payload_len)
+// Gather the ClientHello from a QUIC Initial's CRYPTO frames and look for
+// the SNI. Returns 0 while more Initials are needed, 1 once the flow can
+// be decided (*host is set if the SNI was found).
+static int gather_quic_hello(const packet_t *packet, conntrack_entry_t *flow,
+                             char *hostname, size_t hostname_len, const char **host)
 {
-    (void)payload_len;
-    char *host_pos = find_host_header(payload, payload_len);
-    if (!host_pos) return -1;
+    uint8_t plain[QUIC_MAX_INITIAL];
+    size_t plain_len, num_frames;
+    quic_crypto_frame_t frames[QUIC_MAX_CRYPTO_FRAMES];
+    
+    if (quic_decrypt_initial(packet->payload, packet->payload_len, plain, sizeof(plain), &plain_len) < 0 ||
+        quic_crypto_frames(plain, plain_len, frames, QUIC_MAX_CRYPTO_FRAMES, &num_frames) < 0 ||
+        num_frames == 0) {
+        return 1;
+    }
+    
+    // The CRYPTO stream is gathered in the flow's buffer, so a ClientHello
+    // spread over several Initials (e.g. post-quantum key shares) is seen whole
+    const uint8_t *stream = NULL;
+    size_t stream_len = 0;
+    for (size_t i = 0; i < num_frames; i++) {
+        if (frames[i].len == 0) {
+            continue;
+        }
+        if (frames[i].offset > UINT32_MAX ||
+            reassembly_add_at(flow, (uint32_t)frames[i].offset, frames[i].data, frames[i].len,
+                              &stream, &stream_len) < 0) {
+            stream = NULL;
+            break;
+        }
+    }
     
-    // Add extra space after "Host:" by shifting right
-    char *insert_pos = host_pos + 5;
-    size_t remaining_len = strlen(insert_pos) + 1;
+    // Without a buffer, a ClientHello in a single frame can still be read
+    if (!stream && frames[0].offset == 0) {
+        stream = frames[0].data;
+        stream_len = frames[0].len;
+    }
+    if (!stream) {
+        return 1;
+    }
     
-    // Make sure we have room (this is simplified - in production would need buffer management)
-    if (remaining_len > 0) {
-        memmove(insert_pos + 1, insert_pos, remaining_len);
-        *insert_pos = ' ';
-        log_debug("Added additional space after Host:");
+    int result = evasion_extract_handshake_sni(stream, stream_len, hostname, hostname_len);
+    if (result == 1) {
+        return flow && flow->reasm ? 0 : 1;
+    }
+    if (result == 0) {
+        *host = hostname;
+    }
+    return 1;
+}
+
+// QUIC (HTTP/3) blocking by host. Connections to hosts selected by the
+// host lists are dropped so the browser falls back to TCP, where they are
+// evaded; others pass untouched. Blocking every host is left to a kernel
+// rule (see firewall_setup_quic), but is still done here should QUIC be
+// queued without host lists or Initial decryption.
+static int process_quic(packet_t *packet)
+{
+    conntrack_entry_t *flow = conntrack_get(packet, true);
+    
+    if (flow && flow->state == FLOW_BLOCKED) {
+        packet->drop = true;
+        return 1;
+    }
+    
+    if (flow && flow_is_decided(flow)) {
+        flow_decide(packet, flow, flow->state);
         return 0;
     }
     
-    return -1;
+    bool block = true;
+    
+    if (blackwhitelist_enabled() && quic_decryption_available()) {
+        char hostname[MAX_HOSTNAME_LEN];
+        const char *host = NULL;
+        bool initial = quic_is_initial(packet->payload, packet->payload_len);
+        
+        // Other packets (e.g. 0-RTT) may be sent before the ClientHello is complete
+        if (!initial && flow && flow->state == FLOW_HANDSHAKE) {
+            return 0;
+        }
+        
+        if (initial && gather_quic_hello(packet, flow, hostname, sizeof(hostname), &host) == 0) {
+            flow->state = FLOW_HANDSHAKE;
+            return 0;
+        }
+        
+        block = blackwhitelist_check_hostname(host, host ? strlen(host) : 0);
+        log_debug("QUIC %s: %s", host ? host : "connection without SNI", block ? "blocked" : "passed");
+    }
+    
+    if (!block) {
+        flow_decide(packet, flow, FLOW_PASSTHROUGH);
+        return 0;
+    }
+    
+    flow_decide(packet, flow, FLOW_BLOCKED);
+    packet->drop = true;
+    return 1;
 }
 
 // Core packet processing function
@@ -95,66 +395,154 @@ int packet_process(packet_t *packet)
     log_debug("Processing packet: type=%d, is_ipv6=%d, outbound=%d",
               packet->type, packet->is_ipv6, packet->is_outbound);
     
-    // Apply evasion techniques based on configuration
+    // Ports with no class carry nothing we act on, except for TLS found
+    // by content; only a new flow's first data gets looked at for that
+    uint8_t port_class = packet_port_class(packet);
+    if (port_class == 0 && !(config.tls_any_port && packet_is_tcp(packet))) {
+        return 0;
+    }
     
-    // Skip packets that are too large
-    if (config.max_payload_size > 0 && 
+    // Only outgoing QUIC is queued (see firewall_setup)
+    if ((port_class & PORT_CLASS_QUIC) && config.block_quic && packet->is_outbound) {
+        return process_quic(packet);
+    }
+    
+    // DNS redirection
+    if (packet_is_udp(packet)) {
+        return (port_class & PORT_CLASS_DNS) ? dns_redirect_process_packet(packet) : 0;
+    }
+    
+    // Flows are created by their first outgoing data packet, or by the
+    // SYN-ACK when the server's window scale is needed later; decided
+    // flows are passed on after this one lookup
+    bool has_data = packet->payload && packet->payload_len > 0;
+    int wscale = -1;
+    if (http_persistent_wait() && !packet->is_outbound && (port_class & PORT_CLASS_HTTP)) {
+        wscale = packet_get_tcp_wscale(packet);
+    }
+    conntrack_entry_t *flow = conntrack_get(packet, (packet->is_outbound && has_data) || wscale >= 0);
+    
+    if (flow && wscale >= 0) {
+        flow->server_wscale = (uint8_t)wscale;
+        return 0;
+    }
+    
+    if (flow && flow_is_decided(flow)) {
+        flow_decide(packet, flow, flow->state);
+        return 0;
+    }
+    
+    // Keep-alive HTTP: requests after the first are found by sequence
+    // number, and in wait mode the server's ACKs make the client split them
+    bool follow_up = flow && flow->persistent;
+    if (follow_up && !packet->is_outbound) {
+        return http_persistent_clamp(packet, flow);
+    }
+    
+    // Handshake, ACKs and responses carry nothing to decide on
+    if (!packet->is_outbound || !has_data) {
+        return 0;
+    }
+    
+    if (follow_up && flow->state == FLOW_EVADED && !http_request_starts(packet, flow)) {
+        return 0;
+    }
+    
+    // A segment that continues a request has the kind of the request's
+    // first segment; it is not sniffed again
+    bool gathering = flow && flow->state == FLOW_HANDSHAKE;
+    request_kind_t kind = gathering ? flow->request_kind : request_kind_of(packet, follow_up);
+    
+    // Skip packets that are too large (bulk data); a first flight such as
+    // a post-quantum ClientHello may legitimately fill whole segments
+    bool first_flight = gathering || (kind == REQUEST_TLS && packet->payload[0] == 0x16);
+    if (config.max_payload_size > 0 && !first_flight &&
         packet->payload_len > config.max_payload_size) {
         log_debug("Skipping large packet: payload size=%zu", packet->payload_len);
+        flow_decide(packet, flow, FLOW_PASSTHROUGH);
         return 0;
     }
     
-    int modified = 0;
+    char hostname[MAX_HOSTNAME_LEN];
+    const char *host = NULL;
+    gathered_request_t gathered = { .valid = false };
     
-    // HTTP packet processing
-    if (packet_is_http(packet)) {
-        log_debug("Processing HTTP packet");
-        
-        if (config.host_mixedcase && packet->payload) {
-            if (apply_host_mixedcase(packet->payload, packet->payload_len) == 0) {
-                modified = 1;
-            }
+    if (gathering) {
+        // Next segment of a request split across segments
+        if (gather_request(packet, flow, hostname, sizeof(hostname), &host, &gathered) == 0) {
+            return 0;
         }
-        
-        if (config.host_removespace && packet->payload) {
-            if (apply_host_removespace(packet->payload, packet->payload_len) == 0) {
-                modified = 1;
-            }
+    } else {
+        if (kind == REQUEST_NONE) {
+            flow_decide(packet, flow, FLOW_PASSTHROUGH);
+            return 0;
         }
         
-        if (config.additional_space && packet->payload) {
-            if (apply_additional_space(packet->payload, packet->payload_len) == 0) {
-                modified = 1;
-            }
-        }
-        
-        // HTTP fragmentation
-        if (config.http_fragment_size > 0) {
-            if (evasion_fragment_packet(packet, config.http_fragment_size) == 0) {
-                modified = 1;
+        if (find_request_hostname(packet, kind, hostname, sizeof(hostname)) == 0) {
+            host = hostname;
+        } else if (flow && (follow_up ? !http_persistent_wait() :
+                            blackwhitelist_enabled() || strategy_enabled()) &&
+                   request_incomplete(packet, kind)) {
+            // The decision needs the hostname; gather the rest of the request.
+            // In wait mode the client already splits keep-alive requests at
+            // the clamped window, so those segments are not joined again
+            flow->state = FLOW_HANDSHAKE;
+            flow->request_kind = kind;
+            if (gather_request(packet, flow, hostname, sizeof(hostname), &host, &gathered) == 0) {
+                return 0;
             }
         }
     }
     
-    // HTTPS packet processing
-    else if (packet_is_https(packet)) {
-        log_debug("Processing HTTPS packet");
-        
-        // HTTPS fragmentation
-        if (config.https_fragment_size > 0) {
-            if (evasion_fragment_packet(packet, config.https_fragment_size) == 0) {
-                modified = 1;
-            }
+    // A request gathered from held segments is processed in their place
+    packet_t *request = gathered.valid ? &gathered.packet : packet;
+    
+    // Host lists decide whether this connection is touched at all
+    if (!follow_up && blackwhitelist_enabled() &&
+        !blackwhitelist_check_hostname(host, host ? strlen(host) : 0)) {
+        log_debug("Skipping %s: not selected by host lists", host ? host : "request without host");
+        flow_decide(packet, flow, FLOW_PASSTHROUGH);
+        request_send(packet, &gathered);
+        return 0;
+    }
+    
+    // The flow keeps the profile resolved from its first SNI/Host
+    const strategy_profile_t *profile = strategy_default();
+    if (flow) {
+        if (!flow->profile && host) {
+            flow->profile = strategy_lookup(host, strlen(host));
+            log_debug("Host %s uses profile %s", host, flow->profile->name);
+        }
+        if (flow->profile) {
+            profile = flow->profile;
         }
+    }
+    
+    evasion_ctx_t ctx = {
+        .packet = request,
+        .profile = profile,
+        .flow = flow,
+        .host = host,
+        .follow_up = follow_up,
+    };
+    int modified = 0;
+    
+    // The request's kind was told from its first segment
+    if (kind == REQUEST_HTTP) {
+        log_debug("Processing HTTP request");
         
-        // Fake packet injection
-        if (config.fake_packet) {
-            if (evasion_inject_fake_packet(packet) == 0) {
-                modified = 1;
-            }
+        if (flow) {
+            http_track_request(flow, request, request->payload, request->payload_len);
         }
+        modified = evasion_chain_run(&profile->http_chain, &ctx);
+    } else {
+        log_debug("Processing HTTPS request");
+        modified = evasion_chain_run(&profile->https_chain, &ctx);
     }
     
+    flow_decide(packet, flow, FLOW_EVADED);
+    request_send(packet, &gathered);
+    
     log_debug("Packet processing completed: modified=%d", modified);
     return modified;
-}
\ No newline at end of file
+}
@@ -0,0 +1,152 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include "../include/config.h"
+
+// Evasion chains. Processing a request packet runs classify (packet type,
+// flow lookup) and match (host lists, profile) in packet_process(); what
+// to do with the packet then is a profile's chain for the request kind,
+// a flat array of stage functions built when the profiles are loaded.
+// Only the enabled techniques have a stage, so the per-packet path runs
+// them in order without consulting the configuration. What the stages
+// emit leaves with the verdict (see emit.c).
+
+// Stages, for their statistics
+typedef enum {
+    STAGE_FAKES,
+    STAGE_HTTP_REWRITE,
+    STAGE_FRAGMENT,
+    STAGE_FRAGMENT_FIRST,
+    STAGE_COUNT
+} evasion_stage_id_t;
+
+static const char *const stage_names[STAGE_COUNT] = {
+    "fakes", "http-rewrite", "fragment", "fragment-first"
+};
+
+// Statistics
+static uint64_t chain_runs = 0;
+static uint64_t stage_runs[STAGE_COUNT];
+static uint64_t stage_modified[STAGE_COUNT];
+
+// Emit the profile's fakes ahead of the real data, one per FAKE_* kind,
+// within the injection budget
+static int stage_fakes(evasion_ctx_t *ctx)
+{
+    unsigned int count = (unsigned int)__builtin_popcount((unsigned int)ctx->profile->fake_type);
+    
+    if (!inject_limit_allow(ctx->flow, count)) {
+        log_debug("Fake packets throttled");
+        return 0;
+    }
+    
+    evasion_inject_fake_packet(ctx->packet, ctx->profile);
+    return 0;
+}
+
+// Host mangling; rebuilds raw_packet, which is what gets sent
+static int stage_http_rewrite(evasion_ctx_t *ctx)
+{
+    return http_rewrite_request(ctx->packet) > 0;
+}
+
+// Split the request at the profile's first segment
+static int stage_fragment(evasion_ctx_t *ctx)
+{
+    unsigned int first = strategy_first_segment(ctx->profile, ctx->packet, ctx->host);
+    
+    return evasion_fragment_packet(ctx->packet, ctx->flow, first) == 0;
+}
+
+// Split only a connection's first request: in wait mode the client
+// splits keep-alive requests itself (see http_persistent_clamp)
+static int stage_fragment_first(evasion_ctx_t *ctx)
+{
+    return ctx->follow_up ? 0 : stage_fragment(ctx);
+}
+
+// Append a stage to a chain
+static void evasion_chain_add(evasion_chain_t *chain, evasion_stage_fn stage, evasion_stage_id_t id)
+{
+    if (chain->count < EVASION_MAX_STAGES) {
+        chain->stages[chain->count] = stage;
+        chain->ids[chain->count] = (uint8_t)id;
+        chain->count++;
+    }
+}
+
+// Build a profile's chains from its techniques and the global options
+void evasion_chains_build(strategy_profile_t *profile)
+{
+    evasion_chain_t *http = &profile->http_chain;
+    evasion_chain_t *https = &profile->https_chain;
+    
+    http->count = 0;
+    https->count = 0;
+    
+    if (profile->fake_type != FAKE_NONE) {
+        evasion_chain_add(http, stage_fakes, STAGE_FAKES);
+        evasion_chain_add(https, stage_fakes, STAGE_FAKES);
+    }
+    
+    if (config.host_mixedcase || config.host_uppercase || config.additional_space ||
+        config.host_removespace || config.host_reorder) {
+        evasion_chain_add(http, stage_http_rewrite, STAGE_HTTP_REWRITE);
+    }
+    
+    if (profile->http_fragment_size > 0) {
+        bool wait = config.fragment_http_persistent && !config.fragment_http_persistent_nowait;
+        if (wait) {
+            evasion_chain_add(http, stage_fragment_first, STAGE_FRAGMENT_FIRST);
+        } else {
+            evasion_chain_add(http, stage_fragment, STAGE_FRAGMENT);
+        }
+    }
+    
+    if (profile->https_fragment_size > 0) {
+        evasion_chain_add(https, stage_fragment, STAGE_FRAGMENT);
+    }
+    
+    log_debug("Profile %s: %zu HTTP and %zu HTTPS evasion stages",
+              profile->name, http->count, https->count);
+}
+
+// Run a chain over a request packet, counting what each stage did.
+// Returns 1 if the packet was modified, 0 otherwise.
+int evasion_chain_run(const evasion_chain_t *chain, evasion_ctx_t *ctx)
+{
+    int modified = 0;
+    
+    chain_runs++;
+    for (size_t i = 0; i < chain->count; i++) {
+        int result = chain->stages[i](ctx);
+        
+        stage_runs[chain->ids[i]]++;
+        if (result) {
+            stage_modified[chain->ids[i]]++;
+            modified = 1;
+        }
+    }
+    
+    return modified;
+}
+
+// Log how often each stage ran and modified its packet
+void evasion_chain_log_stats(void)
+{
+    char line[256];
+    size_t used = 0;
+    
+    line[0] = '\0';
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (stage_runs[i] == 0 || used >= sizeof(line)) {
+            continue;
+        }
+        int n = snprintf(line + used, sizeof(line) - used, ", %s %lu (%lu modified)", stage_names[i],
+                         (unsigned long)stage_runs[i], (unsigned long)stage_modified[i]);
+        if (n > 0) {
+            used += (size_t)n;
+        }
+    }
+    
+    log_info("Evasion: %lu requests%s", (unsigned long)chain_runs, line);
+}
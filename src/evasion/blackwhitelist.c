@@ -0,0 +1,351 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include "../include/domain_set.h"
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+// One generation of host lists. Packet workers only ever see a fully
+// built generation; replaced generations are freed after a grace period.
+typedef struct {
+    domain_set_t blacklist;
+    domain_set_t whitelist;
+    bool has_blacklist;
+    bool has_whitelist;
+} host_lists_t;
+
+// Quiet time after the last file event before reloading (milliseconds),
+// so an editor's write-then-rename is picked up once
+#define RELOAD_DEBOUNCE_MS 200
+
+// inotify events that mean a list file has new contents
+#define RELOAD_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+static host_lists_t *current_lists = NULL;
+
+// Reload watcher state
+static pthread_t watcher_thread;
+static bool watcher_running = false;
+static int watcher_stop = 0;
+static int reload_event_fd = -1;
+static int inotify_fd = -1;
+
+// Load one list file (text or compiled) into a fresh set
+static int blackwhitelist_load_set(domain_set_t *set, const char *filename, const char *name)
+{
+    int count = domain_set_open(set, filename, 0);
+    if (count < 0) {
+        return -1;
+    }
+    
+    log_info("Loaded %s: %d domains from %s", name, count, filename);
+    return 0;
+}
+
+// Free a generation
+static void blackwhitelist_free_lists(host_lists_t *lists)
+{
+    if (!lists) {
+        return;
+    }
+    
+    if (lists->has_blacklist) {
+        domain_set_free(&lists->blacklist);
+    }
+    if (lists->has_whitelist) {
+        domain_set_free(&lists->whitelist);
+    }
+    free(lists);
+}
+
+// Build a new generation from the configured files
+static host_lists_t *blackwhitelist_build(void)
+{
+    host_lists_t *lists = calloc(1, sizeof(host_lists_t));
+    if (!lists) {
+        log_error("Failed to allocate host lists");
+        return NULL;
+    }
+    
+    if (config.enable_blacklist && config.blacklist_file[0] != '\0') {
+        if (blackwhitelist_load_set(&lists->blacklist, config.blacklist_file, "blacklist") < 0) {
+            blackwhitelist_free_lists(lists);
+            return NULL;
+        }
+        lists->has_blacklist = true;
+    }
+    
+    if (config.enable_whitelist && config.whitelist_file[0] != '\0') {
+        if (blackwhitelist_load_set(&lists->whitelist, config.whitelist_file, "whitelist") < 0) {
+            blackwhitelist_free_lists(lists);
+            return NULL;
+        }
+        lists->has_whitelist = true;
+    }
+    
+    return lists;
+}
+
+// Publish a generation and free the one it replaces once no packet
+// worker can still be using it
+static void blackwhitelist_publish(host_lists_t *lists)
+{
+    host_lists_t *old = __atomic_exchange_n(&current_lists, lists, __ATOMIC_SEQ_CST);
+    
+    if (old) {
+        qsbr_synchronize();
+        blackwhitelist_free_lists(old);
+    }
+}
+
+// Load the configured blacklist and whitelist
+int blackwhitelist_load(void)
+{
+    if (!config.enable_blacklist && !config.enable_whitelist) {
+        return 0;
+    }
+    
+    host_lists_t *lists = blackwhitelist_build();
+    if (!lists) {
+        return -1;
+    }
+    
+    blackwhitelist_publish(lists);
+    return 0;
+}
+
+// Rebuild the lists off the packet path; on failure the current lists stay
+static void blackwhitelist_reload(void)
+{
+    log_info("Reloading host lists");
+    
+    host_lists_t *lists = blackwhitelist_build();
+    if (!lists) {
+        log_error("Host list reload failed, keeping previous lists");
+        return;
+    }
+    
+    blackwhitelist_publish(lists);
+    log_info("Host lists reloaded");
+}
+
+// Check whether an inotify event concerns one of the list files
+static bool blackwhitelist_event_matches(const struct inotify_event *event)
+{
+    const char *files[] = { config.blacklist_file, config.whitelist_file };
+    
+    if (event->len == 0 || !(event->mask & RELOAD_EVENTS)) {
+        return false;
+    }
+    
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        if (files[i][0] == '\0') {
+            continue;
+        }
+        
+        const char *slash = strrchr(files[i], '/');
+        const char *base = slash ? slash + 1 : files[i];
+        if (strcmp(base, event->name) == 0) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// Drain pending inotify events; returns true if a list file changed
+static bool blackwhitelist_drain_inotify(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t len;
+    
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            changed |= blackwhitelist_event_matches(event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    
+    return changed;
+}
+
+// Watcher thread: reloads on SIGHUP and when a list file is replaced
+static void *blackwhitelist_watcher(void *arg)
+{
+    (void)arg;
+    
+    while (!__atomic_load_n(&watcher_stop, __ATOMIC_ACQUIRE)) {
+        struct pollfd fds[2] = {
+            { .fd = reload_event_fd, .events = POLLIN },
+            { .fd = inotify_fd, .events = POLLIN },
+        };
+        bool reload = false;
+        
+        if (poll(fds, inotify_fd >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Host list watcher poll failed: %s", strerror(errno));
+            break;
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(reload_event_fd, &count, sizeof(count)) == sizeof(count)) {
+                reload = true;
+            }
+        }
+        
+        if (inotify_fd >= 0 && (fds[1].revents & POLLIN) && blackwhitelist_drain_inotify()) {
+            // Let a burst of writes settle before reading the file
+            struct pollfd settle = { .fd = inotify_fd, .events = POLLIN };
+            while (poll(&settle, 1, RELOAD_DEBOUNCE_MS) > 0) {
+                blackwhitelist_drain_inotify();
+            }
+            reload = true;
+        }
+        
+        if (reload && !__atomic_load_n(&watcher_stop, __ATOMIC_ACQUIRE)) {
+            blackwhitelist_reload();
+        }
+    }
+    
+    return NULL;
+}
+
+// Watch the directory holding a list file (catches rename-into-place)
+static void blackwhitelist_watch_file(const char *filename)
+{
+    char path[PATH_MAX];
+    
+    if (filename[0] == '\0') {
+        return;
+    }
+    
+    safe_string_copy(path, filename, sizeof(path));
+    if (inotify_add_watch(inotify_fd, dirname(path), RELOAD_EVENTS) < 0) {
+        log_warning("Cannot watch %s for changes: %s", filename, strerror(errno));
+    }
+}
+
+// Start reloading the lists on SIGHUP and on file changes
+int blackwhitelist_start_watcher(void)
+{
+    if (watcher_running || !current_lists) {
+        return 0;
+    }
+    
+    reload_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (reload_event_fd < 0) {
+        log_error("Failed to create reload eventfd: %s", strerror(errno));
+        return -1;
+    }
+    
+    inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd < 0) {
+        log_warning("inotify unavailable (%s), host lists reload on SIGHUP only", strerror(errno));
+    } else {
+        if (config.enable_blacklist) {
+            blackwhitelist_watch_file(config.blacklist_file);
+        }
+        if (config.enable_whitelist) {
+            blackwhitelist_watch_file(config.whitelist_file);
+        }
+    }
+    
+    __atomic_store_n(&watcher_stop, 0, __ATOMIC_RELEASE);
+    if (pthread_create(&watcher_thread, NULL, blackwhitelist_watcher, NULL) != 0) {
+        log_error("Failed to start host list watcher");
+        blackwhitelist_stop_watcher();
+        return -1;
+    }
+    
+    watcher_running = true;
+    log_info("Watching host lists for changes");
+    return 0;
+}
+
+// Stop the watcher thread
+void blackwhitelist_stop_watcher(void)
+{
+    if (watcher_running) {
+        __atomic_store_n(&watcher_stop, 1, __ATOMIC_RELEASE);
+        blackwhitelist_request_reload();
+        pthread_join(watcher_thread, NULL);
+        watcher_running = false;
+    }
+    
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    if (reload_event_fd >= 0) {
+        close(reload_event_fd);
+        reload_event_fd = -1;
+    }
+}
+
+// Ask the watcher to reload the lists (async-signal-safe)
+void blackwhitelist_request_reload(void)
+{
+    uint64_t one = 1;
+    
+    if (reload_event_fd >= 0) {
+        ssize_t ret = write(reload_event_fd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+// Free both lists
+void blackwhitelist_cleanup(void)
+{
+    blackwhitelist_stop_watcher();
+    
+    host_lists_t *old = __atomic_exchange_n(&current_lists, NULL, __ATOMIC_SEQ_CST);
+    if (old) {
+        qsbr_synchronize();
+        blackwhitelist_free_lists(old);
+    }
+}
+
+// Check whether any host list is active
+bool blackwhitelist_enabled(void)
+{
+    return __atomic_load_n(&current_lists, __ATOMIC_ACQUIRE) != NULL;
+}
+
+// Decide whether circumvention applies to a hostname: whitelisted hosts
+// are always left alone; with a blacklist, only listed hosts are handled.
+// A NULL hostname (none found in the packet) follows --allow-no-sni.
+// Packet workers call this between qsbr_online() and qsbr_offline().
+bool blackwhitelist_check_hostname(const char *host, size_t host_len)
+{
+    const host_lists_t *lists = __atomic_load_n(&current_lists, __ATOMIC_ACQUIRE);
+    
+    if (!lists) {
+        return true;
+    }
+    
+    if (!host || host_len == 0) {
+        return !lists->has_blacklist || config.allow_no_sni;
+    }
+    
+    if (lists->has_whitelist && domain_set_lookup(&lists->whitelist, host, host_len, NULL)) {
+        log_debug("Host %.*s is whitelisted", (int)host_len, host);
+        return false;
+    }
+    
+    if (lists->has_blacklist) {
+        return domain_set_lookup(&lists->blacklist, host, host_len, NULL);
+    }
+    
+    return true;
+}
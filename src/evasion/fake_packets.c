@@ -1,166 +1,424 @@
 #include "../include/goodbyedpi.h"
 #include "../include/logging.h"
+#include "../include/packet.h"
+#include "../include/tls_parser.h"
 #include <string.h>
 #include <stdlib.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
 
-// Create fake TCP reset packet
-int create_fake_reset_packet(const packet_t *original_packet, uint8_t **fake_packet, size_t *fake_packet_len)
+// Fake packets are crafted from templates built once at startup, one per
+// kind and address family: complete IP/TCP packets with the decoy payload
+// in place and a TCP checksum computed with zero addresses, ports and
+// sequence numbers. A fake is a copy of its template with the flow's
+// values patched in and the checksums updated incrementally.
+
+#define FAKE_SNI "www.w3.org"
+#define FAKE_TTL_DEFAULT 64
+#define FAKE_WINDOW 64240
+
+typedef struct {
+    uint8_t data[FAKE_TEMPLATE_SIZE];
+    size_t len;
+    size_t l4_offset;
+} fake_template_t;
+
+static fake_template_t templates[2][FAKE_TEMPLATE_COUNT];  // [is_ipv6][kind]
+static bool templates_ready = false;
+
+// Payload under construction; ok is cleared if it does not fit
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool ok;
+} fake_writer_t;
+
+// Append bytes to a payload
+static void put_bytes(fake_writer_t *w, const void *data, size_t len)
 {
-    if (!original_packet || !fake_packet || !fake_packet_len) {
-        return -1;
+    if (!w->ok || len > w->size - w->len) {
+        w->ok = false;
+        return;
     }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+// Append a byte
+static void put_u8(fake_writer_t *w, uint8_t value)
+{
+    put_bytes(w, &value, 1);
+}
+
+// Append a big-endian 16-bit value
+static void put_u16(fake_writer_t *w, uint16_t value)
+{
+    uint8_t be[2] = { (uint8_t)(value >> 8), (uint8_t)value };
+    put_bytes(w, be, 2);
+}
+
+// Append random bytes
+static void put_random(fake_writer_t *w, size_t len)
+{
+    uint8_t data[32];
     
-    // Allocate space for fake packet
-    *fake_packet_len = original_packet->headers_len;
-    *fake_packet = malloc(*fake_packet_len);
-    if (!*fake_packet) {
-        log_error("Failed to allocate memory for fake packet");
-        return -1;
+    while (len > 0) {
+        size_t n = len < sizeof(data) ? len : sizeof(data);
+        if (getrandom(data, n, 0) != (ssize_t)n) {
+            for (size_t i = 0; i < n; i++) {
+                data[i] = (uint8_t)rand();
+            }
+        }
+        put_bytes(w, data, n);
+        len -= n;
+    }
+}
+
+// Fill in the length field at off (len_size bytes) with the number of
+// bytes written after it
+static void put_length(fake_writer_t *w, size_t off, size_t len_size)
+{
+    if (!w->ok) {
+        return;
     }
     
-    // Copy original headers
-    memcpy(*fake_packet, original_packet->headers, original_packet->headers_len);
-    
-    // Modify TCP header to set RST flag
-    // This is a simplified implementation
-    // Real implementation would need to parse and modify TCP header properly
-    
-    log_debug("Created fake reset packet: %zu bytes", *fake_packet_len);
-    return 0;
+    size_t value = w->len - off - len_size;
+    for (size_t i = 0; i < len_size; i++) {
+        w->buf[off + i] = (uint8_t)(value >> (8 * (len_size - 1 - i)));
+    }
 }
 
-// Create fake HTTP response
-int create_fake_http_response(const packet_t *original_packet, uint8_t **fake_packet, size_t *fake_packet_len)
+// Open an extension and return where its length goes
+static size_t put_extension(fake_writer_t *w, uint16_t type)
 {
-    if (!original_packet || !fake_packet || !fake_packet_len) {
-        return -1;
+    put_u16(w, type);
+    size_t off = w->len;
+    put_u16(w, 0);
+    return off;
+}
+
+// Build a decoy TLS 1.3 ClientHello for FAKE_SNI, shaped like a browser's
+static size_t fake_build_client_hello(uint8_t *buf, size_t size)
+{
+    static const uint16_t ciphers[] = {
+        0x1301, 0x1302, 0x1303, 0xc02b, 0xc02f, 0xc02c, 0xc030,
+        0xcca9, 0xcca8, 0xc013, 0xc014, 0x009c, 0x009d, 0x002f, 0x0035
+    };
+    static const uint16_t groups[] = { 0x001d, 0x0017, 0x0018 };
+    static const uint16_t sig_algs[] = {
+        0x0403, 0x0804, 0x0401, 0x0503, 0x0805, 0x0501, 0x0806, 0x0601
+    };
+    static const uint8_t alpn[] = { 2, 'h', '2', 8, 'h', 't', 't', 'p', '/', '1', '.', '1' };
+    fake_writer_t w = { buf, size, 0, true };
+    size_t record, handshake, list, ext;
+    
+    put_u8(&w, TLS_CONTENT_HANDSHAKE);
+    put_u16(&w, 0x0301);
+    record = w.len;
+    put_u16(&w, 0);
+    
+    put_u8(&w, TLS_HANDSHAKE_CLIENT_HELLO);
+    handshake = w.len;
+    put_u8(&w, 0);
+    put_u16(&w, 0);
+    put_u16(&w, 0x0303);
+    put_random(&w, 32);
+    put_u8(&w, 32);
+    put_random(&w, 32);
+    
+    put_u16(&w, sizeof(ciphers));
+    for (size_t i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); i++) {
+        put_u16(&w, ciphers[i]);
     }
+    put_u8(&w, 1);
+    put_u8(&w, 0);
     
-    const char *fake_response = 
-        "HTTP/1.1 200 OK\r\n"
-        "Content-Type: text/html\r\n"
-        "Content-Length: 0\r\n"
-        "Connection: close\r\n"
-        "\r\n";
+    size_t extensions = w.len;
+    put_u16(&w, 0);
     
-    size_t response_len = strlen(fake_response);
+    ext = put_extension(&w, TLS_EXT_SERVER_NAME);
+    list = w.len;
+    put_u16(&w, 0);
+    put_u8(&w, 0);
+    put_u16(&w, sizeof(FAKE_SNI) - 1);
+    put_bytes(&w, FAKE_SNI, sizeof(FAKE_SNI) - 1);
+    put_length(&w, list, 2);
+    put_length(&w, ext, 2);
     
-    // Allocate space for fake packet (headers + response)
-    *fake_packet_len = original_packet->headers_len + response_len;
-    *fake_packet = malloc(*fake_packet_len);
-    if (!*fake_packet) {
-        log_error("Failed to allocate memory for fake HTTP response");
-        return -1;
+    ext = put_extension(&w, 0x0017);  // extended_master_secret
+    put_length(&w, ext, 2);
+    
+    ext = put_extension(&w, 0xff01);  // renegotiation_info
+    put_u8(&w, 0);
+    put_length(&w, ext, 2);
+    
+    ext = put_extension(&w, 0x000a);  // supported_groups
+    put_u16(&w, sizeof(groups));
+    for (size_t i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+        put_u16(&w, groups[i]);
     }
+    put_length(&w, ext, 2);
     
-    // Copy original headers
-    memcpy(*fake_packet, original_packet->headers, original_packet->headers_len);
+    ext = put_extension(&w, 0x000b);  // ec_point_formats
+    put_u8(&w, 1);
+    put_u8(&w, 0);
+    put_length(&w, ext, 2);
     
-    // Add fake HTTP response
-    memcpy(*fake_packet + original_packet->headers_len, fake_response, response_len);
+    ext = put_extension(&w, TLS_EXT_ALPN);
+    put_u16(&w, sizeof(alpn));
+    put_bytes(&w, alpn, sizeof(alpn));
+    put_length(&w, ext, 2);
     
-    log_debug("Created fake HTTP response: %zu bytes", *fake_packet_len);
-    return 0;
+    ext = put_extension(&w, 0x000d);  // signature_algorithms
+    put_u16(&w, sizeof(sig_algs));
+    for (size_t i = 0; i < sizeof(sig_algs) / sizeof(sig_algs[0]); i++) {
+        put_u16(&w, sig_algs[i]);
+    }
+    put_length(&w, ext, 2);
+    
+    ext = put_extension(&w, 0x0033);  // key_share: one x25519 share
+    put_u16(&w, 2 + 2 + 32);
+    put_u16(&w, 0x001d);
+    put_u16(&w, 32);
+    put_random(&w, 32);
+    put_length(&w, ext, 2);
+    
+    ext = put_extension(&w, 0x002d);  // psk_key_exchange_modes
+    put_u8(&w, 1);
+    put_u8(&w, 1);
+    put_length(&w, ext, 2);
+    
+    ext = put_extension(&w, TLS_EXT_SUPPORTED_VERSIONS);
+    put_u8(&w, 4);
+    put_u16(&w, 0x0304);
+    put_u16(&w, 0x0303);
+    put_length(&w, ext, 2);
+    
+    put_length(&w, extensions, 2);
+    put_length(&w, handshake, 3);
+    put_length(&w, record, 2);
+    
+    return w.ok ? w.len : 0;
 }
 
-// Create fake DNS response
-int create_fake_dns_response(const packet_t *original_packet, uint8_t **fake_packet, size_t *fake_packet_len)
+// Build a decoy HTTP request for FAKE_SNI
+static size_t fake_build_http_request(uint8_t *buf, size_t size)
 {
-    if (!original_packet || !fake_packet || !fake_packet_len) {
-        return -1;
-    }
+    static const char request[] =
+        "GET / HTTP/1.1\r\n"
+        "Host: " FAKE_SNI "\r\n"
+        "User-Agent: Mozilla/5.0\r\n"
+        "Accept: */*\r\n"
+        "\r\n";
     
-    // This would create a fake DNS response
-    // For now, just a placeholder implementation
-    *fake_packet_len = original_packet->headers_len + 64; // Approximate DNS response size
-    *fake_packet = malloc(*fake_packet_len);
-    if (!*fake_packet) {
-        log_error("Failed to allocate memory for fake DNS response");
-        return -1;
+    if (sizeof(request) - 1 > size) {
+        return 0;
     }
+    memcpy(buf, request, sizeof(request) - 1);
+    return sizeof(request) - 1;
+}
+
+// Build a template: IP and TCP headers with zero addresses, ports and
+// sequence numbers around the payload already in place
+static void fake_finish_template(fake_template_t *t, bool is_ipv6, bool rst, size_t payload_len)
+{
+    size_t tcp_len = sizeof(struct tcphdr) + payload_len;
     
-    // Copy original headers
-    memcpy(*fake_packet, original_packet->headers, original_packet->headers_len);
+    t->len = t->l4_offset + tcp_len;
     
-    // Add fake DNS response data (simplified)
-    uint8_t fake_dns[64] = {0};
-    // Set DNS response flags (simplified)
-    fake_dns[2] = 0x81; // Response with recursion available
-    fake_dns[3] = 0x80; // Response code
+    if (is_ipv6) {
+        struct ip6_hdr *ip6_hdr = (struct ip6_hdr *)t->data;
+        ip6_hdr->ip6_flow = htonl(6u << 28);
+        ip6_hdr->ip6_plen = htons((uint16_t)tcp_len);
+        ip6_hdr->ip6_nxt = IPPROTO_TCP;
+        ip6_hdr->ip6_hlim = FAKE_TTL_DEFAULT;
+    } else {
+        struct iphdr *ip_hdr = (struct iphdr *)t->data;
+        ip_hdr->version = 4;
+        ip_hdr->ihl = 5;
+        ip_hdr->tot_len = htons((uint16_t)t->len);
+        ip_hdr->frag_off = htons(IP_DF);
+        ip_hdr->ttl = FAKE_TTL_DEFAULT;
+        ip_hdr->protocol = IPPROTO_TCP;
+    }
     
-    memcpy(*fake_packet + original_packet->headers_len, fake_dns, 64);
+    struct tcphdr *tcp_hdr = (struct tcphdr *)(t->data + t->l4_offset);
+    tcp_hdr->doff = sizeof(struct tcphdr) / 4;
+    tcp_hdr->ack = 1;
+    if (rst) {
+        tcp_hdr->rst = 1;
+    } else {
+        tcp_hdr->psh = 1;
+        tcp_hdr->window = htons(FAKE_WINDOW);
+    }
+    tcp_hdr->check = l4_checksum(t->data, t->len, t->l4_offset, is_ipv6, IPPROTO_TCP);
+}
+
+// Build the fake packet templates
+int fake_templates_init(void)
+{
+    for (int family = 0; family < 2; family++) {
+        bool is_ipv6 = family == 1;
+        size_t l4_offset = is_ipv6 ? sizeof(struct ip6_hdr) : sizeof(struct iphdr);
+        size_t payload_off = l4_offset + sizeof(struct tcphdr);
+        
+        for (int kind = 0; kind < FAKE_TEMPLATE_COUNT; kind++) {
+            fake_template_t *t = &templates[family][kind];
+            size_t payload_len = 0;
+            
+            memset(t, 0, sizeof(*t));
+            t->l4_offset = l4_offset;
+            
+            if (kind == FAKE_TEMPLATE_CLIENT_HELLO) {
+                payload_len = fake_build_client_hello(t->data + payload_off, sizeof(t->data) - payload_off);
+            } else if (kind == FAKE_TEMPLATE_HTTP) {
+                payload_len = fake_build_http_request(t->data + payload_off, sizeof(t->data) - payload_off);
+            }
+            
+            if (payload_len == 0 && kind != FAKE_TEMPLATE_RST) {
+                log_error("Failed to build fake packet template %d", kind);
+                return -1;
+            }
+            
+            fake_finish_template(t, is_ipv6, kind == FAKE_TEMPLATE_RST, payload_len);
+        }
+    }
     
-    log_debug("Created fake DNS response: %zu bytes", *fake_packet_len);
+    templates_ready = true;
+    log_debug("Fake packet templates built (decoy host %s)", FAKE_SNI);
     return 0;
 }
 
-// Inject fake packet into network
-int evasion_inject_fake_packet(const packet_t *original_packet)
+// Craft a fake packet for the flow of a TCP packet: the template's copy
+// gets the packet's addresses, ports and sequence numbers and the given
+// TTL. Returns the fake's length, or -1 on error.
+int fake_packet_build(const packet_t *original_packet, fake_template_kind_t kind, uint8_t ttl,
+                      uint8_t *out, size_t out_size)
 {
-    uint8_t *fake_packet = NULL;
-    size_t fake_packet_len = 0;
-    int result = -1;
+    static const uint32_t zero[4];
+    uint32_t seq, ack;
     
-    if (!original_packet) {
+    if (!templates_ready || !original_packet || !out || kind >= FAKE_TEMPLATE_COUNT ||
+        packet_get_tcp_seq(original_packet, &seq, &ack) < 0) {
         return -1;
     }
     
-    // Determine type of fake packet to create based on original packet
-    if (original_packet->type == PACKET_IPV4_TCP || original_packet->type == PACKET_IPV6_TCP) {
-        if (config.fake_packet) {
-            result = create_fake_reset_packet(original_packet, &fake_packet, &fake_packet_len);
-        }
-    } else if (original_packet->type == PACKET_IPV4_UDP_DATA || original_packet->type == PACKET_IPV6_UDP_DATA) {
-        if (original_packet->src_port == 53 || original_packet->dst_port == 53) {
-            result = create_fake_dns_response(original_packet, &fake_packet, &fake_packet_len);
-        }
+    const fake_template_t *t = &templates[original_packet->is_ipv6][kind];
+    if (t->len > out_size) {
+        return -1;
     }
     
-    if (result == 0 && fake_packet && fake_packet_len > 0) {
-        // Send fake packet using raw socket
-        result = send_raw_packet(fake_packet, fake_packet_len, original_packet->is_ipv6);
-        
-        if (result == 0) {
-            log_info("Successfully injected fake packet");
-        } else {
-            log_error("Failed to inject fake packet");
-        }
-    }
+    memcpy(out, t->data, t->len);
     
-    // Cleanup
-    if (fake_packet) {
-        free(fake_packet);
+    if (original_packet->is_ipv6) {
+        struct ip6_hdr *ip6_hdr = (struct ip6_hdr *)out;
+        memcpy(&ip6_hdr->ip6_src, original_packet->src_ip, sizeof(ip6_hdr->ip6_src));
+        memcpy(&ip6_hdr->ip6_dst, original_packet->dst_ip, sizeof(ip6_hdr->ip6_dst));
+        ip6_hdr->ip6_hlim = ttl;
+    } else {
+        struct iphdr *ip_hdr = (struct iphdr *)out;
+        ip_hdr->saddr = original_packet->src_ip[0];
+        ip_hdr->daddr = original_packet->dst_ip[0];
+        ip_hdr->ttl = ttl;
+        ip_hdr->check = ip_checksum(ip_hdr, sizeof(*ip_hdr));
     }
     
-    return result;
+    // The template's checksum covers zeros wherever a value is patched in
+    struct tcphdr *tcp_hdr = (struct tcphdr *)(out + t->l4_offset);
+    uint16_t csum = tcp_hdr->check;
+    
+    csum = checksum_update_addr(csum, zero, original_packet->src_ip, original_packet->is_ipv6);
+    csum = checksum_update_addr(csum, zero, original_packet->dst_ip, original_packet->is_ipv6);
+    tcp_hdr->source = htons(original_packet->src_port);
+    tcp_hdr->dest = htons(original_packet->dst_port);
+    tcp_hdr->seq = htonl(seq);
+    tcp_hdr->ack_seq = htonl(ack);
+    csum = checksum_update_16(csum, 0, tcp_hdr->source);
+    csum = checksum_update_16(csum, 0, tcp_hdr->dest);
+    csum = checksum_update_32(csum, 0, tcp_hdr->seq);
+    csum = checksum_update_32(csum, 0, tcp_hdr->ack_seq);
+    tcp_hdr->check = csum;
+    
+    return (int)t->len;
+}
+
+// Template for the decoy that matches the packet's protocol
+static fake_template_kind_t fake_kind_for(const packet_t *original_packet)
+{
+    return packet_is_http(original_packet) ? FAKE_TEMPLATE_HTTP : FAKE_TEMPLATE_CLIENT_HELLO;
 }
 
 // Send fake packet with specific TTL
 int send_fake_packet_with_ttl(const packet_t *original_packet, uint8_t ttl)
 {
-    uint8_t *fake_packet = NULL;
-    size_t fake_packet_len = 0;
-    int result = -1;
+    uint8_t fake_packet[FAKE_TEMPLATE_SIZE];
     
     if (!original_packet) {
         return -1;
     }
     
-    result = create_fake_reset_packet(original_packet, &fake_packet, &fake_packet_len);
-    if (result != 0) {
-        return result;
+    int len = fake_packet_build(original_packet, fake_kind_for(original_packet), ttl,
+                                fake_packet, sizeof(fake_packet));
+    if (len < 0) {
+        return -1;
     }
     
-    // Modify TTL in IP header (simplified)
-    // Real implementation would need to parse IP header properly
-    
-    // Send packet
-    result = send_raw_packet(fake_packet, fake_packet_len, original_packet->is_ipv6);
-    
+    int result = send_raw_packet(fake_packet, (size_t)len, original_packet->is_ipv6);
     if (result == 0) {
         log_debug("Sent fake packet with TTL: %d", ttl);
     }
-    
-    free(fake_packet);
     return result;
-}
\ No newline at end of file
+}
+
+// Queue the profile's fake packets ahead of the real data: one per
+// FAKE_* kind set, emitted together with it (see emit.c). A TTL fake
+// expires before the server; bad-checksum and bad-sequence fakes keep the
+// real packet's TTL and are discarded by the server itself.
+int evasion_inject_fake_packet(const packet_t *original_packet, const strategy_profile_t *profile)
+{
+    uint8_t fake[FAKE_TEMPLATE_SIZE];
+    size_t count = 0;
+    
+    if (!original_packet || !profile || !packet_is_tcp(original_packet)) {
+        return -1;
+    }
+    
+    fake_template_kind_t kind = fake_kind_for(original_packet);
+    uint8_t ttl = profile->fake_ttl ? profile->fake_ttl : config.ttl_of_fake_packet;
+    size_t l4_offset = templates[original_packet->is_ipv6][kind].l4_offset;
+    
+    if (profile->fake_type & FAKE_TTL) {
+        int len = fake_packet_build(original_packet, kind, ttl, fake, sizeof(fake));
+        if (len < 0 || emit_packet(fake, (size_t)len) < 0) {
+            return -1;
+        }
+        count++;
+    }
+    
+    if (profile->fake_type & FAKE_BADSUM) {
+        int len = fake_packet_build(original_packet, kind, original_packet->ttl, fake, sizeof(fake));
+        if (len < 0 || apply_wrong_checksum(fake, (size_t)len, l4_offset) < 0 ||
+            emit_packet(fake, (size_t)len) < 0) {
+            return -1;
+        }
+        count++;
+    }
+    
+    if (profile->fake_type & FAKE_BADSEQ) {
+        int len = fake_packet_build(original_packet, kind, original_packet->ttl, fake, sizeof(fake));
+        if (len < 0 || apply_wrong_sequence(fake, (size_t)len, l4_offset) < 0 ||
+            emit_packet(fake, (size_t)len) < 0) {
+            return -1;
+        }
+        count++;
+    }
+    
+    if (count > 0) {
+        log_debug("Queued %zu fake packets (kinds %#x)", count, (unsigned int)profile->fake_type);
+    }
+    return 0;
+}
@@ -11,23 +11,45 @@
 // External configuration
 extern goodbyedpi_config_t config;
 
-// Fragment packet
-int evasion_fragment_packet(packet_t *packet, unsigned int fragment_size)
+// Split a TCP request after its first `first` payload bytes. The head
+// goes out as a segment of its own (several if it exceeds the packet's
+// max_segment), emitted ahead of the verdict (see emit.c); the packet
+// keeps the rest, its sequence number moved past the
+// head, so it still leaves through its verdict. The extra segment is
+// charged to the flow's injection budget (NULL: no flow). Returns 0 if
+// the packet was split, -1 if it was left as it was.
+int evasion_fragment_packet(packet_t *packet, conntrack_entry_t *flow, unsigned int first)
 {
-    if (!packet || !packet->raw_packet || fragment_size == 0) {
+    uint32_t seq;
+    
+    if (!packet || !packet->raw_packet || !packet->payload || first == 0 ||
+        first >= packet->payload_len ||
+        packet->raw_packet_len != packet->headers_len + packet->payload_len ||
+        packet_get_tcp_seq(packet, &seq, NULL) < 0) {
+        return -1;
+    }
+    
+    if (!inject_limit_allow(flow, 1)) {
+        log_debug("Fragmentation throttled");
+        return -1;
+    }
+    
+    if (emit_tcp_segments(packet, 0, first) < 0) {
         return -1;
     }
     
-    log_debug("Fragmenting packet: size=%u, fragment=%u", 
-             packet->raw_packet_len, fragment_size);
+    uint8_t *raw = packet->raw_packet;
+    size_t headers_len = packet->headers_len;
+    size_t rest = packet->payload_len - first;
+    memmove(raw + headers_len, raw + headers_len + first, rest);
+    memmove(packet->payload, packet->payload + first, rest);
+    packet->raw_packet_len = headers_len + rest;
+    packet->payload_len = rest;
     
-    // This is a simplified implementation
-    // Real fragmentation would require:
-    // 1. Split packet data
-    // 2. Create multiple IP fragments with appropriate headers
-    // 3. Modify fragment offsets and flags
-    // 4. Recalculate checksums
+    struct tcphdr *tcp_hdr = (struct tcphdr *)(raw + packet->l4_offset);
+    tcp_hdr->seq = htonl(seq + first);
+    packet_finalize_tcp(raw, packet->raw_packet_len, packet->l4_offset, packet->is_ipv6);
     
-    // For now, just return success to indicate we would fragment
+    log_debug("Fragmented request: %u + %zu bytes", first, rest);
     return 0;
-}
\ No newline at end of file
+}
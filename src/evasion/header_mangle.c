@@ -1,7 +1,14 @@
 #include "../include/goodbyedpi.h"
 #include "../include/logging.h"
+#include "../include/packet.h"
 #include <string.h>
 #include <stdlib.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+#define WRONG_CHECKSUM_XOR 0x5a5a
+#define WRONG_SEQ_OFFSET 10000
+#define WRONG_ACK_OFFSET 66000
 
 // Modify HTTP headers for evasion
 int evasion_modify_headers(packet_t *packet)
@@ -15,9 +22,10 @@ int evasion_modify_headers(packet_t *packet)
         return -1;
     }
     
-    // Check if this is HTTP traffic (port 80) or HTTPS (port 443)
-    bool is_http = (packet->dst_port == 80 || packet->src_port == 80);
-    bool is_https = (packet->dst_port == 443 || packet->src_port == 443);
+    // Check if this is HTTP or HTTPS traffic by the server's port
+    uint8_t port_class = packet_port_class(packet);
+    bool is_http = (port_class & PORT_CLASS_HTTP) != 0;
+    bool is_https = (port_class & PORT_CLASS_TLS) != 0;
     
     if (!is_http && !is_https) {
         return -1; // Not HTTP/HTTPS traffic
@@ -35,54 +43,7 @@ int evasion_modify_headers(packet_t *packet)
 // Modify HTTP headers specifically
 int modify_http_headers(packet_t *packet)
 {
-    char *payload = (char *)packet->payload;
-    size_t payload_len = packet->payload_len;
-    
-    // Look for Host header
-    char *host_header = strstr(payload, "\r\nHost:");
-    if (!host_header) {
-        return -1; // No Host header found
-    }
-    
-    // Apply evasion techniques based on configuration
-    if (config.host_mixedcase) {
-        // Mix case in Host header
-        char *host_start = host_header + 7; // Skip "\r\nHost:"
-        char *host_end = strstr(host_start, "\r\n");
-        if (host_end) {
-            mix_case(host_start, host_end - host_start);
-        }
-    }
-    
-    if (config.additional_space) {
-        // Add additional space after Host header name
-        if (payload_len >= 7 && strncmp(host_header, "\r\nHost:", 7) == 0) {
-            // Insert space: "\r\nHost: " -> "\r\nHost:  "
-            memmove(host_header + 8, host_header + 7, payload_len - (host_header - payload) - 7);
-            host_header[7] = ' ';
-            host_header[8] = ' ';
-            packet->payload_len += 1;
-        }
-    }
-    
-    if (config.host_removespace) {
-        // Remove space after Host header name
-        if (payload_len >= 8 && strncmp(host_header, "\r\nHost: ", 8) == 0) {
-            memmove(host_header + 7, host_header + 8, payload_len - (host_header - payload) - 8);
-            packet->payload_len -= 1;
-        }
-    }
-    
-    if (config.host_uppercase) {
-        // Make Host header uppercase
-        char *host_start = host_header + 7; // Skip "\r\nHost:"
-        char *host_end = strstr(host_start, "\r\n");
-        if (host_end) {
-            string_to_upper(host_start);
-        }
-    }
-    
-    return 0;
+    return http_rewrite_request(packet) < 0 ? -1 : 0;
 }
 
 // Modify TCP headers
@@ -93,26 +54,37 @@ int modify_tcp_headers(packet_t *packet)
     return 0;
 }
 
-// Apply wrong checksum for evasion
-int apply_wrong_checksum(packet_t *packet)
+// Corrupt the TCP checksum of a fake packet: the server drops it, while
+// a DPI box that does not verify checksums still takes it in. XOR with a
+// constant cannot turn 0x0000 into the equivalent 0xFFFF.
+int apply_wrong_checksum(uint8_t *raw, size_t raw_len, size_t l4_offset)
 {
-    if (!packet || !packet->raw_packet) {
+    if (!raw || l4_offset + sizeof(struct tcphdr) > raw_len) {
         return -1;
     }
     
-    // This would intentionally corrupt checksums
-    // Implementation depends on packet structure
+    struct tcphdr *tcp_hdr = (struct tcphdr *)(raw + l4_offset);
+    tcp_hdr->check ^= htons(WRONG_CHECKSUM_XOR);
     return 0;
 }
 
-// Apply wrong sequence numbers
-int apply_wrong_sequence(packet_t *packet)
+// Move a fake packet's sequence numbers into the past, outside the
+// server's receive window, so the server discards it while a DPI box that
+// does not follow the window still reassembles it (the offsets are
+// GoodbyeDPI's). The checksum is kept valid.
+int apply_wrong_sequence(uint8_t *raw, size_t raw_len, size_t l4_offset)
 {
-    if (!packet || !packet->raw_packet) {
+    if (!raw || l4_offset + sizeof(struct tcphdr) > raw_len) {
         return -1;
     }
     
-    // This would modify TCP sequence numbers
-    // Implementation depends on packet structure
+    struct tcphdr *tcp_hdr = (struct tcphdr *)(raw + l4_offset);
+    uint32_t seq = htonl(ntohl(tcp_hdr->seq) - WRONG_SEQ_OFFSET);
+    uint32_t ack = htonl(ntohl(tcp_hdr->ack_seq) - WRONG_ACK_OFFSET);
+    
+    tcp_hdr->check = checksum_update_32(tcp_hdr->check, tcp_hdr->seq, seq);
+    tcp_hdr->check = checksum_update_32(tcp_hdr->check, tcp_hdr->ack_seq, ack);
+    tcp_hdr->seq = seq;
+    tcp_hdr->ack_seq = ack;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,162 @@
+#include "../include/http_parser.h"
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Find the next LF at or after pos; len if there is none
+static size_t http_find_lf(const uint8_t *data, size_t pos, size_t len)
+{
+#ifdef __SSE2__
+    // 16 bytes per step; SSE2 is always there on x86-64
+    const __m128i lf = _mm_set1_epi8('\n');
+    
+    while (pos + 16 <= len) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + pos));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+        if (mask) {
+            return pos + (size_t)__builtin_ctz((unsigned int)mask);
+        }
+        pos += 16;
+    }
+#endif
+
+    while (pos < len && data[pos] != '\n') {
+        pos++;
+    }
+    return pos;
+}
+
+// Compare a header name case-insensitively; name is lowercase
+static bool http_name_equal(const uint8_t *p, const char *name, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = p[i];
+        if (c >= 'A' && c <= 'Z') {
+            c |= 0x20;
+        }
+        if (c != (uint8_t)name[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Record a header line whose name (including the colon) is name_len long
+static void http_set_header(http_header_t *header, const uint8_t *data, size_t line_off,
+                            size_t name_len, size_t line_end)
+{
+    size_t value = line_off + name_len;
+    size_t value_end = line_end;
+    
+    while (value < value_end && (data[value] == ' ' || data[value] == '\t')) {
+        value++;
+    }
+    while (value_end > value && (data[value_end - 1] == ' ' || data[value_end - 1] == '\t')) {
+        value_end--;
+    }
+    
+    header->found = true;
+    header->line_off = (uint32_t)line_off;
+    header->value_off = (uint32_t)value;
+    header->value_len = (uint32_t)(value_end - value);
+    header->line_end = (uint32_t)line_end;
+}
+
+// Locate the request line and the headers we use of an HTTP request in
+// one pass over the headers. Only lines terminated inside the payload are
+// considered; the first of each header wins. Returns 0 if the request
+// line is complete, -1 otherwise.
+int http_parse_request(const uint8_t *data, size_t len, http_request_t *req)
+{
+    if (!data || !req || len > UINT32_MAX) {
+        return -1;
+    }
+    
+    memset(req, 0, sizeof(*req));
+    
+    // Request line: method SP request-target [SP version]
+    size_t eol = http_find_lf(data, 0, len);
+    if (eol == len) {
+        return -1;
+    }
+    
+    size_t line_end = (eol > 0 && data[eol - 1] == '\r') ? eol - 1 : eol;
+    const uint8_t *space = memchr(data, ' ', line_end);
+    if (!space || space == data) {
+        return -1;
+    }
+    
+    req->method_len = (uint32_t)(space - data);
+    req->uri_off = req->method_len + 1;
+    
+    const uint8_t *uri_end = memchr(data + req->uri_off, ' ', line_end - req->uri_off);
+    req->uri_len = (uint32_t)((uri_end ? (size_t)(uri_end - data) : line_end) - req->uri_off);
+    if (req->uri_len == 0) {
+        return -1;
+    }
+    req->request_line_end = (uint32_t)line_end;
+    
+    for (size_t pos = eol + 1; pos < len; pos = eol + 1) {
+        eol = http_find_lf(data, pos, len);
+        if (eol == len) {
+            break;
+        }
+        
+        line_end = (eol > pos && data[eol - 1] == '\r') ? eol - 1 : eol;
+        
+        // Blank line ends the headers
+        if (line_end == pos) {
+            req->headers_end = (uint32_t)(eol + 1);
+            break;
+        }
+        
+        size_t line_len = line_end - pos;
+        if (!req->host.found && line_len >= 5 && http_name_equal(data + pos, "host:", 5)) {
+            http_set_header(&req->host, data, pos, 5, line_end);
+        } else if (!req->user_agent.found && line_len >= 11 &&
+                   http_name_equal(data + pos, "user-agent:", 11)) {
+            http_set_header(&req->user_agent, data, pos, 11, line_end);
+        } else if (!req->content_length.found && line_len >= 15 &&
+                   http_name_equal(data + pos, "content-length:", 15)) {
+            http_set_header(&req->content_length, data, pos, 15, line_end);
+        } else if (!req->transfer_encoding.found && line_len >= 18 &&
+                   http_name_equal(data + pos, "transfer-encoding:", 18)) {
+            http_set_header(&req->transfer_encoding, data, pos, 18, line_end);
+        }
+    }
+    
+    return 0;
+}
+
+// Length of a request's body as its headers give it (RFC 9112, 6.3): the
+// Content-Length, or none at all. Returns -1 if it is not known up front
+// (Transfer-Encoding, or an invalid Content-Length).
+int http_body_length(const uint8_t *data, const http_request_t *req, uint64_t *len)
+{
+    const http_header_t *cl = &req->content_length;
+    
+    *len = 0;
+    
+    if (req->transfer_encoding.found) {
+        return -1;
+    }
+    
+    if (!cl->found) {
+        return 0;
+    }
+    
+    if (cl->value_len == 0 || cl->value_len > 15) {
+        return -1;
+    }
+    
+    for (size_t i = cl->value_off; i < (size_t)cl->value_off + cl->value_len; i++) {
+        if (data[i] < '0' || data[i] > '9') {
+            return -1;
+        }
+        *len = *len * 10 + (data[i] - '0');
+    }
+    
+    return 0;
+}
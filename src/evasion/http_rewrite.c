@@ -0,0 +1,235 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include "../include/packet.h"
+#include "../include/http_parser.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Host mangling is planned as a list of edits against the original payload
+// and applied in one pass while the packet is rebuilt, so no edit has to
+// shift the ones after it and the result always reaches the wire.
+
+#define HTTP_MAX_EDITS 8
+#define HTTP_EDIT_SCRATCH 1024
+
+// Replace del_len bytes at off with ins_len bytes of scratch
+typedef struct {
+    uint32_t off;
+    uint32_t del_len;
+    uint16_t ins_off;
+    uint16_t ins_len;
+} http_edit_t;
+
+typedef struct {
+    http_edit_t edits[HTTP_MAX_EDITS];
+    size_t count;
+    long delta;                 // Net change of the payload length
+    uint8_t scratch[HTTP_EDIT_SCRATCH];
+    size_t scratch_len;
+} http_edit_list_t;
+
+static const char spaces[] = "                ";
+
+// Append an edit; edits must come in payload order and must not overlap
+static int http_edit_add(http_edit_list_t *list, size_t off, size_t del_len,
+                         const void *ins, size_t ins_len)
+{
+    if (del_len == 0 && ins_len == 0) {
+        return 0;
+    }
+    
+    if (list->count == HTTP_MAX_EDITS || ins_len > HTTP_EDIT_SCRATCH - list->scratch_len) {
+        return -1;
+    }
+    
+    if (list->count > 0) {
+        const http_edit_t *prev = &list->edits[list->count - 1];
+        if (off < (size_t)prev->off + prev->del_len) {
+            return -1;
+        }
+    }
+    
+    http_edit_t *edit = &list->edits[list->count++];
+    edit->off = (uint32_t)off;
+    edit->del_len = (uint32_t)del_len;
+    edit->ins_off = (uint16_t)list->scratch_len;
+    edit->ins_len = (uint16_t)ins_len;
+    if (ins_len > 0) {
+        memcpy(list->scratch + list->scratch_len, ins, ins_len);
+        list->scratch_len += ins_len;
+    }
+    list->delta += (long)ins_len - (long)del_len;
+    return 0;
+}
+
+// Copy the Host value with the configured case changes applied. Returns
+// true if it differs from the original.
+static bool http_host_case(const uint8_t *value, size_t len, char *out)
+{
+    memcpy(out, value, len);
+    
+    if (config.host_mixedcase) {
+        mix_case(out, len);
+    }
+    
+    if (config.host_uppercase) {
+        for (size_t i = 0; i < len; i++) {
+            out[i] = toupper((unsigned char)out[i]);
+        }
+    }
+    
+    return memcmp(out, value, len) != 0;
+}
+
+// Plan the Host edits for the configured options. The request keeps its
+// length so the TCP sequence space stays in step with the sender: spaces
+// taken from after "Host:" pay for the one added after the method, and
+// the rest move behind the value, where they are optional whitespace.
+static int http_plan_edits(const uint8_t *data, const http_request_t *req, http_edit_list_t *list)
+{
+    const http_header_t *host = &req->host;
+    size_t name_end = host->line_off + 5;
+    size_t ws_len = host->value_off - name_end;
+    size_t value_end = host->value_off + host->value_len;
+    char value[HTTP_EDIT_SCRATCH / 2];
+    
+    if (host->value_len > sizeof(value) || ws_len > sizeof(spaces) - 1) {
+        return -1;
+    }
+    
+    list->count = 0;
+    list->delta = 0;
+    list->scratch_len = 0;
+    
+    bool add_space = config.additional_space && ws_len > 0;
+    size_t removed = (config.host_removespace || add_space) ? ws_len : 0;
+    size_t pad = removed - (add_space ? 1 : 0);
+    bool recase = http_host_case(data + host->value_off, host->value_len, value);
+    
+    // "GET  /" keeps the request valid for servers but not for naive matchers
+    if (add_space && http_edit_add(list, req->method_len, 0, " ", 1) < 0) {
+        return -1;
+    }
+    
+    // Start of the line after Host and of the blank line ending the headers
+    size_t next_line = data[host->line_end] == '\r' ? host->line_end + 2 : host->line_end + 1;
+    size_t blank = 0;
+    if (req->headers_end) {
+        blank = req->headers_end - (data[req->headers_end - 2] == '\r' ? 2 : 1);
+    }
+    
+    if (!config.host_reorder || req->headers_end == 0 || next_line == blank) {
+        if (http_edit_add(list, name_end, removed, NULL, 0) < 0 ||
+            (recase && http_edit_add(list, host->value_off, host->value_len,
+                                     value, host->value_len) < 0) ||
+            http_edit_add(list, value_end, 0, spaces, pad) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+    
+    // Move the whole Host line to the end of the headers
+    uint8_t line[HTTP_EDIT_SCRATCH / 2];
+    size_t line_len = 0;
+    
+    if (next_line - host->line_off + pad > sizeof(line)) {
+        return -1;
+    }
+    
+    memcpy(line, data + host->line_off, 5);
+    line_len = 5;
+    memcpy(line + line_len, data + name_end + removed, ws_len - removed);
+    line_len += ws_len - removed;
+    memcpy(line + line_len, recase ? (const uint8_t *)value : data + host->value_off, host->value_len);
+    line_len += host->value_len;
+    memcpy(line + line_len, spaces, pad);
+    line_len += pad;
+    memcpy(line + line_len, data + value_end, next_line - value_end);
+    line_len += next_line - value_end;
+    
+    if (http_edit_add(list, host->line_off, next_line - host->line_off, NULL, 0) < 0 ||
+        http_edit_add(list, blank, 0, line, line_len) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Rebuild the packet with the edits applied: the headers and the new
+// payload are written once into a fresh buffer, then lengths and
+// checksums are fixed
+static int http_apply_edits(packet_t *packet, const http_edit_list_t *list)
+{
+    size_t payload_len = (size_t)((long)packet->payload_len + list->delta);
+    size_t raw_len = packet->headers_len + payload_len;
+    
+    if (raw_len > UINT16_MAX) {
+        return -1;
+    }
+    
+    uint8_t *raw = malloc(raw_len);
+    uint8_t *payload = malloc(payload_len);
+    if (!raw || !payload) {
+        free(raw);
+        free(payload);
+        return -1;
+    }
+    
+    memcpy(raw, packet->raw_packet, packet->headers_len);
+    
+    uint8_t *out = raw + packet->headers_len;
+    size_t pos = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        const http_edit_t *edit = &list->edits[i];
+        memcpy(out, packet->payload + pos, edit->off - pos);
+        out += edit->off - pos;
+        memcpy(out, list->scratch + edit->ins_off, edit->ins_len);
+        out += edit->ins_len;
+        pos = edit->off + edit->del_len;
+    }
+    memcpy(out, packet->payload + pos, packet->payload_len - pos);
+    
+    packet_finalize_tcp(raw, raw_len, packet->l4_offset, packet->is_ipv6);
+    memcpy(payload, raw + packet->headers_len, payload_len);
+    
+    free(packet->raw_packet);
+    free(packet->payload);
+    packet->raw_packet = raw;
+    packet->raw_packet_len = raw_len;
+    packet->payload = payload;
+    packet->payload_len = payload_len;
+    return 0;
+}
+
+// Apply the configured Host mangling to an HTTP request. Returns 1 if the
+// packet was rewritten, 0 if there was nothing to change, -1 on error.
+int http_rewrite_request(packet_t *packet)
+{
+    http_request_t req;
+    http_edit_list_t list;
+    
+    if (!packet || !packet->payload || !packet->raw_packet ||
+        packet->raw_packet_len != packet->headers_len + packet->payload_len) {
+        return -1;
+    }
+    
+    if (http_parse_request(packet->payload, packet->payload_len, &req) < 0 || !req.host.found) {
+        return 0;
+    }
+    
+    if (http_plan_edits(packet->payload, &req, &list) < 0) {
+        log_debug("Host header too long to rewrite");
+        return -1;
+    }
+    
+    if (list.count == 0) {
+        return 0;
+    }
+    
+    if (http_apply_edits(packet, &list) < 0) {
+        return -1;
+    }
+    
+    log_debug("Rewrote HTTP request with %zu edits", list.count);
+    return 1;
+}
@@ -0,0 +1,360 @@
+#include "../include/quic.h"
+#include "../include/logging.h"
+#include <string.h>
+
+#ifdef ENABLE_QUIC
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#endif
+
+// Long header of a client Initial, before header protection is removed
+typedef struct {
+    uint32_t version;
+    const uint8_t *dcid;
+    uint8_t dcid_len;
+    size_t pn_offset;   // Offset of the (protected) packet number
+    size_t end;         // End of this packet; a datagram may coalesce more
+} quic_initial_header_t;
+
+// Read a variable-length integer (RFC 9000 section 16). Returns the
+// number of bytes used, 0 if it runs past the buffer.
+static size_t quic_get_varint(const uint8_t *p, size_t len, uint64_t *value)
+{
+    if (len == 0) {
+        return 0;
+    }
+    
+    size_t n = (size_t)1 << (p[0] >> 6);
+    if (len < n) {
+        return 0;
+    }
+    
+    uint64_t v = p[0] & 0x3f;
+    for (size_t i = 1; i < n; i++) {
+        v = (v << 8) | p[i];
+    }
+    
+    *value = v;
+    return n;
+}
+
+// Read a varint at *pos and advance past it
+static int quic_read_varint(const uint8_t *data, size_t len, size_t *pos, uint64_t *value)
+{
+    size_t n = quic_get_varint(data + *pos, len - *pos, value);
+    if (n == 0) {
+        return -1;
+    }
+    
+    *pos += n;
+    return 0;
+}
+
+// Parse the long header of a v1/v2 Initial packet
+static int quic_parse_header(const uint8_t *data, size_t len, quic_initial_header_t *hdr)
+{
+    if (!data || len < 7 || !(data[0] & 0x80)) {
+        return -1;
+    }
+    
+    hdr->version = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) |
+                   ((uint32_t)data[3] << 8) | data[4];
+    
+    // The Initial packet type differs between versions
+    unsigned int type = (data[0] >> 4) & 0x03;
+    if (!(hdr->version == QUIC_VERSION_1 && type == 0) &&
+        !(hdr->version == QUIC_VERSION_2 && type == 1)) {
+        return -1;
+    }
+    
+    size_t p = 5;
+    uint8_t dcid_len = data[p++];
+    if (dcid_len > QUIC_MAX_CID_LEN || dcid_len >= len - p) {
+        return -1;
+    }
+    hdr->dcid = data + p;
+    hdr->dcid_len = dcid_len;
+    p += dcid_len;
+    
+    uint8_t scid_len = data[p++];
+    if (scid_len > QUIC_MAX_CID_LEN || scid_len > len - p) {
+        return -1;
+    }
+    p += scid_len;
+    
+    uint64_t token_len, length;
+    if (quic_read_varint(data, len, &p, &token_len) < 0 || token_len > len - p) {
+        return -1;
+    }
+    p += token_len;
+    
+    if (quic_read_varint(data, len, &p, &length) < 0 || length > len - p) {
+        return -1;
+    }
+    
+    // Room for the header protection sample (4 bytes past the packet
+    // number start) and the AEAD tag
+    if (length < 4 + 16) {
+        return -1;
+    }
+    
+    hdr->pn_offset = p;
+    hdr->end = p + length;
+    return 0;
+}
+
+// Check if a UDP payload starts with a QUIC v1/v2 Initial packet
+bool quic_is_initial(const uint8_t *data, size_t len)
+{
+    quic_initial_header_t hdr;
+    
+    return quic_parse_header(data, len, &hdr) == 0;
+}
+
+#ifdef ENABLE_QUIC
+
+typedef struct {
+    uint8_t key[16];
+    uint8_t iv[12];
+    uint8_t hp[16];
+} quic_keys_t;
+
+static const uint8_t quic_v1_salt[20] = {
+    0x38, 0x76, 0x2c, 0xf7, 0xf5, 0x59, 0x34, 0xb3, 0x4d, 0x17,
+    0x9a, 0xe6, 0xa4, 0xc8, 0x0c, 0xad, 0xcc, 0xbb, 0x7f, 0x0a
+};
+
+static const uint8_t quic_v2_salt[20] = {
+    0x0d, 0xed, 0xe3, 0xde, 0xf7, 0x00, 0xa6, 0xdb, 0x81, 0x93,
+    0x81, 0xbe, 0x6e, 0x26, 0x9d, 0xcb, 0xf9, 0xbd, 0x2e, 0xd9
+};
+
+// HKDF-Expand-Label (RFC 8446 section 7.1) with an empty context; every
+// output we need fits in the first SHA-256 block
+static int quic_expand_label(const uint8_t secret[32], const char *label,
+                             uint8_t *out, size_t out_len)
+{
+    uint8_t info[64];
+    uint8_t block[EVP_MAX_MD_SIZE];
+    unsigned int block_len;
+    size_t label_len = strlen(label);
+    size_t n = 0;
+    
+    info[n++] = 0;
+    info[n++] = (uint8_t)out_len;
+    info[n++] = (uint8_t)(6 + label_len);
+    memcpy(info + n, "tls13 ", 6);
+    n += 6;
+    memcpy(info + n, label, label_len);
+    n += label_len;
+    info[n++] = 0;      // Context length
+    info[n++] = 1;      // HKDF-Expand block counter
+    
+    if (!HMAC(EVP_sha256(), secret, 32, info, n, block, &block_len)) {
+        return -1;
+    }
+    
+    memcpy(out, block, out_len);
+    return 0;
+}
+
+// Derive the client Initial keys from the destination connection ID
+static int quic_derive_keys(const quic_initial_header_t *hdr, quic_keys_t *keys)
+{
+    bool v2 = hdr->version == QUIC_VERSION_2;
+    uint8_t initial_secret[EVP_MAX_MD_SIZE];
+    uint8_t client_secret[32];
+    unsigned int secret_len;
+    
+    // HKDF-Extract is HMAC keyed with the salt
+    if (!HMAC(EVP_sha256(), v2 ? quic_v2_salt : quic_v1_salt, 20,
+              hdr->dcid, hdr->dcid_len, initial_secret, &secret_len)) {
+        return -1;
+    }
+    
+    if (quic_expand_label(initial_secret, "client in", client_secret, 32) < 0 ||
+        quic_expand_label(client_secret, v2 ? "quicv2 key" : "quic key", keys->key, 16) < 0 ||
+        quic_expand_label(client_secret, v2 ? "quicv2 iv" : "quic iv", keys->iv, 12) < 0 ||
+        quic_expand_label(client_secret, v2 ? "quicv2 hp" : "quic hp", keys->hp, 16) < 0) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Remove header protection and decrypt the first Initial of a datagram.
+// plain receives the frames; it must hold at least the whole packet.
+// AES-128 runs through EVP, which uses AES-NI/PCLMULQDQ when available.
+int quic_decrypt_initial(const uint8_t *data, size_t len, uint8_t *plain,
+                         size_t plain_size, size_t *plain_len)
+{
+    quic_initial_header_t hdr;
+    quic_keys_t keys;
+    uint8_t mask[16];
+    uint8_t nonce[12];
+    int out_len;
+    int ret = -1;
+    
+    if (!plain || !plain_len || quic_parse_header(data, len, &hdr) < 0 ||
+        hdr.end > plain_size || quic_derive_keys(&hdr, &keys) < 0) {
+        return -1;
+    }
+    
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        return -1;
+    }
+    
+    // Header protection mask from the sample after the packet number
+    if (EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, keys.hp, NULL) != 1 ||
+        EVP_CIPHER_CTX_set_padding(ctx, 0) != 1 ||
+        EVP_EncryptUpdate(ctx, mask, &out_len, data + hdr.pn_offset + 4, 16) != 1) {
+        goto out;
+    }
+    
+    // Unprotected header (the associated data) goes first in plain
+    memcpy(plain, data, hdr.pn_offset + 4);
+    plain[0] ^= mask[0] & 0x0f;
+    size_t pn_len = (plain[0] & 0x03) + 1;
+    
+    // Nonce is the IV xored with the packet number; the client's first
+    // Initials have small numbers, so the truncated value is the full one
+    memcpy(nonce, keys.iv, sizeof(nonce));
+    for (size_t i = 0; i < pn_len; i++) {
+        plain[hdr.pn_offset + i] ^= mask[1 + i];
+        nonce[sizeof(nonce) - pn_len + i] ^= plain[hdr.pn_offset + i];
+    }
+    
+    size_t header_len = hdr.pn_offset + pn_len;
+    size_t cipher_len = hdr.end - header_len - 16;
+    
+    if (EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, keys.key, nonce) != 1 ||
+        EVP_DecryptUpdate(ctx, NULL, &out_len, plain, (int)header_len) != 1 ||
+        EVP_DecryptUpdate(ctx, plain + header_len, &out_len,
+                          data + header_len, (int)cipher_len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16,
+                            (void *)(data + hdr.end - 16)) != 1 ||
+        EVP_DecryptFinal_ex(ctx, plain + header_len + out_len, &out_len) != 1) {
+        log_debug("QUIC Initial failed to decrypt");
+        goto out;
+    }
+    
+    memmove(plain, plain + header_len, cipher_len);
+    *plain_len = cipher_len;
+    ret = 0;
+    
+out:
+    EVP_CIPHER_CTX_free(ctx);
+    return ret;
+}
+
+// Check if Initial packets can be decrypted (built with libcrypto)
+bool quic_decryption_available(void)
+{
+    return true;
+}
+
+#else
+
+// Without libcrypto Initials cannot be decrypted
+int quic_decrypt_initial(const uint8_t *data, size_t len, uint8_t *plain,
+                         size_t plain_size, size_t *plain_len)
+{
+    (void)data;
+    (void)len;
+    (void)plain;
+    (void)plain_size;
+    (void)plain_len;
+    return -1;
+}
+
+// Check if Initial packets can be decrypted (built with libcrypto)
+bool quic_decryption_available(void)
+{
+    return false;
+}
+
+#endif // ENABLE_QUIC
+
+// Collect the CRYPTO frames of a decrypted Initial, sorted by stream
+// offset (clients such as Chrome send them out of order). Only the
+// frames allowed in Initial packets are accepted.
+int quic_crypto_frames(const uint8_t *plain, size_t plain_len, quic_crypto_frame_t *frames,
+                       size_t max_frames, size_t *num_frames)
+{
+    size_t p = 0;
+    size_t count = 0;
+    
+    if (!plain || !frames || !num_frames) {
+        return -1;
+    }
+    
+    while (p < plain_len) {
+        uint64_t type, value, ranges;
+        
+        if (quic_read_varint(plain, plain_len, &p, &type) < 0) {
+            return -1;
+        }
+        
+        switch (type) {
+            case 0x00: // PADDING
+            case 0x01: // PING
+                break;
+                
+            case 0x02: // ACK
+            case 0x03: // ACK with ECN counts
+                // Largest acknowledged, delay, range count, first range
+                if (quic_read_varint(plain, plain_len, &p, &value) < 0 ||
+                    quic_read_varint(plain, plain_len, &p, &value) < 0 ||
+                    quic_read_varint(plain, plain_len, &p, &ranges) < 0 ||
+                    quic_read_varint(plain, plain_len, &p, &value) < 0) {
+                    return -1;
+                }
+                
+                // Gap and length per range, then three ECN counts; each
+                // read consumes a byte, so a bogus count runs out quickly
+                for (uint64_t i = 0; i < 2 * ranges + (type == 0x03 ? 3 : 0); i++) {
+                    if (quic_read_varint(plain, plain_len, &p, &value) < 0) {
+                        return -1;
+                    }
+                }
+                break;
+                
+            case 0x06: { // CRYPTO
+                uint64_t offset, length;
+                
+                if (quic_read_varint(plain, plain_len, &p, &offset) < 0 ||
+                    quic_read_varint(plain, plain_len, &p, &length) < 0 ||
+                    length > plain_len - p || count >= max_frames) {
+                    return -1;
+                }
+                
+                frames[count].offset = offset;
+                frames[count].data = plain + p;
+                frames[count].len = (size_t)length;
+                count++;
+                p += length;
+                break;
+            }
+            
+            default:
+                // CONNECTION_CLOSE or a frame not allowed here
+                return -1;
+        }
+    }
+    
+    // Insertion sort; there are only a handful of frames
+    for (size_t i = 1; i < count; i++) {
+        quic_crypto_frame_t frame = frames[i];
+        size_t j = i;
+        
+        while (j > 0 && frames[j - 1].offset > frame.offset) {
+            frames[j] = frames[j - 1];
+            j--;
+        }
+        frames[j] = frame;
+    }
+    
+    *num_frames = count;
+    return 0;
+}
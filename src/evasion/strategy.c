@@ -0,0 +1,384 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include "../include/packet.h"
+#include "../include/domain_set.h"
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+// Strategy profiles map domain groups to techniques. The profile file is
+// INI-like; each [section] is a profile:
+//
+//   [turkey]
+//   domains = discord.com twitter.com
+//   domains_file = /etc/goodbyedpi/turkey.txt
+//   https_fragment_size = 2
+//   fake = ttl
+//   ttl = 5
+//   split = host+1
+//
+// All domains go into one domain set whose values are profile indexes, so
+// a flow resolves its profile with a single lookup. Keys a profile leaves
+// out are taken from the global configuration.
+
+#define STRATEGY_MAX_PROFILES 64
+#define STRATEGY_MAX_LINE 4096
+
+static strategy_profile_t default_profile;
+static strategy_profile_t *profiles = NULL;
+static uint32_t profile_count = 0;
+static domain_set_t profile_domains;
+static bool profile_domains_loaded = false;
+
+// Build the profile used for hosts no profile matches
+static void strategy_init_default(void)
+{
+    memset(&default_profile, 0, sizeof(default_profile));
+    safe_string_copy(default_profile.name, "default", sizeof(default_profile.name));
+    default_profile.http_fragment_size = config.http_fragment_size;
+    default_profile.https_fragment_size = config.https_fragment_size;
+    
+    if (config.fake_packet) {
+        if (config.wrong_checksum) {
+            default_profile.fake_type |= FAKE_BADSUM;
+        }
+        if (config.wrong_sequence) {
+            default_profile.fake_type |= FAKE_BADSEQ;
+        }
+        if (default_profile.fake_type == FAKE_NONE) {
+            default_profile.fake_type = FAKE_TTL;
+        }
+    }
+    default_profile.split_mode = SPLIT_NONE;
+    evasion_chains_build(&default_profile);
+}
+
+// Parse "none" or fake kind names joined by '+' (e.g. "badsum+badseq")
+static int strategy_parse_fake(const char *value, fake_type_t *type)
+{
+    if (strcasecmp(value, "none") == 0) {
+        *type = FAKE_NONE;
+        return 0;
+    }
+    
+    unsigned int types = FAKE_NONE;
+    while (*value) {
+        size_t len = strcspn(value, "+");
+        
+        if (len == 3 && strncasecmp(value, "ttl", 3) == 0) {
+            types |= FAKE_TTL;
+        } else if (len == 6 && strncasecmp(value, "badsum", 6) == 0) {
+            types |= FAKE_BADSUM;
+        } else if (len == 6 && strncasecmp(value, "badseq", 6) == 0) {
+            types |= FAKE_BADSEQ;
+        } else {
+            return -1;
+        }
+        
+        value += len;
+        if (*value == '+') {
+            value++;
+        }
+    }
+    
+    *type = (fake_type_t)types;
+    return types == FAKE_NONE ? -1 : 0;
+}
+
+// Parse "none", "N", "host" or "host+N"
+static int strategy_parse_split(const char *value, strategy_profile_t *profile)
+{
+    char *end;
+    
+    if (strcasecmp(value, "none") == 0) {
+        profile->split_mode = SPLIT_NONE;
+        profile->split_pos = 0;
+        return 0;
+    }
+    
+    if (strncasecmp(value, "host", 4) == 0 || strncasecmp(value, "sni", 3) == 0) {
+        const char *rest = value + (tolower((unsigned char)value[0]) == 'h' ? 4 : 3);
+        profile->split_mode = SPLIT_HOST;
+        profile->split_pos = 0;
+        if (*rest == '\0') {
+            return 0;
+        }
+        if (*rest != '+') {
+            return -1;
+        }
+        value = rest + 1;
+    } else {
+        profile->split_mode = SPLIT_OFFSET;
+    }
+    
+    errno = 0;
+    unsigned long pos = strtoul(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || pos > 65535) {
+        return -1;
+    }
+    
+    profile->split_pos = (unsigned int)pos;
+    return 0;
+}
+
+// Parse an unsigned size in 1..65535
+static int strategy_parse_size(const char *value, unsigned int *size)
+{
+    char *end;
+    
+    errno = 0;
+    unsigned long val = strtoul(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || val == 0 || val > 65535) {
+        return -1;
+    }
+    
+    *size = (unsigned int)val;
+    return 0;
+}
+
+// Add the whitespace or comma separated domains of a "domains" line
+static int strategy_add_domains(char *value, uint32_t index)
+{
+    int added = 0;
+    char *saveptr = NULL;
+    
+    for (char *domain = strtok_r(value, " \t,", &saveptr); domain;
+         domain = strtok_r(NULL, " \t,", &saveptr)) {
+        if (domain_set_add(&profile_domains, domain, index) < 0) {
+            log_warning("Invalid domain '%s' in profile %s", domain, profiles[index].name);
+            continue;
+        }
+        added++;
+    }
+    
+    return added;
+}
+
+// Apply one key of the current profile
+static int strategy_set_value(strategy_profile_t *profile, uint32_t index,
+                              const char *key, char *value)
+{
+    if (strcmp(key, "domains") == 0) {
+        strategy_add_domains(value, index);
+    } else if (strcmp(key, "domains_file") == 0) {
+        if (domain_set_load_file(&profile_domains, value, index) < 0) {
+            return -1;
+        }
+    } else if (strcmp(key, "http_fragment_size") == 0) {
+        return strategy_parse_size(value, &profile->http_fragment_size);
+    } else if (strcmp(key, "https_fragment_size") == 0) {
+        return strategy_parse_size(value, &profile->https_fragment_size);
+    } else if (strcmp(key, "fragment_size") == 0) {
+        if (strategy_parse_size(value, &profile->http_fragment_size) < 0) {
+            return -1;
+        }
+        profile->https_fragment_size = profile->http_fragment_size;
+    } else if (strcmp(key, "fake") == 0) {
+        return strategy_parse_fake(value, &profile->fake_type);
+    } else if (strcmp(key, "ttl") == 0) {
+        int ttl = atoi(value);
+        if (ttl < 1 || ttl > 255) {
+            return -1;
+        }
+        profile->fake_ttl = (uint8_t)ttl;
+    } else if (strcmp(key, "split") == 0) {
+        return strategy_parse_split(value, profile);
+    } else {
+        log_warning("Unknown profile key: %s", key);
+    }
+    
+    return 0;
+}
+
+// Start a new profile named by a [section] line
+static strategy_profile_t *strategy_new_profile(const char *name)
+{
+    if (profile_count >= STRATEGY_MAX_PROFILES) {
+        log_error("Too many strategy profiles (max %d)", STRATEGY_MAX_PROFILES);
+        return NULL;
+    }
+    
+    strategy_profile_t *profile = &profiles[profile_count++];
+    *profile = default_profile;
+    safe_string_copy(profile->name, name, sizeof(profile->name));
+    return profile;
+}
+
+// Parse the profile file into the profile table and domain set
+static int strategy_parse_file(const char *filename)
+{
+    char line[STRATEGY_MAX_LINE];
+    strategy_profile_t *profile = NULL;
+    int line_num = 0;
+    
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        log_error("Cannot open profile file %s: %s", filename, strerror(errno));
+        return -1;
+    }
+    
+    while (fgets(line, sizeof(line), file)) {
+        line_num++;
+        
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        
+        char *text = trim(line);
+        if (text[0] == '\0') {
+            continue;
+        }
+        
+        if (text[0] == '[') {
+            char *close = strchr(text, ']');
+            if (!close || close == text + 1) {
+                log_error("%s:%d: invalid section", filename, line_num);
+                fclose(file);
+                return -1;
+            }
+            *close = '\0';
+            profile = strategy_new_profile(trim(text + 1));
+            if (!profile) {
+                fclose(file);
+                return -1;
+            }
+            continue;
+        }
+        
+        char *equals = strchr(text, '=');
+        if (!equals || !profile) {
+            log_error("%s:%d: expected key = value inside a [profile]", filename, line_num);
+            fclose(file);
+            return -1;
+        }
+        *equals = '\0';
+        
+        char *key = trim(text);
+        char *value = trim(equals + 1);
+        if (strategy_set_value(profile, (uint32_t)(profile - profiles), key, value) < 0) {
+            log_error("%s:%d: invalid value for %s", filename, line_num, key);
+            fclose(file);
+            return -1;
+        }
+    }
+    
+    fclose(file);
+    return 0;
+}
+
+// Load the strategy profiles (if configured)
+int strategy_load(void)
+{
+    strategy_init_default();
+    
+    if (config.profiles_file[0] == '\0') {
+        return 0;
+    }
+    
+    profiles = calloc(STRATEGY_MAX_PROFILES, sizeof(strategy_profile_t));
+    if (!profiles || domain_set_init(&profile_domains) < 0) {
+        log_error("Failed to allocate strategy profiles");
+        free(profiles);
+        profiles = NULL;
+        return -1;
+    }
+    profile_domains_loaded = true;
+    
+    if (strategy_parse_file(config.profiles_file) < 0) {
+        strategy_cleanup();
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < profile_count; i++) {
+        evasion_chains_build(&profiles[i]);
+        log_debug("Profile %s: http=%u https=%u fake=%#x ttl=%u split=%d/%u",
+                  profiles[i].name, profiles[i].http_fragment_size,
+                  profiles[i].https_fragment_size, profiles[i].fake_type,
+                  profiles[i].fake_ttl, profiles[i].split_mode, profiles[i].split_pos);
+    }
+    
+    log_info("Loaded %u strategy profiles covering %u domains from %s",
+             profile_count, profile_domains.domain_count, config.profiles_file);
+    return 0;
+}
+
+// Free the profiles
+void strategy_cleanup(void)
+{
+    if (profile_domains_loaded) {
+        domain_set_free(&profile_domains);
+        profile_domains_loaded = false;
+    }
+    
+    free(profiles);
+    profiles = NULL;
+    profile_count = 0;
+}
+
+// Check whether any profile is loaded
+bool strategy_enabled(void)
+{
+    return profile_count > 0;
+}
+
+// Profile for hosts that match no profile
+const strategy_profile_t *strategy_default(void)
+{
+    return &default_profile;
+}
+
+// Resolve the profile of a hostname (the most specific domain wins)
+const strategy_profile_t *strategy_lookup(const char *host, size_t host_len)
+{
+    uint32_t index;
+    
+    if (profile_count > 0 && host &&
+        domain_set_lookup(&profile_domains, host, host_len, &index) &&
+        index < profile_count) {
+        return &profiles[index];
+    }
+    
+    return &default_profile;
+}
+
+// Length of the first segment a request is split into: the profile's
+// split point if it falls inside the payload, else its fragment size.
+// host is the request's Host/SNI, or NULL if not known.
+unsigned int strategy_first_segment(const strategy_profile_t *profile, const packet_t *packet,
+                                    const char *host)
+{
+    unsigned int fragment_size = packet_is_http(packet) ? profile->http_fragment_size
+                                                        : profile->https_fragment_size;
+    size_t offset;
+    
+    switch (profile->split_mode) {
+        case SPLIT_OFFSET:
+            offset = profile->split_pos;
+            break;
+            
+        case SPLIT_HOST: {
+            if (!host || !packet->payload) {
+                return fragment_size;
+            }
+            // Without case: --host-mixedcase may have rewritten the header
+            const uint8_t *found = memcasemem(packet->payload, packet->payload_len,
+                                              host, strlen(host));
+            if (!found) {
+                return fragment_size;
+            }
+            offset = (size_t)(found - packet->payload) + profile->split_pos;
+            break;
+        }
+        
+        default:
+            return fragment_size;
+    }
+    
+    if (offset == 0 || offset >= packet->payload_len) {
+        return fragment_size;
+    }
+    
+    return (unsigned int)offset;
+}
@@ -0,0 +1,293 @@
+#include "../include/tls_parser.h"
+#include <string.h>
+#include <stdbool.h>
+
+// Read a big-endian 16-bit value
+static inline uint16_t tls_get16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// Check the 5-byte record header (as far as it is present)
+static tls_parse_result_t tls_check_record_header(const uint8_t *data, size_t len)
+{
+    if (len >= 1 && data[0] != TLS_CONTENT_HANDSHAKE) {
+        return TLS_PARSE_INVALID;
+    }
+
+    // Record versions 0x0300 (SSL 3.0, still used by some clients) to 0x0304
+    if (len >= 2 && data[1] != 3) {
+        return TLS_PARSE_INVALID;
+    }
+    if (len >= 3 && data[2] > 4) {
+        return TLS_PARSE_INVALID;
+    }
+
+    if (len >= TLS_RECORD_HEADER_LEN) {
+        uint16_t record_len = tls_get16(data + 3);
+        if (record_len == 0 || record_len > TLS_MAX_RECORD_LEN) {
+            return TLS_PARSE_INVALID;
+        }
+    }
+
+    return len >= TLS_RECORD_HEADER_LEN ? TLS_PARSE_OK : TLS_PARSE_INCOMPLETE;
+}
+
+// Parse the server_name extension body
+static bool tls_parse_sni(const uint8_t *data, uint32_t off, uint16_t len, tls_client_hello_t *hello)
+{
+    if (len < 2 || tls_get16(data + off) != len - 2) {
+        return false;
+    }
+
+    uint32_t p = off + 2;
+    uint32_t end = off + len;
+    while (p < end) {
+        if (end - p < 3) {
+            return false;
+        }
+
+        uint8_t name_type = data[p];
+        uint16_t name_len = tls_get16(data + p + 1);
+        p += 3;
+        if (name_len > end - p) {
+            return false;
+        }
+
+        // First host_name wins; other name types are skipped
+        if (name_type == 0 && hello->sni_len == 0) {
+            if (name_len == 0) {
+                return false;
+            }
+            hello->sni_off = p;
+            hello->sni_len = name_len;
+        }
+        p += name_len;
+    }
+
+    return true;
+}
+
+// Parse the ALPN extension body
+static bool tls_parse_alpn(const uint8_t *data, uint32_t off, uint16_t len, tls_client_hello_t *hello)
+{
+    if (len < 3 || tls_get16(data + off) != len - 2) {
+        return false;
+    }
+
+    uint32_t p = off + 2;
+    uint32_t end = off + len;
+    while (p < end) {
+        uint8_t proto_len = data[p++];
+        if (proto_len == 0 || proto_len > end - p) {
+            return false;
+        }
+        p += proto_len;
+    }
+
+    hello->alpn_off = off + 2;
+    hello->alpn_len = len - 2;
+    return true;
+}
+
+// Parse the supported_versions extension body (ClientHello form)
+static bool tls_parse_versions(const uint8_t *data, uint32_t off, uint16_t len, tls_client_hello_t *hello)
+{
+    if (len < 3 || data[off] != len - 1 || (data[off] & 1)) {
+        return false;
+    }
+
+    hello->versions_off = off + 1;
+    hello->versions_len = len - 1;
+    return true;
+}
+
+// Read the 24-bit handshake length and check it is plausible for a ClientHello
+static tls_parse_result_t tls_check_handshake_header(const uint8_t *data, size_t len,
+                                                     uint32_t start, tls_client_hello_t *hello)
+{
+    if (len > start && data[start] != TLS_HANDSHAKE_CLIENT_HELLO) {
+        return TLS_PARSE_INVALID;
+    }
+    if (len < start + 4) {
+        return TLS_PARSE_INCOMPLETE;
+    }
+    
+    hello->handshake_len = ((uint32_t)data[start + 1] << 16) |
+                           ((uint32_t)data[start + 2] << 8) | data[start + 3];
+    
+    // legacy_version + random + session ID length + ciphers + compression
+    if (hello->handshake_len < 2 + 32 + 1 + 4 + 2) {
+        return TLS_PARSE_INVALID;
+    }
+
+    return TLS_PARSE_OK;
+}
+
+// Parse the ClientHello body following the handshake header at start.
+// The handshake length has been checked against the buffer.
+static tls_parse_result_t tls_parse_hello_body(const uint8_t *data, uint32_t start, tls_client_hello_t *hello)
+{
+    uint32_t p = start + 4;
+    uint32_t end = p + hello->handshake_len;
+
+    hello->legacy_version = tls_get16(data + p);
+    p += 2 + 32;
+
+    // Session ID
+    uint8_t session_id_len = data[p++];
+    if (session_id_len > 32 || session_id_len > end - p) {
+        return TLS_PARSE_INVALID;
+    }
+    hello->session_id_off = p;
+    hello->session_id_len = session_id_len;
+    p += session_id_len;
+
+    // Cipher suites
+    if (end - p < 2) {
+        return TLS_PARSE_INVALID;
+    }
+    uint16_t ciphers_len = tls_get16(data + p);
+    p += 2;
+    if (ciphers_len < 2 || (ciphers_len & 1) || ciphers_len > end - p) {
+        return TLS_PARSE_INVALID;
+    }
+    hello->ciphers_off = p;
+    hello->ciphers_len = ciphers_len;
+    p += ciphers_len;
+
+    // Compression methods
+    if (end - p < 1) {
+        return TLS_PARSE_INVALID;
+    }
+    uint8_t compression_len = data[p++];
+    if (compression_len < 1 || compression_len > end - p) {
+        return TLS_PARSE_INVALID;
+    }
+    p += compression_len;
+
+    // Extensions are optional, but when present fill the rest exactly
+    if (p == end) {
+        return TLS_PARSE_OK;
+    }
+    if (end - p < 2) {
+        return TLS_PARSE_INVALID;
+    }
+    uint16_t extensions_len = tls_get16(data + p);
+    p += 2;
+    if (extensions_len != end - p) {
+        return TLS_PARSE_INVALID;
+    }
+    hello->extensions_off = p;
+    hello->extensions_len = extensions_len;
+
+    bool seen_sni = false, seen_alpn = false, seen_versions = false;
+
+    while (p < end) {
+        if (end - p < 4) {
+            return TLS_PARSE_INVALID;
+        }
+
+        uint16_t ext_type = tls_get16(data + p);
+        uint16_t ext_len = tls_get16(data + p + 2);
+        uint32_t ext_off = p + 4;
+        if (ext_len > end - ext_off) {
+            return TLS_PARSE_INVALID;
+        }
+
+        bool ok = true;
+        switch (ext_type) {
+            case TLS_EXT_SERVER_NAME:
+                ok = !seen_sni && tls_parse_sni(data, ext_off, ext_len, hello);
+                hello->sni_ext_off = p;
+                seen_sni = true;
+                break;
+
+            case TLS_EXT_ALPN:
+                ok = !seen_alpn && tls_parse_alpn(data, ext_off, ext_len, hello);
+                seen_alpn = true;
+                break;
+
+            case TLS_EXT_SUPPORTED_VERSIONS:
+                ok = !seen_versions && tls_parse_versions(data, ext_off, ext_len, hello);
+                seen_versions = true;
+                break;
+
+            default:
+                break;
+        }
+
+        if (!ok) {
+            return TLS_PARSE_INVALID;
+        }
+
+        p = ext_off + ext_len;
+    }
+
+    return TLS_PARSE_OK;
+}
+
+// Parse a TLS record holding a ClientHello. Everything is bounds-checked
+// against len; nothing is copied. A ClientHello spread over several
+// records is reported as invalid.
+tls_parse_result_t tls_parse_client_hello(const uint8_t *data, size_t len, tls_client_hello_t *hello)
+{
+    if (!data || !hello) {
+        return TLS_PARSE_INVALID;
+    }
+    
+    memset(hello, 0, sizeof(*hello));
+    
+    tls_parse_result_t result = tls_check_record_header(data, len);
+    if (result != TLS_PARSE_OK) {
+        return result;
+    }
+    
+    hello->record_version = tls_get16(data + 1);
+    hello->record_len = tls_get16(data + 3);
+    
+    result = tls_check_handshake_header(data, len, TLS_RECORD_HEADER_LEN, hello);
+    if (result != TLS_PARSE_OK) {
+        return result;
+    }
+    
+    if (hello->handshake_len + 4 > hello->record_len) {
+        return TLS_PARSE_INVALID;
+    }
+    if (len < TLS_RECORD_HEADER_LEN + hello->record_len) {
+        return TLS_PARSE_INCOMPLETE;
+    }
+    
+    return tls_parse_hello_body(data, TLS_RECORD_HEADER_LEN, hello);
+}
+
+// Parse a ClientHello handshake message without a record header, as
+// carried in QUIC CRYPTO frames
+tls_parse_result_t tls_parse_handshake(const uint8_t *data, size_t len, tls_client_hello_t *hello)
+{
+    if (!data || !hello) {
+        return TLS_PARSE_INVALID;
+    }
+    
+    memset(hello, 0, sizeof(*hello));
+    
+    tls_parse_result_t result = tls_check_handshake_header(data, len, 0, hello);
+    if (result != TLS_PARSE_OK) {
+        return result;
+    }
+    
+    if (len < 4 + (size_t)hello->handshake_len) {
+        return TLS_PARSE_INCOMPLETE;
+    }
+    
+    return tls_parse_hello_body(data, 0, hello);
+}
+
+// Check whether data starts like a ClientHello record: handshake content,
+// version 3.x and a ClientHello message. Only those six bytes are read,
+// which is enough to tell TLS apart from other first payloads.
+bool tls_is_client_hello(const uint8_t *data, size_t len)
+{
+    return data && len > TLS_RECORD_HEADER_LEN && data[0] == TLS_CONTENT_HANDSHAKE &&
+           data[1] == 3 && data[TLS_RECORD_HEADER_LEN] == TLS_HANDSHAKE_CLIENT_HELLO;
+}
@@ -1,9 +1,9 @@
 #include "../include/goodbyedpi.h"
 #include "../include/logging.h"
 #include "../include/packet.h"
-#include <stdlib.h>
+#include "../include/config.h"
+#include "../include/aho_corasick.h"
 #include <string.h>
-#include <ctype.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
@@ -38,251 +38,67 @@ static const char *turkish_services[] = {
     NULL
 };
 
-// Turkey-specific header manipulation
-int turkey_header_obfuscation(packet_t *packet)
-{
-    if (!packet || !packet_is_http(packet)) {
-        return -1;
-    }
-    
-    if (!config.host_mixedcase && !config.additional_space) {
-        // Apply Turkish ISP-specific techniques
-        // 1. Add extra spaces in random places
-        char *host_header = strstr((char*)packet->payload, "Host:");
-        if (host_header) {
-            // Insert random whitespace in Host header
-            size_t host_len = strlen(host_header);
-            if (host_len > 6 && host_len < MAX_HOSTNAME_LEN - 10) {
-                // Split Host: into multiple parts
-                char modified_host[MAX_HOSTNAME_LEN];
-                strncpy(modified_host, host_header, 6);  // Copy "Host: "
-                
-                // Mix case and add spaces
-                const char *hostname = host_header + 6;
-                int space_pos = rand() % 8 + 2;  // Random position
-                
-                for (int i = 0; hostname[i] && i < space_pos; i++) {
-                    if (i % 2 == 0) {
-                        modified_host[6 + i] = toupper(hostname[i]);
-                    } else {
-                        modified_host[6 + i] = tolower(hostname[i]);
-                    }
-                }
-                
-                // Insert spaces
-                modified_host[6 + space_pos] = ' ';
-                modified_host[6 + space_pos + 1] = hostname[space_pos];
-                
-                // Copy rest
-                strncpy(modified_host + 6 + space_pos + 1, 
-                       hostname + space_pos + 1, 
-                       MAX_HOSTNAME_LEN - 6 - space_pos - 2);
-                
-                // Replace in packet
-                log_debug("Applied Turkish header obfuscation");
-                // Implementation would modify packet buffer
-                return 0;
-            }
-        }
-    }
-    
-    return -1;  // No changes made
-}
+// Matcher over turkish_services, built once by turkey_init()
+static ac_automaton_t service_matcher;
 
-// Turkey-specific TLS fingerprint obfuscation
-int turkey_tls_obfuscation(packet_t *packet)
+// Build the service matcher
+int turkey_init(void)
 {
-    if (!packet || !packet_is_https(packet)) {
-        return -1;
-    }
+    size_t count = 0;
     
-    // Detect if this is Turkish service
-    char hostname[MAX_HOSTNAME_LEN] = {0};
-    char *extracted_hostname = extract_sni_from_packet(packet);
-    if (extracted_hostname) {
-        strncpy(hostname, extracted_hostname, MAX_HOSTNAME_LEN - 1);
-        free(extracted_hostname);
+    while (turkish_services[count]) {
+        count++;
     }
     
-    if (hostname[0] != '\0') {
-        // This is HTTPS - modify ClientHello
-        // For Turkish DPI, we need to:
-        // 1. Fragment TLS handshake
-        // 2. Modify TLS version
-        // 3. Add fake SNI entries
-        // 4. Obfuscate JA3/JA4 fingerprints
-        
-        log_debug("Applied Turkish TLS obfuscation");
-        return 0;
+    if (ac_build(&service_matcher, turkish_services, count) < 0) {
+        log_error("Failed to build Turkish service matcher");
+        return -1;
     }
     
-    return -1;
+    log_debug("Turkish service matcher: %zu patterns, %u states",
+              count, service_matcher.num_states);
+    return 0;
 }
 
-// Enhanced fragmentation for Turkish ISPs
-int turkey_enhanced_fragmentation(packet_t *packet)
+// Free the service matcher
+void turkey_cleanup(void)
 {
-    if (!packet) {
-        return -1;
-    }
-    
-    // Use smaller fragment sizes for Turkish DPI
-    unsigned int frag_size = TURKEY_HTTP_FRAGMENT_SIZE;
-    
-    if (packet_is_https(packet)) {
-        frag_size = TURKEY_HTTPS_FRAGMENT_SIZE;
-    }
-    
-    log_debug("Applying Turkish enhanced fragmentation: size=%u", frag_size);
-    
-    // This would implement multiple fragmentation techniques:
-    // 1. Time-based fragmentation (delay between fragments)
-    // 2. Overlapping fragments
-    // 3. Out-of-order fragments
-    // 4. Mixed fragment sizes
-    
-    return evasion_fragment_packet(packet, frag_size);
+    ac_free(&service_matcher);
 }
 
-// Check if packet matches Turkish service patterns
+// Check if packet matches Turkish service patterns. Once the request's
+// Host/SNI is read, the verdict is kept in the flow for its later packets;
+// a segment without the hostname is scanned, but its verdict is not kept.
 bool turkey_is_blocked_service(const packet_t *packet)
 {
-    if (!packet || !packet->payload) {
+    if (!packet || !packet->payload || packet->payload_len == 0) {
         return false;
     }
     
-    char payload_str[512] = {0};
-    size_t copy_len = packet->payload_len < sizeof(payload_str) - 1 ? 
-                     packet->payload_len : sizeof(payload_str) - 1;
-    
-    strncpy(payload_str, (char*)packet->payload, copy_len);
-    
-    // Convert to lowercase for comparison
-    for (size_t i = 0; payload_str[i]; i++) {
-        payload_str[i] = tolower(payload_str[i]);
-    }
-    
-    // Check against Turkish service list
-    for (int i = 0; turkish_services[i]; i++) {
-        if (strstr(payload_str, turkish_services[i])) {
-            log_debug("Detected Turkish service: %s", turkish_services[i]);
-            return true;
-        }
-    }
-    
-    return false;
-}
-
-// Apply Turkey-specific IP TTL manipulation
-int turkey_ttl_manipulation(packet_t *packet)
-{
-    if (!packet) {
-        return -1;
-    }
-    
-    // Turkish DPI systems are sensitive to TTL patterns
-    // Use multiple TTL values to confuse detection
-    
-    uint8_t original_ttl = packet->ttl;
-    uint8_t modified_ttl;
-    
-    // TTL obfuscation strategies for Turkish ISPs:
-    if (original_ttl > 64) {
-        // For distant servers, use TTL 64 to appear local
-        modified_ttl = 64;
-    } else if (original_ttl > 32) {
-        // For regional servers, use TTL 32
-        modified_ttl = 32;
-    } else {
-        // For local networks, TTL 1 might bypass
-        modified_ttl = 1;
-    }
-    
-    log_debug("Applied Turkish TTL manipulation: %d -> %d", original_ttl, modified_ttl);
-    
-    return packet_set_ttl(packet, modified_ttl);
-}
-
-// Generate fake Turkish service traffic
-int turkey_generate_fake_service_traffic(const packet_t *packet)
-{
-    if (!packet) {
-        return -1;
-    }
-    
-    // Generate fake HTTP requests to popular Turkish blocked services
-    // This creates noise and confuses DPI systems
-    
-    const char *fake_services[] = {
-        "http://twitter.com/",
-        "http://youtube.com/", 
-        "http://discord.com/",
-        "http://telegram.org/",
-        NULL
-    };
-    
-    for (int i = 0; fake_services[i]; i++) {
-        // Generate fake HTTP request to this service
-        // This would create and send a packet
-        log_debug("Generated fake traffic for: %s", fake_services[i]);
-        
-        // Implementation would create actual packets
-        // For now, just log the attempt
-    }
-    
-    return 0;
-}
-
-// Apply comprehensive Turkey-specific evasion
-int turkey_apply_all_evasion(packet_t *packet)
-{
-    if (!packet) {
-        return -1;
+    conntrack_entry_t *flow = conntrack_get(packet, false);
+    if (flow && flow->service_match != CONNTRACK_MATCH_UNKNOWN) {
+        return flow->service_match >= 0;
     }
     
-    int changes_made = 0;
+    char hostname[MAX_HOSTNAME_LEN];
+    bool have_host = packet_is_http(packet) ?
+        packet_get_http_host(packet, hostname, sizeof(hostname)) == 0 :
+        evasion_extract_sni(packet->payload, packet->payload_len,
+                            hostname, sizeof(hostname)) == 0;
     
-    // Apply header obfuscation
-    if (turkey_header_obfuscation(packet) == 0) {
-        changes_made++;
+    int match = have_host ?
+        ac_search(&service_matcher, (const uint8_t *)hostname, strlen(hostname)) :
+        ac_search(&service_matcher, packet->payload, packet->payload_len);
+    if (flow && have_host) {
+        flow->service_match = (int8_t)(match >= 0 ? match : CONNTRACK_MATCH_NONE);
     }
     
-    // Apply TLS obfuscation for HTTPS
-    if (packet_is_https(packet) && turkey_tls_obfuscation(packet) == 0) {
-        changes_made++;
+    if (match >= 0) {
+        log_debug("Detected Turkish service: %s", turkish_services[match]);
+        return true;
     }
     
-    // Apply enhanced fragmentation
-    if (evasion_fragment_packet(packet, TURKEY_MAX_FRAGMENT_SIZE) == 0) {
-        changes_made++;
-    }
-    
-    // Apply TTL manipulation
-    if (turkey_ttl_manipulation(packet) == 0) {
-        changes_made++;
-    }
-    
-    // Generate fake traffic for additional noise
-    if (config.fake_packet) {
-        turkey_generate_fake_service_traffic(packet);
-    }
-    
-    if (changes_made > 0) {
-        log_debug("Applied %d Turkey-specific evasion techniques", changes_made);
-    }
-    
-    return 0;
-}
-
-// Check if we should apply Turkish-specific techniques
-bool turkey_should_apply_techniques(const packet_t *packet)
-{
-    if (!packet) {
-        return false;
-    }
-    
-    // Check if packet is going to common Turkish blocked services
-    return turkey_is_blocked_service(packet);
+    return false;
 }
 
 // Get optimal fragment size for Turkish ISPs
@@ -292,19 +108,26 @@ unsigned int turkey_get_optimal_fragment_size(const packet_t *packet)
         return TURKEY_MAX_FRAGMENT_SIZE;
     }
     
+    // A strategy profile matched by the flow's host takes precedence
+    const conntrack_entry_t *flow = conntrack_get(packet, false);
+    const strategy_profile_t *profile = flow ? flow->profile : NULL;
+    if (profile && profile != strategy_default()) {
+        return packet_is_http(packet) ? profile->http_fragment_size : profile->https_fragment_size;
+    }
+    
     // Return size based on packet type and target service
     if (packet_is_http(packet)) {
         if (turkey_is_blocked_service(packet)) {
             return TURKEY_HTTP_FRAGMENT_SIZE;  // Smaller for blocked services
         }
-        return DEFAULT_HTTP_FRAGMENT_SIZE;
+        return config.http_fragment_size;
     }
     
     if (packet_is_https(packet)) {
         if (turkey_is_blocked_service(packet)) {
             return TURKEY_HTTPS_FRAGMENT_SIZE;  // Much smaller for HTTPS
         }
-        return DEFAULT_HTTPS_FRAGMENT_SIZE;
+        return config.https_fragment_size;
     }
     
     return TURKEY_MAX_FRAGMENT_SIZE;
@@ -0,0 +1,22 @@
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Case-insensitive multi-pattern matcher. Patterns are compiled once into
+// a dense DFA over a compressed alphabet (bytes that occur in no pattern
+// share one class), so a scan is one table lookup per input byte.
+typedef struct {
+    uint16_t *next;           // num_states x num_classes transitions
+    int16_t *match;           // Per state: pattern index ending here, or -1
+    uint8_t byte_class[256];  // Input byte -> alphabet class
+    uint32_t num_classes;
+    uint32_t num_states;
+} ac_automaton_t;
+
+int ac_build(ac_automaton_t *ac, const char *const *patterns, size_t count);
+void ac_free(ac_automaton_t *ac);
+int ac_search(const ac_automaton_t *ac, const uint8_t *data, size_t len);
+
+#endif // AHO_CORASICK_H
@@ -7,19 +7,28 @@
 #define DEFAULT_HTTP_FRAGMENT_SIZE      2
 #define DEFAULT_HTTPS_FRAGMENT_SIZE     2
 #define DEFAULT_DNS_PORT               53
+#define DEFAULT_HTTP_PORTS              "80"
+#define DEFAULT_TLS_PORTS               "443"
 #define DEFAULT_DNS_SERVER_V4           "1.1.1.1"    // Cloudflare DNS (better for Turkey)
 #define DEFAULT_DNS_SERVER_TURKEY       "208.67.222.222"  // Turkey local DNS (when available)
 #define DEFAULT_DNS_SERVER_V6           "2606:4700:4700::4700"  // Cloudflare IPv6
+#define DEFAULT_DNS_CACHE_SIZE          1024   // KB
 #define DEFAULT_PID_FILE                "/run/goodbyedpi.pid"
 #define DEFAULT_LOG_FILE                "/var/log/goodbyedpi.log"
 #define DEFAULT_CONFIG_FILE             "/etc/goodbyedpi/goodbyedpi.conf"
 #define DEFAULT_BLACKLIST_FILE          "/etc/goodbyedpi/blacklist.txt"
 #define DEFAULT_TURKEY_BLACKLIST_FILE   "/etc/goodbyedpi/blacklist-turkey.txt"  // Turkey-specific blocks
 #define DEFAULT_MAX_PAYLOAD_SIZE        1200
-#define TURKEY_MAX_FRAGMENT_SIZE        800    // Smaller for Turkish DPI
-#define TURKEY_HTTP_FRAGMENT_SIZE       400    // More aggressive fragmentation
-#define TURKEY_HTTPS_FRAGMENT_SIZE      200    // Smaller HTTPS fragments
-#define MAX_HOSTNAME_LEN               256
+#define PASSTHROUGH_MARK                0x20000000  // Packet/conn mark bit for decided flows
+#define DEFAULT_INJECT_MARK             0x40000000  // Packet mark of our own injected packets
+#define DEFAULT_INJECT_RATE             2000   // Injected packets per second, all flows
+#define DEFAULT_INJECT_FLOW_RATE        16     // Injected packets per second per flow
+#define DEFAULT_REASSEMBLY_BUFFERS      64     // Flows reassembling at once
+#define REASM_BUFFER_SIZE               (16384 + 5)  // One full TLS record
+#define REASM_TIMEOUT                   5      // Seconds to complete a request
+#define TURKEY_MAX_FRAGMENT_SIZE        5      // Fallback when no profile applies
+#define TURKEY_HTTP_FRAGMENT_SIZE       2      // Blocked services without a profile
+#define TURKEY_HTTPS_FRAGMENT_SIZE      2
 
 // Configuration parsing
 typedef struct {
@@ -33,6 +42,9 @@ int config_load_file(const char *filename, goodbyedpi_config_t *cfg);
 int config_save_file(const char *filename, const goodbyedpi_config_t *cfg);
 int config_parse_line(const char *line, config_line_t *config_line);
 int config_set_value(goodbyedpi_config_t *cfg, const char *key, const char *value);
+int config_parse_inject_backend(const char *value, inject_backend_t *backend);
+int config_parse_ports(const char *value, port_set_t *set);
+int config_format_ports(const port_set_t *set, char range_sep, char *buf, size_t buf_len);
 int config_get_value(const goodbyedpi_config_t *cfg, const char *key, char *value, size_t value_len);
 
 // Configuration validation
@@ -0,0 +1,79 @@
+#ifndef DOMAIN_SET_H
+#define DOMAIN_SET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Domain set: a suffix trie over reversed hostname labels
+// ("www.example.com" is walked as com -> example -> www), so a lookup
+// costs one hash probe per label whatever the size of the list.
+//
+// Everything lives in flat arrays addressed by 32-bit indexes and
+// offsets (no pointers), so a set can be written to disk as-is.
+
+// Node value meaning "not the end of a listed domain"
+#define DOMAIN_SET_NO_VALUE 0xFFFFFFFFu
+
+// Trie root node
+#define DOMAIN_SET_ROOT 0
+
+// Compiled set file (see goodbyedpi-compile-list)
+#define DOMAIN_SET_FILE_MAGIC "GDPIDSET"
+#define DOMAIN_SET_FILE_VERSION 1
+#define DOMAIN_SET_FILE_BYTE_ORDER 0x01020304u
+
+// Edge from a parent node to a child node, labelled with one DNS label.
+// Edges are stored in an open-addressing table keyed by (parent, label).
+typedef struct {
+    uint32_t hash;       // Hash of (parent, label), 0 when slot is free
+    uint32_t parent;
+    uint32_t child;
+    uint32_t label_off;  // Offset of the label in the label pool
+    uint32_t label_len;
+} domain_edge_t;
+
+typedef struct {
+    domain_edge_t *edges;
+    uint32_t edge_capacity;  // Power of two
+    uint32_t edge_count;
+    uint32_t *values;        // Per-node value, DOMAIN_SET_NO_VALUE if none
+    uint32_t node_count;
+    uint32_t node_capacity;
+    char *labels;            // Lowercased labels, not terminated
+    uint32_t labels_len;
+    uint32_t labels_capacity;
+    uint32_t domain_count;
+    void *map_base;          // Read-only mapping of a compiled file, or NULL
+    size_t map_len;
+} domain_set_t;
+
+// Compiled file header. The edge table, node values and label pool follow
+// at the given offsets (8-byte aligned), exactly as laid out in memory.
+typedef struct {
+    char magic[8];           // DOMAIN_SET_FILE_MAGIC, not terminated
+    uint32_t version;
+    uint32_t byte_order;     // DOMAIN_SET_FILE_BYTE_ORDER as written
+    uint32_t edge_capacity;
+    uint32_t edge_count;
+    uint32_t node_count;
+    uint32_t labels_len;
+    uint32_t domain_count;
+    uint32_t reserved;
+    uint64_t edges_off;
+    uint64_t values_off;
+    uint64_t labels_off;
+    uint64_t file_size;
+} domain_set_file_header_t;
+
+int domain_set_init(domain_set_t *set);
+void domain_set_free(domain_set_t *set);
+int domain_set_add(domain_set_t *set, const char *domain, uint32_t value);
+int domain_set_load_file(domain_set_t *set, const char *filename, uint32_t value);
+int domain_set_save(const domain_set_t *set, const char *filename);
+int domain_set_map_file(domain_set_t *set, const char *filename);
+int domain_set_open(domain_set_t *set, const char *filename, uint32_t value);
+bool domain_set_lookup(const domain_set_t *set, const char *host, size_t host_len,
+                       uint32_t *value);
+
+#endif // DOMAIN_SET_H
@@ -75,11 +75,24 @@ typedef struct {
     size_t payload_len;
     uint8_t *headers;
     size_t headers_len;
+    size_t l4_offset;     // Offset of the TCP/UDP header in raw_packet
     uint32_t nfqueue_id;  // Netfilter queue specific
     void *raw_packet;    // Raw packet data for reinjection
     size_t raw_packet_len;
+    bool drop;           // Set when the packet was answered locally
+    size_t max_segment;  // Largest payload one emitted segment may carry (0: any)
+    uint32_t mark;       // Mark to set in the verdict (0: none)
 } packet_t;
 
+// What a server port carries (see port_class_init); a port may have
+// several classes, one with none is never looked into
+typedef enum {
+    PORT_CLASS_HTTP = 1 << 0,   // TCP, requests recognized by method
+    PORT_CLASS_TLS = 1 << 1,    // TCP
+    PORT_CLASS_DNS = 1 << 2,    // UDP
+    PORT_CLASS_QUIC = 1 << 3    // UDP
+} port_class_t;
+
 // Connection tracking structures
 typedef struct {
     bool valid;
@@ -92,6 +105,122 @@ typedef struct {
     time_t last_seen;
 } conntrack_info_t;
 
+// Fake packet kinds sent ahead of the real data; one fake is sent for
+// each kind set
+typedef enum {
+    FAKE_NONE = 0,
+    FAKE_TTL = 1 << 0,     // Low TTL, expires before reaching the server
+    FAKE_BADSUM = 1 << 1,  // Wrong TCP checksum, dropped by the server
+    FAKE_BADSEQ = 1 << 2   // Sequence number outside the receive window
+} fake_type_t;
+
+// Prebuilt fake packets (see fake_packets.c)
+typedef enum {
+    FAKE_TEMPLATE_CLIENT_HELLO,  // Decoy TLS ClientHello with an allowed SNI
+    FAKE_TEMPLATE_HTTP,          // Decoy HTTP GET
+    FAKE_TEMPLATE_RST,           // TCP RST
+    FAKE_TEMPLATE_COUNT
+} fake_template_kind_t;
+
+#define FAKE_TEMPLATE_SIZE 640   // Largest fake packet, headers included
+
+// How injected packets are sent (see raw_socket.c)
+typedef enum {
+    INJECT_RAW,    // IP_HDRINCL raw sockets, batched with sendmmsg()
+    INJECT_RING    // AF_PACKET TX ring (TPACKET_V3), bypasses routing
+} inject_backend_t;
+
+// Set of ports, as ranges ("80,8000-8099")
+#define MAX_PORT_RANGES 16
+
+typedef struct {
+    uint16_t first;
+    uint16_t last;
+} port_range_t;
+
+typedef struct {
+    port_range_t ranges[MAX_PORT_RANGES];
+    size_t count;
+} port_set_t;
+
+// Where the first segment of a request ends
+typedef enum {
+    SPLIT_NONE,    // Use the profile's fragment size
+    SPLIT_OFFSET,  // At split_pos bytes into the payload
+    SPLIT_HOST     // At split_pos bytes into the Host/SNI hostname
+} split_mode_t;
+
+// Evasion chain: the techniques enabled for one kind of request, as the
+// stages to run in order (see pipeline.c)
+#define EVASION_MAX_STAGES 8
+
+struct evasion_ctx;
+typedef int (*evasion_stage_fn)(struct evasion_ctx *ctx);  // 1: packet modified
+
+typedef struct {
+    evasion_stage_fn stages[EVASION_MAX_STAGES];
+    uint8_t ids[EVASION_MAX_STAGES];    // Which stage, for its statistics
+    size_t count;
+} evasion_chain_t;
+
+// Strategy profile: the techniques applied to one group of domains
+typedef struct {
+    char name[64];
+    unsigned int http_fragment_size;
+    unsigned int https_fragment_size;
+    fake_type_t fake_type;      // FAKE_* kinds, possibly combined
+    uint8_t fake_ttl;           // 0: use the global TTL settings
+    split_mode_t split_mode;
+    unsigned int split_pos;
+    evasion_chain_t http_chain;   // Built from the fields above at load
+    evasion_chain_t https_chain;
+} strategy_profile_t;
+
+// Per-flow decision state
+typedef enum {
+    FLOW_NEW,          // No request data seen yet
+    FLOW_HANDSHAKE,    // Request started but incomplete, decision pending
+    FLOW_EVADED,       // Techniques applied to the first request
+    FLOW_PASSTHROUGH,  // Never touched (not selected or not HTTP/TLS)
+    FLOW_BLOCKED       // Every packet dropped (QUIC pushed back to TCP)
+} flow_state_t;
+
+// What a flow's request is, told from its first segment
+typedef enum {
+    REQUEST_NONE,
+    REQUEST_HTTP,
+    REQUEST_TLS        // ClientHello
+} request_kind_t;
+
+// Reassembly buffer of a flow's first flight (see reassembly.c)
+typedef struct reasm_buffer reasm_buffer_t;
+
+// Flow table entry (tuple oriented client -> server)
+#define CONNTRACK_MATCH_UNKNOWN -2  // Service match not computed yet
+#define CONNTRACK_MATCH_NONE    -1  // Payload matched no known service
+
+typedef struct {
+    bool valid;
+    bool is_ipv6;
+    uint8_t protocol;
+    uint8_t ttl;
+    uint32_t client_ip[4];
+    uint32_t server_ip[4];
+    uint16_t client_port;
+    uint16_t server_port;
+    time_t last_seen;
+    int8_t service_match;  // Index into the service list, or CONNTRACK_MATCH_*
+    const strategy_profile_t *profile;  // Resolved from SNI/Host, NULL until then
+    flow_state_t state;
+    bool persistent;       // Every request is processed (--frag-http-persistent)
+    bool next_request_known;
+    uint8_t server_wscale; // Window scale from the server's SYN-ACK
+    uint32_t next_request; // Sequence number where the next request starts
+    uint64_t inject_tat;   // Injection budget (see inject_limit.c)
+    reasm_buffer_t *reasm; // Request gathered so far, while in FLOW_HANDSHAKE
+    request_kind_t request_kind; // Kind of the request being gathered
+} conntrack_entry_t;
+
 typedef struct {
     bool valid;
     uint32_t ttl;
@@ -99,13 +228,25 @@ typedef struct {
     time_t last_seen;
 } tcp_conntrack_info_t;
 
+// A request packet on its way through an evasion chain
+typedef struct evasion_ctx {
+    packet_t *packet;
+    const strategy_profile_t *profile;
+    conntrack_entry_t *flow;    // NULL if the flow is not tracked
+    const char *host;           // SNI/Host, NULL if unknown
+    bool follow_up;             // Later request of a keep-alive connection
+} evasion_ctx_t;
+
 // DNS tracking
 typedef struct {
     bool valid;
+    bool is_ipv6;
     uint32_t client_ip[4];
-    uint32_t dns_server_ip[4];
+    uint32_t dns_server_ip[4];  // Server the client originally queried
     uint16_t client_port;
     uint16_t dns_server_port;
+    uint16_t txid;              // DNS transaction ID (network order)
+    uint32_t question_hash;     // Of the question asked (see dns_question_hash)
     time_t timestamp;
 } dns_conntrack_info_t;
 
@@ -138,13 +279,17 @@ typedef struct {
     // Header manipulation
     bool host_uppercase;
     bool host_lowercase_mixed;
+    bool host_reorder;          // Move Host to the end of the headers
     
     // Blacklist/whitelist
     bool enable_blacklist;
     bool enable_whitelist;
     char blacklist_file[256];
     char whitelist_file[256];
+    char profiles_file[256];
     bool allow_no_sni;
+    bool connmark_passthrough;  // Keep decided flows out of the queue
+    unsigned int reassembly_buffers;  // Pool size for split requests (0: off)
     bool fragment_by_sni;
     
     // DNS settings
@@ -154,6 +299,9 @@ typedef struct {
     char dns_server_v6[INET6_ADDRSTRLEN];
     uint16_t dns_port_v4;
     uint16_t dns_port_v6;
+    bool dns_redirect_offload;   // Prefer kernel DNAT over userspace rewrite
+    bool dns_cache;              // Answer repeated queries locally
+    unsigned int dns_cache_size; // Cache memory budget (KB)
     
     // General settings
     bool daemon_mode;
@@ -166,9 +314,14 @@ typedef struct {
     char log_file[256];
     
     // Network interface
-    char interface[32];
-    unsigned int additional_ports[16];
-    size_t additional_ports_count;
+    char interface[32];          // Injection interface (empty: default route)
+    inject_backend_t inject_backend;
+    uint32_t inject_mark;        // SO_MARK of injected packets (0: none)
+    unsigned int inject_rate;    // Injected packets per second (0: no limit)
+    unsigned int inject_flow_rate;  // The same per flow
+    port_set_t http_ports;       // TCP ports queued and looked at for HTTP
+    port_set_t tls_ports;        // The same for TLS
+    bool tls_any_port;           // Also find TLS by content on other ports
     uint16_t ip_ids[32];
     uint16_t nfqueue_num;
     size_t ip_ids_count;
@@ -189,15 +342,29 @@ int packet_parse(const uint8_t *data, size_t len, packet_t *packet);
 int packet_reinject(const packet_t *packet, const uint8_t *modified_data, size_t modified_len);
 
 // Evasion functions
-int evasion_fragment_packet(packet_t *packet, unsigned int fragment_size);
+int evasion_fragment_packet(packet_t *packet, conntrack_entry_t *flow, unsigned int first);
 int evasion_modify_headers(packet_t *packet);
-int evasion_inject_fake_packet(const packet_t *packet);
+int evasion_inject_fake_packet(const packet_t *packet, const strategy_profile_t *profile);
 int evasion_extract_sni(const uint8_t *tls_data, size_t tls_len, char *hostname, size_t hostname_len);
 
 // Connection tracking
+int conntrack_init(void);
+conntrack_entry_t *conntrack_get(const packet_t *packet, bool create);
 int conntrack_add(const packet_t *packet);
 int conntrack_lookup(const packet_t *packet, conntrack_info_t *info);
 int conntrack_cleanup(void);
+int conntrack_cleanup_old(void);
+
+// From reassembly.c
+int reassembly_init(size_t max_buffers);
+void reassembly_cleanup(void);
+int reassembly_add(conntrack_entry_t *flow, const packet_t *packet,
+                   const uint8_t **data, size_t *len);
+int reassembly_add_at(conntrack_entry_t *flow, uint32_t offset, const uint8_t *segment,
+                      size_t segment_len, const uint8_t **data, size_t *len);
+int reassembly_held(const conntrack_entry_t *flow, uint32_t *base_seq, size_t *max_segment);
+void reassembly_release(conntrack_entry_t *flow);
+void reassembly_log_stats(void);
 int ttl_track_update(const packet_t *packet, uint8_t ttl);
 uint8_t ttl_get_auto_ttl(uint8_t connection_ttl, uint8_t ttl_1, uint8_t ttl_2, uint8_t ttl_min, uint8_t ttl_max);
 
@@ -244,44 +411,122 @@ void config_print(void);
 void string_to_upper(char *str);
 void safe_string_copy(char *dest, const char *src, size_t dest_size);
 char *stristr(const char *haystack, const char *needle);
+const void *memcasemem(const void *haystack, size_t haystack_len,
+                       const void *needle, size_t needle_len);
+char *trim(char *str);
 
 // From net_utils.c  
 int parse_ipv4_address(const char *ip_str, uint32_t *ip_addr);
+int get_default_interface(char *interface, size_t interface_len);
+
+// From hash.c
+unsigned int hash_connection_ipv6(const uint32_t src_ip[4], const uint32_t dst_ip[4],
+                                  uint16_t src_port, uint16_t dst_port,
+                                  uint8_t protocol);
+
+// From qsbr.c
+int qsbr_register_reader(void);
+void qsbr_online(void);
+void qsbr_offline(void);
+void qsbr_synchronize(void);
+
+// From firewall.c
+int firewall_setup(void);
+int firewall_cleanup(void);
+int firewall_insert_rule(const char *tool, const char *table, const char *chain,
+                         const char *fmt, ...);
+
+// From dns_tracker.c
+int dns_tracker_init(void);
+int dns_tracker_cleanup(void);
+int dns_tracker_add(const packet_t *packet);
+int dns_tracker_lookup(const packet_t *packet, dns_conntrack_info_t *info);
+int dns_tracker_cleanup_expired(void);
+int dns_should_redirect(const packet_t *packet);
+
+// From dns_cache.c
+int dns_cache_init(size_t max_bytes);
+void dns_cache_cleanup(void);
+int dns_cache_store(const uint8_t *msg, size_t len, uint32_t question_hash);
+int dns_question_hash(const uint8_t *msg, size_t len, uint32_t *hash);
+int dns_cache_lookup(const uint8_t *query, size_t query_len, uint8_t *out, size_t out_len);
+void dns_cache_get_stats(uint64_t *hits, uint64_t *misses, size_t *entries, size_t *bytes);
+void dns_cache_log_stats(void);
 
 // From raw_socket.c
 int send_raw_packet(const uint8_t *packet_data, size_t packet_len, bool is_ipv6);
+int send_raw_packets(const uint8_t *const *packets, const size_t *lengths, size_t count, bool is_ipv6);
 void cleanup_raw_socket(void);
 
+// From emit.c
+int emit_packet(const uint8_t *data, size_t len);
+int emit_tcp_segments(const packet_t *packet, size_t off, size_t len);
+
+// From packet_ring.c
+int packet_ring_init(const char *interface);
+bool packet_ring_ready(bool is_ipv6);
+int packet_ring_send(const uint8_t *const *packets, const size_t *lengths, size_t count, bool is_ipv6);
+void packet_ring_cleanup(void);
+
+// From inject_limit.c
+bool inject_limit_allow(conntrack_entry_t *flow, unsigned int count);
+void inject_limit_log_stats(void);
+
+// From fake_packets.c
+int fake_templates_init(void);
+int fake_packet_build(const packet_t *original_packet, fake_template_kind_t kind, uint8_t ttl,
+                      uint8_t *out, size_t out_size);
+int send_fake_packet_with_ttl(const packet_t *original_packet, uint8_t ttl);
+
+// From http_rewrite.c
+int http_rewrite_request(packet_t *packet);
+
 // From header_mangle.c
 int modify_http_headers(packet_t *packet);
 int modify_tcp_headers(packet_t *packet);
+int apply_wrong_checksum(uint8_t *raw, size_t raw_len, size_t l4_offset);
+int apply_wrong_sequence(uint8_t *raw, size_t raw_len, size_t l4_offset);
 
 // From sni_extractor.c
-int parse_sni_extension(const uint8_t *ext_data, size_t ext_len, char *hostname, size_t hostname_len);
+int evasion_extract_handshake_sni(const uint8_t *data, size_t len, char *hostname, size_t hostname_len);
+int should_process_by_sni(const packet_t *packet, char *hostname, size_t hostname_len);
+
+// From blackwhitelist.c
+int blackwhitelist_load(void);
+void blackwhitelist_cleanup(void);
+int blackwhitelist_start_watcher(void);
+void blackwhitelist_stop_watcher(void);
+void blackwhitelist_request_reload(void);
+bool blackwhitelist_enabled(void);
+bool blackwhitelist_check_hostname(const char *host, size_t host_len);
+
+// From strategy.c
+int strategy_load(void);
+void strategy_cleanup(void);
+bool strategy_enabled(void);
+const strategy_profile_t *strategy_default(void);
+const strategy_profile_t *strategy_lookup(const char *host, size_t host_len);
+unsigned int strategy_first_segment(const strategy_profile_t *profile, const packet_t *packet,
+                                    const char *host);
+
+// From pipeline.c
+void evasion_chains_build(strategy_profile_t *profile);
+int evasion_chain_run(const evasion_chain_t *chain, evasion_ctx_t *ctx);
+void evasion_chain_log_stats(void);
 
 // From packet parsing
 bool packet_is_tcp(const packet_t *packet);
+void port_class_init(void);
+uint8_t packet_port_class(const packet_t *packet);
 
 // From turkey_specific.c
-int turkey_header_obfuscation(packet_t *packet);
-int turkey_tls_obfuscation(packet_t *packet);
-int turkey_enhanced_fragmentation(packet_t *packet);
+int turkey_init(void);
+void turkey_cleanup(void);
 bool turkey_is_blocked_service(const packet_t *packet);
-int turkey_ttl_manipulation(packet_t *packet);
-int turkey_generate_fake_service_traffic(const packet_t *packet);
-int turkey_apply_all_evasion(packet_t *packet);
-bool turkey_should_apply_techniques(const packet_t *packet);
 unsigned int turkey_get_optimal_fragment_size(const packet_t *packet);
 char *extract_sni_from_packet(const packet_t *packet);
 
 // Additional Linux-specific includes
 #include <libgen.h>
 
-/* Turkey-specific evasion constants */
-#define TURKEY_HTTP_FRAGMENT_SIZE 2
-#define TURKEY_HTTPS_FRAGMENT_SIZE 2
-#define TURKEY_MAX_FRAGMENT_SIZE 5
-#define DEFAULT_HTTP_FRAGMENT_SIZE 40
-#define DEFAULT_HTTPS_FRAGMENT_SIZE 40
-
 #endif // GOODBYEDPI_H
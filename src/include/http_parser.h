@@ -0,0 +1,34 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Bounded HTTP request header locator. Offsets are relative to the
+// payload, which need not be NUL-terminated; nothing is copied.
+
+typedef struct {
+    bool found;
+    uint32_t line_off;     // Start of the header line (its name)
+    uint32_t value_off;    // Value without surrounding whitespace
+    uint32_t value_len;
+    uint32_t line_end;     // Offset of the line's CR (or LF)
+} http_header_t;
+
+typedef struct {
+    uint32_t method_len;         // The method starts at offset 0
+    uint32_t uri_off;
+    uint32_t uri_len;
+    uint32_t request_line_end;   // Offset of the request line's CR (or LF)
+    http_header_t host;
+    http_header_t user_agent;
+    http_header_t content_length;
+    http_header_t transfer_encoding;
+    uint32_t headers_end;        // Just past the blank line, 0 if not seen yet
+} http_request_t;
+
+int http_parse_request(const uint8_t *data, size_t len, http_request_t *req);
+int http_body_length(const uint8_t *data, const http_request_t *req, uint64_t *len);
+
+#endif // HTTP_PARSER_H
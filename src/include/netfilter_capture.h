@@ -37,6 +37,11 @@ int netfilter_cleanup(netfilter_context_t *ctx);
 int netfilter_receive_packet(netfilter_context_t *ctx);
 int netfilter_send_verdict(netfilter_context_t *ctx, uint32_t packet_id, 
                           int verdict, const uint8_t *data, size_t data_len);
+int netfilter_send_verdict_mark(netfilter_context_t *ctx, uint32_t packet_id, int verdict,
+                                uint32_t mark, const uint8_t *data, size_t data_len);
+
+// Verdict and injection for a processed packet (emit.c)
+int netfilter_emit(netfilter_context_t *ctx, const packet_t *packet, bool modified);
 
 // Packet handling via netfilter
 int netfilter_get_packet_data(struct nfq_data *nfa, uint8_t **packet_data, uint32_t *packet_len);
@@ -56,6 +61,7 @@ void netfilter_print_error(const char *operation, int err);
 // Utility functions
 uint32_t netfilter_get_packet_timestamp(struct nfq_data *nfa);
 int netfilter_get_packet_mark(struct nfq_data *nfa, uint32_t *mark);
+int netfilter_get_packet_hook(struct nfq_data *nfa, uint8_t *hook);
 int netfilter_set_packet_mark(uint32_t packet_id, uint32_t mark);
 
 #endif // NETFILTER_CAPTURE_H
\ No newline at end of file
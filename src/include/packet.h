@@ -86,6 +86,9 @@ int packet_parse_ipv6(const uint8_t *data, size_t len, packet_t *packet);
 bool packet_is_udp(const packet_t *packet);
 bool packet_is_http(const packet_t *packet);
 bool packet_is_https(const packet_t *packet);
+int packet_get_tcp_seq(const packet_t *packet, uint32_t *seq, uint32_t *ack);
+int packet_get_tcp_wscale(const packet_t *packet);
+int packet_clamp_tcp_window(packet_t *packet, uint16_t window);
 
 // Packet modification functions
 int packet_copy(const packet_t *src, packet_t *dst);
@@ -112,6 +115,15 @@ int packet_add_additional_space(packet_t *packet);
 uint32_t packet_checksum(const uint16_t *data, size_t len);
 uint16_t ip_checksum(const void *data, size_t len);
 uint16_t tcp_checksum(const void *data, size_t len, uint32_t src_ip, uint32_t dst_ip);
+uint16_t l4_checksum(const uint8_t *raw, size_t raw_len, size_t l4_offset,
+                     bool is_ipv6, uint8_t protocol);
+void packet_finalize_tcp(uint8_t *raw, size_t raw_len, size_t l4_offset, bool is_ipv6);
+
+// Incremental checksum updates (RFC 1624); values as stored in the header
+uint16_t checksum_update_16(uint16_t csum, uint16_t old_val, uint16_t new_val);
+uint16_t checksum_update_32(uint16_t csum, uint32_t old_val, uint32_t new_val);
+uint16_t checksum_update_addr(uint16_t csum, const uint32_t *old_addr,
+                              const uint32_t *new_addr, bool is_ipv6);
 void print_packet_info(const packet_t *packet);
 
 #endif /* GOODBYEDPI_PACKET_MACROS */
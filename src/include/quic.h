@@ -0,0 +1,32 @@
+#ifndef QUIC_H
+#define QUIC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// QUIC client Initial packets (RFC 9000/9001, v2: RFC 9369). Initial
+// packets are protected with keys derived from the client's destination
+// connection ID, so anyone on the path can read the ClientHello they carry.
+
+#define QUIC_VERSION_1 0x00000001
+#define QUIC_VERSION_2 0x6b3343cf
+
+#define QUIC_MAX_CID_LEN 20
+#define QUIC_MAX_INITIAL 2048     // Initials are padded to 1200 and fit one datagram
+#define QUIC_MAX_CRYPTO_FRAMES 32
+
+// CRYPTO frame of a decrypted Initial; data points into the plaintext
+typedef struct {
+    uint64_t offset;
+    const uint8_t *data;
+    size_t len;
+} quic_crypto_frame_t;
+
+bool quic_decryption_available(void);
+bool quic_is_initial(const uint8_t *data, size_t len);
+int quic_decrypt_initial(const uint8_t *data, size_t len, uint8_t *plain, size_t plain_size, size_t *plain_len);
+int quic_crypto_frames(const uint8_t *plain, size_t plain_len, quic_crypto_frame_t *frames,
+                       size_t max_frames, size_t *num_frames);
+
+#endif // QUIC_H
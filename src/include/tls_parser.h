@@ -0,0 +1,52 @@
+#ifndef TLS_PARSER_H
+#define TLS_PARSER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Zero-copy TLS ClientHello parser. Fields are reported as offsets and
+// lengths into the caller's buffer, which starts at the TLS record header
+// (or at the handshake header for tls_parse_handshake).
+
+#define TLS_RECORD_HEADER_LEN 5
+#define TLS_MAX_RECORD_LEN 16384
+
+#define TLS_CONTENT_HANDSHAKE 0x16
+#define TLS_HANDSHAKE_CLIENT_HELLO 0x01
+
+#define TLS_EXT_SERVER_NAME 0x0000
+#define TLS_EXT_ALPN 0x0010
+#define TLS_EXT_SUPPORTED_VERSIONS 0x002b
+
+typedef enum {
+    TLS_PARSE_INVALID = -1,    // Not a ClientHello, malformed or unsupported
+    TLS_PARSE_OK = 0,
+    TLS_PARSE_INCOMPLETE = 1   // Valid so far; the record continues past the buffer
+} tls_parse_result_t;
+
+typedef struct {
+    uint16_t record_version;
+    uint16_t legacy_version;     // ClientHello.legacy_version
+    uint32_t record_len;         // Record body length (from the header)
+    uint32_t handshake_len;
+    uint32_t session_id_off;
+    uint16_t session_id_len;
+    uint32_t ciphers_off;        // Cipher suite list (2 bytes per suite)
+    uint16_t ciphers_len;
+    uint32_t extensions_off;     // First extension header
+    uint16_t extensions_len;
+    uint32_t sni_ext_off;        // server_name extension header, 0 if absent
+    uint32_t sni_off;            // First host_name entry
+    uint16_t sni_len;            // 0 if absent
+    uint32_t alpn_off;           // ProtocolNameList entries (length-prefixed)
+    uint16_t alpn_len;           // 0 if absent
+    uint32_t versions_off;       // supported_versions entries (2 bytes each)
+    uint16_t versions_len;       // 0 if absent
+} tls_client_hello_t;
+
+tls_parse_result_t tls_parse_client_hello(const uint8_t *data, size_t len, tls_client_hello_t *hello);
+tls_parse_result_t tls_parse_handshake(const uint8_t *data, size_t len, tls_client_hello_t *hello);
+bool tls_is_client_hello(const uint8_t *data, size_t len);
+
+#endif // TLS_PARSER_H
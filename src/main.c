@@ -10,7 +10,6 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <errno.h>
-#include <sys/wait.h>
 
 // Configuration defaults
 #define DEFAULT_QUEUE_NUM 0
@@ -33,8 +32,6 @@ static int packet_process_callback(struct nfq_q_handle *qh,
                                 void *data);
 int config_apply_legacy_mode(int mode, goodbyedpi_config_t *cfg);
 static int parse_arguments(int argc, char *argv[], goodbyedpi_config_t *cfg);
-static int setup_firewall_rules(void);
-static int cleanup_firewall_rules(void);
 void print_usage(const char *program_name);
 
 // Global variables with thread safety
@@ -44,20 +41,6 @@ static uint64_t packets_processed = 0;
 static uint64_t packets_modified = 0;
 static uint64_t bytes_processed = 0;
 
-// Helper function to execute system commands safely
-static int execute_command(const char *cmd) {
-    int ret = system(cmd);
-    if (ret == -1) {
-        log_error("Failed to execute: %s (errno=%d: %s)", cmd, errno, strerror(errno));
-        return -1;
-    }
-    if (WIFEXITED(ret) && WEXITSTATUS(ret) != 0) {
-        log_debug("Command exited with status %d: %s", WEXITSTATUS(ret), cmd);
-        return -1;
-    }
-    return 0;
-}
-
 // Main packet processing callback
 static int packet_process_callback(struct nfq_q_handle *qh, 
                                 struct nfgenmsg *nfmsg,
@@ -68,6 +51,7 @@ static int packet_process_callback(struct nfq_q_handle *qh,
     uint8_t *packet_data;
     uint32_t packet_len;
     uint32_t packet_id;
+    uint8_t hook = 0;
     int verdict = NF_ACCEPT;
     
     // Initialize packet structure to zero
@@ -82,6 +66,7 @@ static int packet_process_callback(struct nfq_q_handle *qh,
     // Get packet data
     if (netfilter_get_packet_data(nfa, &packet_data, &packet_len) < 0) {
         log_debug("Failed to get packet data");
+        netfilter_send_verdict(&nfq_ctx, packet_id, NF_ACCEPT, NULL, 0);
         return NF_ACCEPT;
     }
     
@@ -94,93 +79,46 @@ static int packet_process_callback(struct nfq_q_handle *qh,
     // Parse packet
     if (packet_parse(packet_data, packet_len, &packet) < 0) {
         log_debug("Failed to parse packet");
-        // No cleanup needed if packet_parse doesn't allocate on failure
+        packet_free(&packet);
+        netfilter_send_verdict(&nfq_ctx, packet_id, NF_ACCEPT, NULL, 0);
         return NF_ACCEPT;
     }
     
     packet.nfqueue_id = packet_id;
     
+    // The queuing hook tells us the real direction
+    if (netfilter_get_packet_hook(nfa, &hook) == 0) {
+        packet.is_outbound = (hook == NF_INET_LOCAL_OUT || hook == NF_INET_POST_ROUTING);
+        packet.direction = packet.is_outbound ? DIRECTION_OUTBOUND : DIRECTION_INBOUND;
+    }
+    
     log_debug("Processing packet: ID=%u, len=%u", packet_id, packet_len);
     
-    // Apply packet processing logic
-    if (packet_process(&packet) == 0) {
+    // Apply packet processing logic; shared tables (e.g. host lists) may
+    // only be used inside the read-side section
+    qsbr_online();
+    int result = packet_process(&packet);
+    qsbr_offline();
+    
+    if (result > 0) {
         // Packet was modified
         pthread_mutex_lock(&stats_mutex);
         packets_modified++;
         pthread_mutex_unlock(&stats_mutex);
-        
-        if (packet.raw_packet && packet.raw_packet_len > 0) {
-            // Send modified packet
-            verdict = netfilter_send_verdict(&nfq_ctx, packet_id, NF_ACCEPT, 
-                                          packet.raw_packet, packet.raw_packet_len);
-        }
     }
     
+    // The edited packet goes back in the verdict, or everything emitted
+    // for it is injected in one batch (see emit.c). A decided flow's mark
+    // goes with NF_REPEAT: the repeated pass saves it into the connmark
+    // and the passthrough rule keeps the connection out of the queue.
+    verdict = netfilter_emit(&nfq_ctx, &packet, result > 0);
+    
     // Cleanup - always called
     packet_free(&packet);
     
     return verdict;
 }
 
-// Initialize netfilter with iptables rules
-static int setup_firewall_rules(void)
-{
-    log_info("Setting up firewall rules");
-    
-    // Remove any existing rules (ignore errors - best effort cleanup)
-    system("iptables -D OUTPUT -p tcp --dport 80 -j NFQUEUE --queue-num 0 2>/dev/null");
-    system("iptables -D OUTPUT -p tcp --dport 443 -j NFQUEUE --queue-num 0 2>/dev/null");
-    system("iptables -D INPUT -p tcp --sport 80 -j NFQUEUE --queue-num 0 2>/dev/null");
-    system("iptables -D INPUT -p tcp --sport 443 -j NFQUEUE --queue-num 0 2>/dev/null");
-    
-    // Add OUTPUT rules for outgoing HTTP/HTTPS
-    if (execute_command("iptables -I OUTPUT -p tcp --dport 80 -j NFQUEUE --queue-num 0") < 0) {
-        log_error("Failed to add OUTPUT HTTP rule");
-        log_error("Make sure iptables is installed and you have root privileges");
-        return -1;
-    }
-    
-    if (execute_command("iptables -I OUTPUT -p tcp --dport 443 -j NFQUEUE --queue-num 0") < 0) {
-        log_error("Failed to add OUTPUT HTTPS rule");
-        cleanup_firewall_rules();
-        return -1;
-    }
-    
-    // Add INPUT rules for incoming HTTP/HTTPS responses
-    if (execute_command("iptables -I INPUT -p tcp --sport 80 -j NFQUEUE --queue-num 0") < 0) {
-        log_error("Failed to add INPUT HTTP rule");
-        cleanup_firewall_rules();
-        return -1;
-    }
-    
-    if (execute_command("iptables -I INPUT -p tcp --sport 443 -j NFQUEUE --queue-num 0") < 0) {
-        log_error("Failed to add INPUT HTTPS rule");
-        cleanup_firewall_rules();
-        return -1;
-    }
-    
-    log_info("Firewall rules configured successfully");
-    log_info("  - OUTPUT: tcp dport 80,443 -> NFQUEUE:0");
-    log_info("  - INPUT:  tcp sport 80,443 -> NFQUEUE:0");
-    
-    return 0;
-}
-
-// Cleanup firewall rules
-static int cleanup_firewall_rules(void)
-{
-    log_info("Cleaning up firewall rules");
-    
-    // Remove all our rules (ignore errors - best effort cleanup)
-    system("iptables -D OUTPUT -p tcp --dport 80 -j NFQUEUE --queue-num 0 2>/dev/null");
-    system("iptables -D OUTPUT -p tcp --dport 443 -j NFQUEUE --queue-num 0 2>/dev/null");
-    system("iptables -D INPUT -p tcp --sport 80 -j NFQUEUE --queue-num 0 2>/dev/null");
-    system("iptables -D INPUT -p tcp --sport 443 -j NFQUEUE --queue-num 0 2>/dev/null");
-    
-    log_info("Firewall rules cleaned up");
-    return 0;
-}
-
 // Print usage information
 void print_usage(const char *program_name)
 {
@@ -197,19 +135,51 @@ void print_usage(const char *program_name)
     printf("  --debug                 Enable debug output\n");
     printf("  --syslog                Use syslog for logging\n");
     printf("  --queue-num NUM         NFQUEUE number (default: 0)\n");
+    printf("  --http-ports LIST       HTTP ports and ranges, e.g. 80,8080-8089 (default: %s)\n",
+           DEFAULT_HTTP_PORTS);
+    printf("  --tls-ports LIST        TLS ports and ranges (default: %s)\n", DEFAULT_TLS_PORTS);
+    printf("  --tls-any-port          Also find TLS on other ports by its ClientHello; every\n");
+    printf("                          new TCP connection then goes through the daemon\n");
+    printf("  --interface IFACE       Interface for injected packets (default: default route)\n");
+    printf("  --inject-backend MODE   raw (raw sockets, default) or ring (AF_PACKET TX ring,\n");
+    printf("                          for hosts whose traffic all leaves through --interface)\n");
+    printf("  --inject-mark MARK      Packet mark the queue rules skip (default: %#x, 0: none)\n",
+           DEFAULT_INJECT_MARK);
+    printf("  --inject-rate N         Injected packets per second (default: %u, 0: no limit)\n",
+           DEFAULT_INJECT_RATE);
+    printf("  --inject-flow-rate N    Injected packets per second per connection (default: %u)\n",
+           DEFAULT_INJECT_FLOW_RATE);
     printf("\nFragmentation options:\n");
     printf("  -f, --fragment-http SIZE    HTTP fragment size (1-65535)\n");
     printf("  -e, --fragment-https SIZE   HTTPS fragment size (1-65535)\n");
     printf("  --native-frag               Use native fragmentation\n");
     printf("  --reverse-frag              Use reverse fragmentation\n");
+    printf("  --frag-http-persistent      Handle every request of keep-alive HTTP connections\n");
+    printf("  --frag-http-persistent-nowait\n");
+    printf("                              Split keep-alive requests right away instead of\n");
+    printf("                              making the client split them via the window size\n");
     printf("\nHeader manipulation:\n");
     printf("  --host-mixedcase          Mix case in Host header\n");
-    printf("  --additional-space         Add additional space\n");
+    printf("  --additional-space         Add space after the method (uses the space after Host:)\n");
     printf("  --host-removespace        Remove space after Host:\n");
+    printf("  --host-reorder            Move the Host header to the end of the headers\n");
+    printf("\nHost lists:\n");
+    printf("  --blacklist FILE          Only circumvent for hosts (and subdomains) in FILE\n");
+    printf("  --whitelist FILE          Never circumvent for hosts (and subdomains) in FILE\n");
+    printf("  --allow-no-sni            With --blacklist, also handle TLS without SNI\n");
+    printf("  --profiles FILE           Per-domain strategy profiles\n");
+    printf("  --connmark-passthrough    Stop queueing a connection once it is handled\n");
+    printf("  --reassembly-buffers N    Requests split across segments reassembled at once\n");
+    printf("                            (default: %u, 0 disables)\n", DEFAULT_REASSEMBLY_BUFFERS);
+    printf("  --block-quic              Block QUIC (HTTP/3) so browsers fall back to TCP;\n");
+    printf("                            with host lists, only for the selected hosts\n");
     printf("\nDNS options:\n");
     printf("  --dns-redirect-v4 ADDR    Redirect IPv4 DNS to ADDR\n");
     printf("  --dns-redirect-v6 ADDR    Redirect IPv6 DNS to ADDR\n");
     printf("  --dns-port PORT           DNS port (default: 53)\n");
+    printf("  --dns-userspace           Rewrite DNS in userspace instead of kernel DNAT\n");
+    printf("  --dns-cache               Answer repeated DNS queries from a local cache\n");
+    printf("  --dns-cache-size KB       DNS cache memory limit (default: %u)\n", DEFAULT_DNS_CACHE_SIZE);
     printf("\nLegacy modes:\n");
     printf("  -1                     Legacy mode 1 (compatible)\n");
     printf("  -2                     Legacy mode 2 (HTTPS optimization)\n");
@@ -245,6 +215,27 @@ static int parse_arguments(int argc, char *argv[], goodbyedpi_config_t *cfg)
         {"dns-redirect-v6",  required_argument, 0, 1010},
         {"dns-port",         required_argument, 0, 1011},
         {"queue-num",        required_argument, 0, 1012},
+        {"dns-userspace",    no_argument,       0, 1013},
+        {"dns-cache",        no_argument,       0, 1014},
+        {"dns-cache-size",   required_argument, 0, 1015},
+        {"blacklist",        required_argument, 0, 1016},
+        {"whitelist",        required_argument, 0, 1017},
+        {"allow-no-sni",     no_argument,       0, 1018},
+        {"profiles",         required_argument, 0, 1019},
+        {"connmark-passthrough", no_argument,   0, 1020},
+        {"reassembly-buffers", required_argument, 0, 1021},
+        {"block-quic",       no_argument,       0, 1022},
+        {"host-reorder",     no_argument,       0, 1023},
+        {"frag-http-persistent", no_argument,   0, 1024},
+        {"frag-http-persistent-nowait", no_argument, 0, 1025},
+        {"interface",        required_argument, 0, 1026},
+        {"inject-backend",   required_argument, 0, 1027},
+        {"inject-mark",      required_argument, 0, 1028},
+        {"inject-rate",      required_argument, 0, 1029},
+        {"inject-flow-rate", required_argument, 0, 1030},
+        {"http-ports",       required_argument, 0, 1031},
+        {"tls-ports",        required_argument, 0, 1032},
+        {"tls-any-port",     no_argument,       0, 1033},
         {0, 0, 0, 0}
     };
     
@@ -413,6 +404,146 @@ static int parse_arguments(int argc, char *argv[], goodbyedpi_config_t *cfg)
                 break;
             }
                 
+            case 1013:
+                cfg->dns_redirect_offload = false;
+                break;
+                
+            case 1014:
+                cfg->dns_cache = true;
+                break;
+                
+            case 1015: {
+                char *endptr;
+                errno = 0;
+                long val = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || errno != 0 || val < 16 || val > 1048576) {
+                    fprintf(stderr, "Error: Invalid DNS cache size '%s' (must be 16-1048576 KB)\n", optarg);
+                    return -1;
+                }
+                cfg->dns_cache = true;
+                cfg->dns_cache_size = (unsigned int)val;
+                break;
+            }
+            
+            case 1016:
+                if (strlen(optarg) >= sizeof(cfg->blacklist_file)) {
+                    fprintf(stderr, "Error: Blacklist path too long\n");
+                    return -1;
+                }
+                cfg->enable_blacklist = true;
+                safe_string_copy(cfg->blacklist_file, optarg, sizeof(cfg->blacklist_file));
+                break;
+                
+            case 1017:
+                if (strlen(optarg) >= sizeof(cfg->whitelist_file)) {
+                    fprintf(stderr, "Error: Whitelist path too long\n");
+                    return -1;
+                }
+                cfg->enable_whitelist = true;
+                safe_string_copy(cfg->whitelist_file, optarg, sizeof(cfg->whitelist_file));
+                break;
+                
+            case 1018:
+                cfg->allow_no_sni = true;
+                break;
+                
+            case 1019:
+                if (strlen(optarg) >= sizeof(cfg->profiles_file)) {
+                    fprintf(stderr, "Error: Profile file path too long\n");
+                    return -1;
+                }
+                safe_string_copy(cfg->profiles_file, optarg, sizeof(cfg->profiles_file));
+                break;
+                
+            case 1020:
+                cfg->connmark_passthrough = true;
+                break;
+                
+            case 1021: {
+                char *endptr;
+                errno = 0;
+                long val = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || errno != 0 || val < 0 || val > 65536) {
+                    fprintf(stderr, "Error: Invalid reassembly buffer count '%s' (must be 0-65536)\n", optarg);
+                    return -1;
+                }
+                cfg->reassembly_buffers = (unsigned int)val;
+                break;
+            }
+            
+            case 1022:
+                cfg->block_quic = true;
+                break;
+                
+            case 1023:
+                cfg->host_reorder = true;
+                break;
+                
+            case 1024:
+                cfg->fragment_http_persistent = true;
+                break;
+                
+            case 1025:
+                cfg->fragment_http_persistent = true;
+                cfg->fragment_http_persistent_nowait = true;
+                break;
+                
+            case 1026:
+                if (strlen(optarg) >= sizeof(cfg->interface)) {
+                    fprintf(stderr, "Error: Interface name too long\n");
+                    return -1;
+                }
+                safe_string_copy(cfg->interface, optarg, sizeof(cfg->interface));
+                break;
+                
+            case 1027:
+                if (config_parse_inject_backend(optarg, &cfg->inject_backend) < 0) {
+                    fprintf(stderr, "Error: Invalid injection backend '%s' (raw or ring)\n", optarg);
+                    return -1;
+                }
+                break;
+                
+            case 1028: {
+                char *endptr;
+                errno = 0;
+                unsigned long val = strtoul(optarg, &endptr, 0);
+                if (*endptr != '\0' || errno != 0 || val > UINT32_MAX) {
+                    fprintf(stderr, "Error: Invalid packet mark '%s'\n", optarg);
+                    return -1;
+                }
+                cfg->inject_mark = (uint32_t)val;
+                break;
+            }
+            
+            case 1029:
+            case 1030: {
+                char *endptr;
+                errno = 0;
+                long val = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || errno != 0 || val < 0 || val > 1000000) {
+                    fprintf(stderr, "Error: Invalid injection rate '%s' (must be 0-1000000)\n", optarg);
+                    return -1;
+                }
+                if (c == 1029) {
+                    cfg->inject_rate = (unsigned int)val;
+                } else {
+                    cfg->inject_flow_rate = (unsigned int)val;
+                }
+                break;
+            }
+            
+            case 1031:
+            case 1032:
+                if (config_parse_ports(optarg, c == 1031 ? &cfg->http_ports : &cfg->tls_ports) < 0) {
+                    fprintf(stderr, "Error: Invalid port list '%s' (e.g. 80,8080-8089)\n", optarg);
+                    return -1;
+                }
+                break;
+                
+            case 1033:
+                cfg->tls_any_port = true;
+                break;
+                
             case '?':
                 fprintf(stderr, "Use -h or --help for usage information.\n");
                 return -1;
@@ -575,8 +706,49 @@ int main(int argc, char *argv[])
         }
     }
     
+    // Load host lists
+    if (blackwhitelist_load() < 0) {
+        log_error("Failed to load host lists");
+        remove_pid_file(config.pid_file);
+        return EXIT_FAILURE;
+    }
+    
+    // Load per-domain strategy profiles
+    if (strategy_load() < 0) {
+        log_error("Failed to load strategy profiles");
+        blackwhitelist_cleanup();
+        remove_pid_file(config.pid_file);
+        return EXIT_FAILURE;
+    }
+    
+    // Reload host lists on SIGHUP or when the files change
+    if (qsbr_register_reader() < 0 || blackwhitelist_start_watcher() < 0) {
+        log_warning("Host list reloading unavailable");
+    }
+    
+    // Flow table and payload matchers used by the evasion modules
+    port_class_init();
+    if (conntrack_init() < 0 || reassembly_init(config.reassembly_buffers) < 0 ||
+        turkey_init() < 0 || fake_templates_init() < 0) {
+        log_error("Failed to initialize flow tracking");
+        remove_pid_file(config.pid_file);
+        return EXIT_FAILURE;
+    }
+    
+    // Initialize DNS redirection
+    if (dns_redirect_init() < 0) {
+        log_error("Failed to initialize DNS redirection");
+        remove_pid_file(config.pid_file);
+        return EXIT_FAILURE;
+    }
+    
+    // Raw sockets carry locally synthesized packets (e.g. cached DNS answers)
+    if (setup_raw_socket() < 0) {
+        log_warning("Raw sockets unavailable, packet injection disabled");
+    }
+    
     // Setup firewall rules
-    if (setup_firewall_rules() < 0) {
+    if (firewall_setup() < 0) {
         log_error("Failed to setup firewall rules");
         remove_pid_file(config.pid_file);
         return EXIT_FAILURE;
@@ -585,7 +757,7 @@ int main(int argc, char *argv[])
     // Initialize netfilter queue with configurable queue number
     if (netfilter_init(&nfq_ctx, config.nfqueue_num, packet_process_callback) < 0) {
         log_error("Failed to initialize netfilter queue");
-        cleanup_firewall_rules();
+        firewall_cleanup();
         remove_pid_file(config.pid_file);
         return EXIT_FAILURE;
     }
@@ -612,6 +784,10 @@ int main(int argc, char *argv[])
             pthread_mutex_unlock(&stats_mutex);
             
             log_packet_stats(processed, modified, bytes);
+            dns_cache_log_stats();
+            reassembly_log_stats();
+            evasion_chain_log_stats();
+            inject_limit_log_stats();
         }
     }
     
@@ -624,10 +800,20 @@ int main(int argc, char *argv[])
     log_info("  Packets modified:  %lu", (unsigned long)packets_modified);
     log_info("  Bytes processed:   %lu", (unsigned long)bytes_processed);
     pthread_mutex_unlock(&stats_mutex);
+    dns_cache_log_stats();
+    evasion_chain_log_stats();
+    inject_limit_log_stats();
     
     // Cleanup
     netfilter_cleanup(&nfq_ctx);
-    cleanup_firewall_rules();
+    firewall_cleanup();
+    dns_flush_cache();
+    blackwhitelist_cleanup();
+    turkey_cleanup();
+    conntrack_cleanup();
+    reassembly_cleanup();
+    strategy_cleanup();
+    cleanup_raw_socket();
     remove_pid_file(config.pid_file);
     logging_cleanup();
     
@@ -25,8 +25,8 @@ void signal_handler(int sig)
             running = 0;
             break;
         case SIGHUP:
-            log_info("Received SIGHUP, reloading configuration");
-            // TODO: Reload configuration
+            log_info("Received SIGHUP, reloading host lists");
+            blackwhitelist_request_reload();
             break;
         case SIGUSR1:
             log_info("Received SIGUSR1, toggling debug mode");
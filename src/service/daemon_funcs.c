@@ -27,6 +27,9 @@ void signal_handler(int sig)
             log_info("Received SIGTERM, shutting down gracefully");
             running = 0;
             break;
+        case SIGHUP:
+            blackwhitelist_request_reload();
+            break;
     }
 }
 
@@ -49,6 +52,11 @@ int install_signal_handlers(void)
         return -1;
     }
     
+    if (sigaction(SIGHUP, &sa, NULL) == -1) {
+        log_error("Failed to install SIGHUP handler");
+        return -1;
+    }
+    
     return 0;
 }
 
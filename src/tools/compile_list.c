@@ -0,0 +1,87 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include "../include/domain_set.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+// goodbyedpi-compile-list: turn text host lists into a compiled domain set
+// that the daemon maps read-only instead of parsing at every start.
+
+// Print usage information
+static void print_usage(const char *program_name)
+{
+    printf("Usage: %s -o OUTPUT LIST...\n\n", program_name);
+    printf("Compile one or more host lists (one domain per line) into a binary\n");
+    printf("file usable as --blacklist or --whitelist.\n\n");
+    printf("Options:\n");
+    printf("  -o, --output FILE   Compiled output file\n");
+    printf("  -q, --quiet         Only report errors\n");
+    printf("  -h, --help          Show this help message\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"output", required_argument, 0, 'o'},
+        {"quiet",  no_argument,       0, 'q'},
+        {"help",   no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    
+    const char *output = NULL;
+    bool quiet = false;
+    int c;
+    
+    while ((c = getopt_long(argc, argv, "o:qh", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    
+    if (!output || optind >= argc) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    logging_init(quiet ? LOG_LEVEL_ERR : LOG_LEVEL_INFO, false, NULL);
+    
+    domain_set_t set;
+    if (domain_set_init(&set) < 0) {
+        log_error("Out of memory");
+        return EXIT_FAILURE;
+    }
+    
+    for (int i = optind; i < argc; i++) {
+        int count = domain_set_load_file(&set, argv[i], 0);
+        if (count < 0) {
+            domain_set_free(&set);
+            return EXIT_FAILURE;
+        }
+        log_info("%s: %d domains", argv[i], count);
+    }
+    
+    if (domain_set_save(&set, output) < 0) {
+        domain_set_free(&set);
+        return EXIT_FAILURE;
+    }
+    
+    log_info("Wrote %s: %u domains, %u nodes, %u bytes of labels",
+             output, set.domain_count, set.node_count, set.labels_len);
+    
+    domain_set_free(&set);
+    logging_cleanup();
+    return EXIT_SUCCESS;
+}
@@ -3,19 +3,14 @@
 #include "../include/config.h"
 #include <time.h>
 
-// Connection tracking table (simplified)
-#define MAX_CONNECTIONS 4096
+// Flow table: open addressing over a fixed array. A flow lives in one of
+// CONNTRACK_PROBE slots after its home slot; when all are taken the
+// least recently seen one is reused.
+#define MAX_CONNECTIONS 16384
+#define CONNTRACK_PROBE 8
 
-typedef struct {
-    uint32_t src_addr;
-    uint32_t dst_addr;
-    uint16_t src_port;
-    uint16_t dst_port;
-    uint8_t ttl;
-    uint8_t protocol;
-    time_t last_seen;
-    bool valid;
-} conntrack_entry_t;
+// Seconds without packets before a flow is forgotten
+#define CONNTRACK_TIMEOUT 300
 
 static conntrack_entry_t conntrack_table[MAX_CONNECTIONS];
 static int conntrack_initialized = 0;
@@ -38,59 +33,98 @@ int conntrack_cleanup(void)
     return 0;
 }
 
-// Add connection to tracking table
-int conntrack_add(const packet_t *packet)
+// Fill in a flow key from a packet, oriented client -> server so both
+// directions of a connection map to the same entry
+static void conntrack_make_key(const packet_t *packet, conntrack_entry_t *key)
 {
-    if (!packet || !conntrack_initialized) {
-        return -1;
+    memset(key, 0, sizeof(*key));
+    key->is_ipv6 = packet->is_ipv6;
+    key->protocol = packet_is_tcp(packet) ? IPPROTO_TCP : IPPROTO_UDP;
+    
+    if (packet->is_outbound) {
+        memcpy(key->client_ip, packet->src_ip, sizeof(key->client_ip));
+        memcpy(key->server_ip, packet->dst_ip, sizeof(key->server_ip));
+        key->client_port = packet->src_port;
+        key->server_port = packet->dst_port;
+    } else {
+        memcpy(key->client_ip, packet->dst_ip, sizeof(key->client_ip));
+        memcpy(key->server_ip, packet->src_ip, sizeof(key->server_ip));
+        key->client_port = packet->dst_port;
+        key->server_port = packet->src_port;
     }
-    
-    uint32_t hash = (packet->src_ip[0] + packet->dst_ip[0] + 
-                     packet->src_port + packet->dst_port) % MAX_CONNECTIONS;
-    
-    conntrack_entry_t *entry = &conntrack_table[hash];
-    
-    // Initialize entry
-    memset(entry, 0, sizeof(conntrack_entry_t));
-    entry->valid = true;
-    entry->src_addr = packet->src_ip[0];
-    entry->dst_addr = packet->dst_ip[0];
-    entry->src_port = packet->src_port;
-    entry->dst_port = packet->dst_port;
-    entry->ttl = packet->ttl;
-    entry->protocol = packet_is_tcp(packet) ? IPPROTO_TCP : IPPROTO_UDP;
-    entry->last_seen = time(NULL);
-    
-    log_debug("Added connection tracking entry");
-    return 0;
 }
 
-// Find connection entry
-static conntrack_entry_t *find_conntrack_entry(const packet_t *packet)
+// Compare the tuple of two entries
+static bool conntrack_key_equal(const conntrack_entry_t *a, const conntrack_entry_t *b)
+{
+    return a->client_port == b->client_port &&
+           a->server_port == b->server_port &&
+           a->protocol == b->protocol &&
+           a->is_ipv6 == b->is_ipv6 &&
+           memcmp(a->client_ip, b->client_ip, sizeof(a->client_ip)) == 0 &&
+           memcmp(a->server_ip, b->server_ip, sizeof(a->server_ip)) == 0;
+}
+
+// Find the flow a packet belongs to. With create set, a missing flow is
+// added (evicting an expired or the oldest entry in its probe window).
+// Returns NULL if the flow is unknown and not created.
+conntrack_entry_t *conntrack_get(const packet_t *packet, bool create)
 {
     if (!packet || !conntrack_initialized) {
         return NULL;
     }
     
-    uint32_t hash = (packet->src_ip[0] + packet->dst_ip[0] + 
-                     packet->src_port + packet->dst_port) % MAX_CONNECTIONS;
+    conntrack_entry_t key;
+    conntrack_make_key(packet, &key);
+    
+    unsigned int home = hash_connection_ipv6(key.client_ip, key.server_ip,
+                                             key.client_port, key.server_port,
+                                             key.protocol) % MAX_CONNECTIONS;
+    time_t now = time(NULL);
+    conntrack_entry_t *victim = NULL;
     
-    conntrack_entry_t *entry = &conntrack_table[hash];
+    for (unsigned int i = 0; i < CONNTRACK_PROBE; i++) {
+        conntrack_entry_t *entry = &conntrack_table[(home + i) % MAX_CONNECTIONS];
+        
+        if (entry->valid && conntrack_key_equal(entry, &key)) {
+            entry->last_seen = now;
+            return entry;
+        }
+        
+        // Prefer a free slot, then an expired one, then the oldest
+        if (!entry->valid || now - entry->last_seen > CONNTRACK_TIMEOUT) {
+            if (!victim || victim->valid) {
+                victim = entry;
+            }
+        } else if (!victim || (victim->valid && entry->last_seen < victim->last_seen)) {
+            victim = entry;
+        }
+    }
     
-    if (!entry->valid) {
+    if (!create) {
         return NULL;
     }
     
-    // Check if this is same connection
-    if (entry->src_addr == packet->src_ip[0] &&
-        entry->dst_addr == packet->dst_ip[0] &&
-        entry->src_port == packet->src_port &&
-        entry->dst_port == packet->dst_port) {
-        
-        return entry;
+    reassembly_release(victim);
+    *victim = key;
+    victim->valid = true;
+    victim->ttl = packet->ttl;
+    victim->last_seen = now;
+    victim->service_match = CONNTRACK_MATCH_UNKNOWN;
+    return victim;
+}
+
+// Add connection to tracking table
+int conntrack_add(const packet_t *packet)
+{
+    conntrack_entry_t *entry = conntrack_get(packet, true);
+    if (!entry) {
+        return -1;
     }
     
-    return NULL;
+    entry->ttl = packet->ttl;
+    log_debug("Added connection tracking entry");
+    return 0;
 }
 
 // Lookup connection entry
@@ -100,21 +134,18 @@ int conntrack_lookup(const packet_t *packet, conntrack_info_t *info)
         return -1;
     }
     
-    conntrack_entry_t *entry = find_conntrack_entry(packet);
+    conntrack_entry_t *entry = conntrack_get(packet, false);
     
     if (!entry) {
         return -1;
     }
     
-    // Update last seen time
-    entry->last_seen = time(NULL);
-    
     // Copy tracking information
     info->valid = true;
-    info->src_addr[0] = entry->src_addr;
-    info->dst_addr[0] = entry->dst_addr;
-    info->src_port = entry->src_port;
-    info->dst_port = entry->dst_port;
+    memcpy(info->src_addr, entry->client_ip, sizeof(info->src_addr));
+    memcpy(info->dst_addr, entry->server_ip, sizeof(info->dst_addr));
+    info->src_port = entry->client_port;
+    info->dst_port = entry->server_port;
     info->ttl = entry->ttl;
     info->protocol = entry->protocol;
     info->last_seen = entry->last_seen;
@@ -136,8 +167,9 @@ int conntrack_cleanup_old(void)
     for (int i = 0; i < MAX_CONNECTIONS; i++) {
         conntrack_entry_t *entry = &conntrack_table[i];
         
-        if (entry->valid && (now - entry->last_seen > 300)) {
+        if (entry->valid && (now - entry->last_seen > CONNTRACK_TIMEOUT)) {
             // Remove old entry
+            reassembly_release(entry);
             memset(entry, 0, sizeof(conntrack_entry_t));
             removed++;
         }
@@ -148,4 +180,4 @@ int conntrack_cleanup_old(void)
     }
     
     return removed;
-}
\ No newline at end of file
+}
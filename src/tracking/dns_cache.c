@@ -0,0 +1,472 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include <string.h>
+#include <time.h>
+
+// DNS answer cache: responses from the redirect server keyed by
+// (qname, qtype, qclass), stored in an open-addressing table bounded by
+// a byte budget. Hits are answered locally without a network round-trip.
+
+#define DNS_HEADER_LEN 12
+#define DNS_MAX_NAME_LEN 255
+#define DNS_MAX_MESSAGE_LEN 4096
+#define DNS_TYPE_OPT 41
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_TC 0x0200
+#define DNS_FLAG_RD 0x0100
+#define DNS_OPCODE_MASK 0x7800
+#define DNS_RCODE_MASK 0x000F
+
+// Longest time an answer is kept, whatever its TTL says (seconds)
+#define DNS_CACHE_MAX_TTL 86400
+
+// Slots examined for a key before giving up / evicting
+#define DNS_CACHE_PROBE_WINDOW 8
+
+// Maximum TTL fields tracked per response
+#define DNS_CACHE_MAX_RECORDS 64
+
+// Cached answer. The heap block holds the lowercased qname, the response
+// message and the message offsets of its TTL fields, in that order.
+typedef struct {
+    uint32_t hash;
+    uint16_t qtype;
+    uint16_t qclass;
+    uint16_t qname_len;
+    uint16_t response_len;
+    uint16_t question_end;  // Offset just past the question in the message
+    uint8_t ttl_count;
+    uint8_t referenced;     // Clock bit, set on every hit
+    time_t stored;
+    time_t expires;
+    uint8_t *data;
+} dns_cache_slot_t;
+
+// Parsed question section
+typedef struct {
+    uint8_t qname[DNS_MAX_NAME_LEN];  // Lowercased wire format
+    uint16_t qname_len;
+    uint16_t qtype;
+    uint16_t qclass;
+    uint16_t question_end;
+    uint32_t hash;
+} dns_question_t;
+
+static dns_cache_slot_t *cache_slots = NULL;
+static size_t cache_capacity = 0;   // Power of two
+static size_t cache_bytes = 0;
+static size_t cache_max_bytes = 0;
+static size_t cache_entries = 0;
+static size_t clock_hand = 0;
+static uint64_t cache_hits = 0;
+static uint64_t cache_misses = 0;
+
+// Read a big-endian 16-bit value
+static uint16_t dns_read16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// Read a big-endian 32-bit value
+static uint32_t dns_read32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Write a big-endian 32-bit value
+static void dns_write32(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+// Parse the single question of a message; names in the question are
+// never compressed, so pointers are rejected
+static int dns_parse_question(const uint8_t *msg, size_t len, dns_question_t *q)
+{
+    size_t pos = DNS_HEADER_LEN;
+    uint32_t hash = 2166136261u;  // FNV-1a
+    
+    if (len < DNS_HEADER_LEN || dns_read16(msg + 4) != 1) {
+        return -1;
+    }
+    
+    q->qname_len = 0;
+    for (;;) {
+        if (pos >= len) {
+            return -1;
+        }
+        
+        uint8_t label_len = msg[pos];
+        if (label_len & 0xC0) {
+            return -1;
+        }
+        if (pos + 1 + label_len > len || q->qname_len + 1 + label_len > DNS_MAX_NAME_LEN) {
+            return -1;
+        }
+        
+        for (size_t i = 0; i <= label_len; i++) {
+            uint8_t c = msg[pos + i];
+            if (i > 0 && c >= 'A' && c <= 'Z') {
+                c = (uint8_t)(c + ('a' - 'A'));
+            }
+            q->qname[q->qname_len++] = c;
+            hash = (hash ^ c) * 16777619u;
+        }
+        pos += 1 + label_len;
+        
+        if (label_len == 0) {
+            break;
+        }
+    }
+    
+    if (pos + 4 > len) {
+        return -1;
+    }
+    
+    q->qtype = dns_read16(msg + pos);
+    q->qclass = dns_read16(msg + pos + 2);
+    q->question_end = (uint16_t)(pos + 4);
+    
+    hash = (hash ^ q->qtype) * 16777619u;
+    hash = (hash ^ q->qclass) * 16777619u;
+    q->hash = hash;
+    return 0;
+}
+
+// Skip an encoded name (possibly compressed) in a resource record
+static int dns_skip_name(const uint8_t *msg, size_t len, size_t *pos)
+{
+    while (*pos < len) {
+        uint8_t label_len = msg[*pos];
+        
+        if ((label_len & 0xC0) == 0xC0) {
+            if (*pos + 2 > len) {
+                return -1;
+            }
+            *pos += 2;
+            return 0;
+        }
+        if (label_len & 0xC0) {
+            return -1;
+        }
+        
+        *pos += 1 + label_len;
+        if (label_len == 0) {
+            return 0;
+        }
+    }
+    
+    return -1;
+}
+
+// Check whether a slot holds the question
+static bool dns_slot_matches(const dns_cache_slot_t *slot, const dns_question_t *q)
+{
+    return slot->data &&
+           slot->hash == q->hash &&
+           slot->qtype == q->qtype &&
+           slot->qclass == q->qclass &&
+           slot->qname_len == q->qname_len &&
+           memcmp(slot->data, q->qname, q->qname_len) == 0;
+}
+
+// Heap bytes used by a slot's entry
+static size_t dns_slot_size(size_t qname_len, size_t response_len, size_t ttl_count)
+{
+    return qname_len + response_len + ttl_count * sizeof(uint16_t);
+}
+
+// Release a slot's storage
+static void dns_slot_free(dns_cache_slot_t *slot)
+{
+    if (!slot->data) {
+        return;
+    }
+    
+    cache_bytes -= dns_slot_size(slot->qname_len, slot->response_len, slot->ttl_count);
+    cache_entries--;
+    free(slot->data);
+    memset(slot, 0, sizeof(*slot));
+}
+
+// Free entries until `needed` more bytes fit under the budget. The clock
+// hand gives recently hit entries a second chance and evicts expired
+// ones on sight.
+static void dns_cache_make_room(size_t needed, time_t now)
+{
+    size_t scanned = 0;
+    
+    while (cache_bytes + needed > cache_max_bytes && cache_entries > 0 &&
+           scanned < cache_capacity * 2) {
+        dns_cache_slot_t *slot = &cache_slots[clock_hand];
+        clock_hand = (clock_hand + 1) & (cache_capacity - 1);
+        scanned++;
+        
+        if (!slot->data) {
+            continue;
+        }
+        if (slot->referenced && slot->expires > now) {
+            slot->referenced = 0;
+            continue;
+        }
+        dns_slot_free(slot);
+    }
+}
+
+// Initialize the cache with a memory budget in bytes
+int dns_cache_init(size_t max_bytes)
+{
+    dns_cache_cleanup();
+    
+    // Size the table for small answers; the byte budget is the real cap
+    size_t target = max_bytes / 128;
+    cache_capacity = 64;
+    while (cache_capacity < target && cache_capacity < (1u << 20)) {
+        cache_capacity <<= 1;
+    }
+    
+    cache_slots = calloc(cache_capacity, sizeof(dns_cache_slot_t));
+    if (!cache_slots) {
+        log_error("Failed to allocate DNS cache");
+        cache_capacity = 0;
+        return -1;
+    }
+    
+    cache_max_bytes = max_bytes;
+    cache_hits = 0;
+    cache_misses = 0;
+    
+    log_info("DNS cache initialized: %zu KB, %zu slots", max_bytes / 1024, cache_capacity);
+    return 0;
+}
+
+// Drop every cached answer and free the table
+void dns_cache_cleanup(void)
+{
+    if (!cache_slots) {
+        return;
+    }
+    
+    for (size_t i = 0; i < cache_capacity; i++) {
+        dns_slot_free(&cache_slots[i]);
+    }
+    
+    free(cache_slots);
+    cache_slots = NULL;
+    cache_capacity = 0;
+    cache_bytes = 0;
+    cache_entries = 0;
+    clock_hand = 0;
+}
+
+// Hash the question of a message, as the cache keys it (lowercased
+// name, type and class). Returns -1 if the question cannot be parsed.
+int dns_question_hash(const uint8_t *msg, size_t len, uint32_t *hash)
+{
+    dns_question_t q;
+    
+    if (!msg || dns_parse_question(msg, len, &q) < 0) {
+        return -1;
+    }
+    *hash = q.hash;
+    return 0;
+}
+
+// Store a DNS response to a query whose question hashed to
+// question_hash. Only complete, successful answers to that single
+// question are cached, for the smallest TTL among their records.
+int dns_cache_store(const uint8_t *msg, size_t len, uint32_t question_hash)
+{
+    dns_question_t q;
+    uint16_t ttl_offsets[DNS_CACHE_MAX_RECORDS];
+    uint8_t ttl_count = 0;
+    uint32_t min_ttl = DNS_CACHE_MAX_TTL;
+    
+    if (!cache_slots || !msg || len > DNS_MAX_MESSAGE_LEN || len < DNS_HEADER_LEN) {
+        return -1;
+    }
+    
+    uint16_t flags = dns_read16(msg + 2);
+    uint16_t ancount = dns_read16(msg + 6);
+    size_t records = (size_t)ancount + dns_read16(msg + 8) + dns_read16(msg + 10);
+    
+    if (!(flags & DNS_FLAG_QR) || (flags & (DNS_FLAG_TC | DNS_OPCODE_MASK | DNS_RCODE_MASK)) ||
+        ancount == 0 || records > DNS_CACHE_MAX_RECORDS) {
+        return -1;
+    }
+    
+    if (dns_parse_question(msg, len, &q) < 0 || q.hash != question_hash) {
+        return -1;
+    }
+    
+    // Walk every record to collect TTL positions
+    size_t pos = q.question_end;
+    for (size_t i = 0; i < records; i++) {
+        if (dns_skip_name(msg, len, &pos) < 0 || pos + 10 > len) {
+            return -1;
+        }
+        
+        uint16_t type = dns_read16(msg + pos);
+        uint32_t ttl = dns_read32(msg + pos + 4);
+        uint16_t rdlen = dns_read16(msg + pos + 8);
+        
+        // The OPT pseudo-record's TTL field carries EDNS flags
+        if (type != DNS_TYPE_OPT) {
+            ttl_offsets[ttl_count++] = (uint16_t)(pos + 4);
+            if (ttl < min_ttl) {
+                min_ttl = ttl;
+            }
+        }
+        
+        pos += 10 + (size_t)rdlen;
+        if (pos > len) {
+            return -1;
+        }
+    }
+    
+    if (min_ttl == 0) {
+        return -1;  // Not meant to be cached
+    }
+    
+    time_t now = time(NULL);
+    size_t needed = dns_slot_size(q.qname_len, len, ttl_count);
+    dns_cache_slot_t *slot = NULL;
+    size_t base = q.hash & (cache_capacity - 1);
+    
+    // Reuse the key's slot, else the first free one, else the one closest
+    // to expiry within the probe window
+    for (size_t i = 0; i < DNS_CACHE_PROBE_WINDOW; i++) {
+        dns_cache_slot_t *candidate = &cache_slots[(base + i) & (cache_capacity - 1)];
+        
+        if (dns_slot_matches(candidate, &q)) {
+            slot = candidate;
+            break;
+        }
+        if (!candidate->data) {
+            if (!slot || slot->data) {
+                slot = candidate;
+            }
+        } else if (!slot || (slot->data && candidate->expires < slot->expires)) {
+            slot = candidate;
+        }
+    }
+    
+    dns_slot_free(slot);
+    dns_cache_make_room(needed, now);
+    if (cache_bytes + needed > cache_max_bytes) {
+        return -1;
+    }
+    
+    uint8_t *data = malloc(needed);
+    if (!data) {
+        return -1;
+    }
+    
+    memcpy(data, q.qname, q.qname_len);
+    memcpy(data + q.qname_len, msg, len);
+    memcpy(data + q.qname_len + len, ttl_offsets, ttl_count * sizeof(uint16_t));
+    
+    slot->hash = q.hash;
+    slot->qtype = q.qtype;
+    slot->qclass = q.qclass;
+    slot->qname_len = q.qname_len;
+    slot->response_len = (uint16_t)len;
+    slot->question_end = q.question_end;
+    slot->ttl_count = ttl_count;
+    slot->referenced = 0;
+    slot->stored = now;
+    slot->expires = now + min_ttl;
+    slot->data = data;
+    
+    cache_bytes += needed;
+    cache_entries++;
+    return 0;
+}
+
+// Answer a query from the cache. On a hit, writes a response for the
+// query into `out` and returns its length; returns 0 on a miss.
+int dns_cache_lookup(const uint8_t *query, size_t query_len, uint8_t *out, size_t out_len)
+{
+    dns_question_t q;
+    
+    if (!cache_slots || !query || query_len < DNS_HEADER_LEN) {
+        return 0;
+    }
+    
+    uint16_t flags = dns_read16(query + 2);
+    if ((flags & (DNS_FLAG_QR | DNS_OPCODE_MASK)) || dns_parse_question(query, query_len, &q) < 0) {
+        return 0;
+    }
+    
+    time_t now = time(NULL);
+    size_t base = q.hash & (cache_capacity - 1);
+    
+    for (size_t i = 0; i < DNS_CACHE_PROBE_WINDOW; i++) {
+        dns_cache_slot_t *slot = &cache_slots[(base + i) & (cache_capacity - 1)];
+        
+        if (!dns_slot_matches(slot, &q)) {
+            continue;
+        }
+        
+        if (slot->expires <= now) {
+            dns_slot_free(slot);
+            break;
+        }
+        
+        if (slot->response_len > out_len) {
+            break;
+        }
+        
+        // Cached response with the client's ID, RD bit and question
+        // spelling (0x20 mixed case survives), TTLs aged by time in cache
+        const uint8_t *response = slot->data + slot->qname_len;
+        const uint8_t *ttl_offsets = response + slot->response_len;
+        uint32_t age = (uint32_t)(now - slot->stored);
+        
+        memcpy(out, response, slot->response_len);
+        memcpy(out, query, 2);
+        out[2] = (uint8_t)((out[2] & ~(DNS_FLAG_RD >> 8)) | (query[2] & (DNS_FLAG_RD >> 8)));
+        memcpy(out + DNS_HEADER_LEN, query + DNS_HEADER_LEN, slot->question_end - DNS_HEADER_LEN);
+        
+        for (uint8_t r = 0; r < slot->ttl_count; r++) {
+            uint16_t offset;
+            memcpy(&offset, ttl_offsets + r * sizeof(uint16_t), sizeof(offset));
+            uint8_t *ttl = out + offset;
+            dns_write32(ttl, dns_read32(ttl) - age);
+        }
+        
+        slot->referenced = 1;
+        cache_hits++;
+        return slot->response_len;
+    }
+    
+    cache_misses++;
+    return 0;
+}
+
+// Get DNS cache statistics
+void dns_cache_get_stats(uint64_t *hits, uint64_t *misses, size_t *entries, size_t *bytes)
+{
+    if (hits) *hits = cache_hits;
+    if (misses) *misses = cache_misses;
+    if (entries) *entries = cache_entries;
+    if (bytes) *bytes = cache_bytes;
+}
+
+// Log hit rate and occupancy
+void dns_cache_log_stats(void)
+{
+    uint64_t lookups = cache_hits + cache_misses;
+    
+    if (!cache_slots) {
+        return;
+    }
+    
+    log_info("DNS cache: %lu hits, %lu misses (%.1f%% hit rate), %zu entries, %zu/%zu KB",
+             (unsigned long)cache_hits, (unsigned long)cache_misses,
+             lookups ? 100.0 * (double)cache_hits / (double)lookups : 0.0,
+             cache_entries, cache_bytes / 1024, cache_max_bytes / 1024);
+}
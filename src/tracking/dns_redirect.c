@@ -0,0 +1,266 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include "../include/packet.h"
+#include <string.h>
+#include <time.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+
+// Redirect target for one address family (addresses in network order)
+typedef struct {
+    bool enabled;
+    uint32_t server_ip[4];
+    uint16_t server_port;
+} dns_redirect_target_t;
+
+static dns_redirect_target_t redirect_v4;
+static dns_redirect_target_t redirect_v6;
+static time_t last_expiry_run = 0;
+
+// How often stale query mappings are swept (seconds)
+#define DNS_REDIRECT_EXPIRY_INTERVAL 10
+
+// Largest DNS message we answer from the cache
+#define DNS_REPLY_MAX_PAYLOAD 4096
+
+// Hop limit of locally synthesized replies
+#define DNS_REPLY_TTL 64
+
+// Initialize DNS redirection from the configured servers
+int dns_redirect_init(void)
+{
+    memset(&redirect_v4, 0, sizeof(redirect_v4));
+    memset(&redirect_v6, 0, sizeof(redirect_v6));
+    
+    if (config.dns_redirect_ipv4) {
+        if (inet_pton(AF_INET, config.dns_server_v4, redirect_v4.server_ip) != 1) {
+            log_error("Invalid IPv4 DNS server: %s", config.dns_server_v4);
+            return -1;
+        }
+        redirect_v4.server_port = config.dns_port_v4;
+        redirect_v4.enabled = true;
+    }
+    
+    if (config.dns_redirect_ipv6) {
+        if (inet_pton(AF_INET6, config.dns_server_v6, redirect_v6.server_ip) != 1) {
+            log_error("Invalid IPv6 DNS server: %s", config.dns_server_v6);
+            return -1;
+        }
+        redirect_v6.server_port = config.dns_port_v6;
+        redirect_v6.enabled = true;
+    }
+    
+    dns_tracker_init();
+    last_expiry_run = time(NULL);
+    
+    if (config.dns_cache && (redirect_v4.enabled || redirect_v6.enabled) &&
+        dns_cache_init((size_t)config.dns_cache_size * 1024) < 0) {
+        return -1;
+    }
+    
+    if (redirect_v4.enabled || redirect_v6.enabled) {
+        log_info("DNS redirection initialized");
+    }
+    
+    return 0;
+}
+
+// Rewrite one endpoint (source or destination) of a UDP packet in place,
+// patching the IP and UDP checksums incrementally
+static int dns_rewrite_endpoint(packet_t *packet, bool rewrite_source,
+                                const uint32_t *new_ip, uint16_t new_port)
+{
+    uint8_t *raw = packet->raw_packet;
+    
+    if (!raw || packet->raw_packet_len < packet->l4_offset + sizeof(struct udphdr)) {
+        return -1;
+    }
+    
+    struct udphdr *udp_hdr = (struct udphdr *)(raw + packet->l4_offset);
+    uint32_t *addr_field;
+    uint16_t *port_field = rewrite_source ? &udp_hdr->source : &udp_hdr->dest;
+    uint32_t old_ip[4];
+    uint16_t new_port_n = htons(new_port);
+    
+    if (packet->is_ipv6) {
+        struct ip6_hdr *ip6_hdr = (struct ip6_hdr *)raw;
+        addr_field = rewrite_source ? (uint32_t *)&ip6_hdr->ip6_src : (uint32_t *)&ip6_hdr->ip6_dst;
+        memcpy(old_ip, addr_field, sizeof(old_ip));
+        memcpy(addr_field, new_ip, sizeof(old_ip));
+    } else {
+        struct iphdr *ip_hdr = (struct iphdr *)raw;
+        addr_field = rewrite_source ? &ip_hdr->saddr : &ip_hdr->daddr;
+        old_ip[0] = *addr_field;
+        *addr_field = new_ip[0];
+        ip_hdr->check = checksum_update_32(ip_hdr->check, old_ip[0], new_ip[0]);
+    }
+    
+    // UDP checksum covers the pseudo-header; zero means "none" on IPv4
+    if (udp_hdr->check != 0 || packet->is_ipv6) {
+        uint16_t csum = checksum_update_addr(udp_hdr->check, old_ip, new_ip, packet->is_ipv6);
+        csum = checksum_update_16(csum, *port_field, new_port_n);
+        udp_hdr->check = (csum == 0) ? 0xFFFF : csum;
+    }
+    *port_field = new_port_n;
+    
+    // Keep the parsed view in sync with the raw packet
+    if (rewrite_source) {
+        memcpy(packet->src_ip, new_ip, packet->is_ipv6 ? sizeof(old_ip) : sizeof(uint32_t));
+        packet->src_port = new_port;
+    } else {
+        memcpy(packet->dst_ip, new_ip, packet->is_ipv6 ? sizeof(old_ip) : sizeof(uint32_t));
+        packet->dst_port = new_port;
+    }
+    
+    return 0;
+}
+
+// Answer a query from the cache by injecting a reply that appears to come
+// from the server the client asked. Returns 1 if the query was answered.
+static int dns_answer_from_cache(const packet_t *packet)
+{
+    uint8_t reply[sizeof(struct ip6_hdr) + sizeof(struct udphdr) + DNS_REPLY_MAX_PAYLOAD];
+    size_t ip_len = packet->is_ipv6 ? sizeof(struct ip6_hdr) : sizeof(struct iphdr);
+    size_t udp_len;
+    
+    memset(reply, 0, ip_len + sizeof(struct udphdr));
+    
+    int dns_len = dns_cache_lookup(packet->payload, packet->payload_len,
+                                   reply + ip_len + sizeof(struct udphdr), DNS_REPLY_MAX_PAYLOAD);
+    if (dns_len <= 0) {
+        return 0;
+    }
+    
+    udp_len = sizeof(struct udphdr) + (size_t)dns_len;
+    
+    // Reply travels back along the query's path: endpoints swapped
+    if (packet->is_ipv6) {
+        struct ip6_hdr *ip6_hdr = (struct ip6_hdr *)reply;
+        ip6_hdr->ip6_flow = htonl(6u << 28);
+        ip6_hdr->ip6_plen = htons((uint16_t)udp_len);
+        ip6_hdr->ip6_nxt = IPPROTO_UDP;
+        ip6_hdr->ip6_hlim = DNS_REPLY_TTL;
+        memcpy(&ip6_hdr->ip6_src, packet->dst_ip, sizeof(ip6_hdr->ip6_src));
+        memcpy(&ip6_hdr->ip6_dst, packet->src_ip, sizeof(ip6_hdr->ip6_dst));
+    } else {
+        struct iphdr *ip_hdr = (struct iphdr *)reply;
+        ip_hdr->version = 4;
+        ip_hdr->ihl = 5;
+        ip_hdr->tot_len = htons((uint16_t)(ip_len + udp_len));
+        ip_hdr->ttl = DNS_REPLY_TTL;
+        ip_hdr->protocol = IPPROTO_UDP;
+        ip_hdr->saddr = packet->dst_ip[0];
+        ip_hdr->daddr = packet->src_ip[0];
+        ip_hdr->check = ip_checksum(ip_hdr, ip_len);
+    }
+    
+    struct udphdr *udp_hdr = (struct udphdr *)(reply + ip_len);
+    udp_hdr->source = htons(packet->dst_port);
+    udp_hdr->dest = htons(packet->src_port);
+    udp_hdr->len = htons((uint16_t)udp_len);
+    udp_hdr->check = l4_checksum(reply, ip_len + udp_len, ip_len, packet->is_ipv6, IPPROTO_UDP);
+    if (udp_hdr->check == 0) {
+        udp_hdr->check = 0xFFFF;
+    }
+    
+    if (emit_packet(reply, ip_len + udp_len) < 0) {
+        return 0;
+    }
+    
+    log_debug("Answered DNS query from cache (%d bytes)", dns_len);
+    return 1;
+}
+
+// Check whether the packet comes from the redirect target
+static bool dns_from_target(const packet_t *packet, const dns_redirect_target_t *target)
+{
+    size_t addr_len = packet->is_ipv6 ? sizeof(uint32_t) * 4 : sizeof(uint32_t);
+    
+    return target->enabled &&
+           packet->src_port == target->server_port &&
+           memcmp(packet->src_ip, target->server_ip, addr_len) == 0;
+}
+
+// Redirect DNS queries to the configured server and restore the original
+// server address on the responses. Returns 1 if the packet was rewritten.
+int dns_redirect_process_packet(packet_t *packet)
+{
+    if (!packet || !packet_is_udp(packet)) {
+        return 0;
+    }
+    
+    const dns_redirect_target_t *target = packet->is_ipv6 ? &redirect_v6 : &redirect_v4;
+    if (!target->enabled) {
+        return 0;
+    }
+    
+    time_t now = time(NULL);
+    if (now - last_expiry_run >= DNS_REDIRECT_EXPIRY_INTERVAL) {
+        dns_tracker_cleanup_expired();
+        last_expiry_run = now;
+    }
+    
+    // Query: remember the original server, then point it at the target
+    if (dns_should_redirect(packet)) {
+        size_t addr_len = packet->is_ipv6 ? sizeof(uint32_t) * 4 : sizeof(uint32_t);
+        
+        if (config.dns_cache && dns_answer_from_cache(packet)) {
+            packet->drop = true;
+            return 1;
+        }
+        
+        bool direct = packet->dst_port == target->server_port &&
+                      memcmp(packet->dst_ip, target->server_ip, addr_len) == 0;
+        if (direct && !config.dns_cache) {
+            return 0;  // Already going to the redirect server
+        }
+        
+        // Tracked even when going to the server already: the cache only
+        // takes answers to queries it has seen
+        if (dns_tracker_add(packet) < 0 || direct) {
+            return 0;
+        }
+        
+        if (dns_rewrite_endpoint(packet, false, target->server_ip, target->server_port) < 0) {
+            return 0;
+        }
+        
+        log_debug("Redirected DNS query to %s:%u",
+                  packet->is_ipv6 ? config.dns_server_v6 : config.dns_server_v4,
+                  target->server_port);
+        return 1;
+    }
+    
+    // Response: map back to the server the client actually asked
+    if (!packet->is_outbound && dns_from_target(packet, target)) {
+        dns_conntrack_info_t info;
+        
+        if (dns_tracker_lookup(packet, &info) < 0 || info.is_ipv6 != packet->is_ipv6) {
+            return 0;  // Not one of ours
+        }
+        
+        // Matched by client port and txid; cached only if it answers the
+        // question that was asked
+        if (config.dns_cache) {
+            dns_cache_store(packet->payload, packet->payload_len, info.question_hash);
+        }
+        
+        if (dns_rewrite_endpoint(packet, true, info.dns_server_ip, info.dns_server_port) < 0) {
+            return 0;
+        }
+        
+        log_debug("Restored DNS response source for txid=%04x", ntohs(info.txid));
+        return 1;
+    }
+    
+    return 0;
+}
+
+// Drop all redirect state
+int dns_flush_cache(void)
+{
+    dns_tracker_cleanup();
+    dns_cache_cleanup();
+    log_info("DNS redirect state flushed");
+    return 0;
+}
@@ -4,9 +4,19 @@
 #include <time.h>
 #include "../utils/uthash.h"
 
+// Binary lookup key: a query is identified by the client end of the
+// 5-tuple plus its transaction ID, which is all a response carries back
+typedef struct {
+    uint32_t client_ip[4];
+    uint16_t client_port;
+    uint16_t txid;
+    uint8_t is_ipv6;
+    uint8_t pad[3];
+} dns_conntrack_key_t;
+
 // DNS connection tracking structure
 typedef struct dns_conntrack_entry {
-    char key[128]; // Composite key
+    dns_conntrack_key_t key;
     dns_conntrack_info_t info;
     time_t last_seen;
     UT_hash_handle hh; // uthash handle
@@ -21,6 +31,12 @@ static dns_conntrack_entry_t *dns_table = NULL;
 // DNS entry timeout (seconds)
 #define DNS_TRACKING_TIMEOUT 60
 
+// Upper bound on outstanding queries
+#define DNS_TRACKING_MAX_ENTRIES 8192
+
+// Minimum DNS message size (header only)
+#define DNS_HEADER_LEN 12
+
 // Initialize DNS tracking
 int dns_tracker_init(void)
 {
@@ -44,86 +60,87 @@ int dns_tracker_cleanup(void)
     return 0;
 }
 
-// Add DNS connection to tracking table
+// Check that a packet carries at least a DNS header over UDP
+static bool dns_packet_valid(const packet_t *packet)
+{
+    return packet &&
+           (packet->type == PACKET_IPV4_UDP_DATA || packet->type == PACKET_IPV6_UDP_DATA) &&
+           packet->payload && packet->payload_len >= DNS_HEADER_LEN;
+}
+
+// Build the lookup key for the client side of a DNS exchange
+static void dns_make_key(dns_conntrack_key_t *key, const packet_t *packet,
+                         const uint32_t *client_ip, uint16_t client_port)
+{
+    memset(key, 0, sizeof(*key));
+    memcpy(key->client_ip, client_ip, packet->is_ipv6 ? sizeof(uint32_t) * 4 : sizeof(uint32_t));
+    key->client_port = client_port;
+    memcpy(&key->txid, packet->payload, sizeof(key->txid));
+    key->is_ipv6 = packet->is_ipv6;
+}
+
+// Add an outgoing DNS query to the tracking table
 int dns_tracker_add(const packet_t *packet)
 {
-    if (!packet || packet->type != PACKET_IPV4_UDP_DATA || 
-        (packet->src_port != 53 && packet->dst_port != 53)) {
+    if (!dns_packet_valid(packet)) {
         return -1; // Not a DNS packet
     }
     
-    dns_conntrack_entry_t *entry = malloc(sizeof(dns_conntrack_entry_t));
+    dns_conntrack_key_t key;
+    dns_make_key(&key, packet, packet->src_ip, packet->src_port);
+    
+    dns_conntrack_entry_t *entry = NULL;
+    HASH_FIND(hh, dns_table, &key, sizeof(key), entry);
+    
     if (!entry) {
-        log_error("Failed to allocate DNS tracking entry");
-        return -1;
+        if (HASH_COUNT(dns_table) >= DNS_TRACKING_MAX_ENTRIES &&
+            dns_tracker_cleanup_expired() == 0) {
+            log_warning("DNS tracking table full");
+            return -1;
+        }
+        
+        entry = malloc(sizeof(dns_conntrack_entry_t));
+        if (!entry) {
+            log_error("Failed to allocate DNS tracking entry");
+            return -1;
+        }
+        
+        memset(entry, 0, sizeof(dns_conntrack_entry_t));
+        entry->key = key;
+        HASH_ADD(hh, dns_table, key, sizeof(dns_conntrack_key_t), entry);
     }
     
-    // Initialize entry
-    memset(entry, 0, sizeof(dns_conntrack_entry_t));
-    
-    // Fill tracking information
+    // Fill tracking information (retransmits simply refresh it)
     entry->info.valid = true;
+    entry->info.is_ipv6 = packet->is_ipv6;
     entry->info.timestamp = time(NULL);
-    
-    // Determine direction and set IPs/ports
-    if (packet->src_port == 53) { // Response from DNS server
-        memcpy(entry->info.dns_server_ip, packet->src_ip, sizeof(uint32_t) * 4);
-        memcpy(entry->info.client_ip, packet->dst_ip, sizeof(uint32_t) * 4);
-        entry->info.dns_server_port = packet->src_port;
-        entry->info.client_port = packet->dst_port;
-    } else { // Query to DNS server
-        memcpy(entry->info.client_ip, packet->src_ip, sizeof(uint32_t) * 4);
-        memcpy(entry->info.dns_server_ip, packet->dst_ip, sizeof(uint32_t) * 4);
-        entry->info.client_port = packet->src_port;
-        entry->info.dns_server_port = packet->dst_port;
+    memcpy(entry->info.client_ip, packet->src_ip, sizeof(uint32_t) * 4);
+    memcpy(entry->info.dns_server_ip, packet->dst_ip, sizeof(uint32_t) * 4);
+    entry->info.client_port = packet->src_port;
+    entry->info.dns_server_port = packet->dst_port;
+    entry->info.txid = key.txid;
+    if (dns_question_hash(packet->payload, packet->payload_len, &entry->info.question_hash) < 0) {
+        entry->info.question_hash = 0;
     }
-    
     entry->last_seen = entry->info.timestamp;
     
-    // Create composite key
-    snprintf(entry->key, sizeof(entry->key), 
-             "%08x:%08x:%04x:%04x", 
-             packet->src_ip[0], packet->dst_ip[0],
-             packet->src_port, packet->dst_port);
-    
-    // Add to hash table
-    HASH_ADD_STR(dns_table, key, entry);
-    
-    log_debug("Added DNS tracking entry: %s", entry->key);
+    log_debug("Added DNS tracking entry: txid=%04x port=%u",
+              ntohs(key.txid), packet->src_port);
     return 0;
 }
 
-// Lookup DNS connection in tracking table
+// Lookup the query matching an incoming DNS response
 int dns_tracker_lookup(const packet_t *packet, dns_conntrack_info_t *info)
 {
-    if (!packet || !info) {
-        return -1;
-    }
-    
-    if (packet->type != PACKET_IPV4_UDP_DATA || 
-        (packet->src_port != 53 && packet->dst_port != 53)) {
+    if (!info || !dns_packet_valid(packet)) {
         return -1; // Not a DNS packet
     }
     
-    // Create lookup key
-    char key[128];
-    snprintf(key, sizeof(key), 
-             "%08x:%08x:%04x:%04x", 
-             packet->src_ip[0], packet->dst_ip[0],
-             packet->src_port, packet->dst_port);
+    dns_conntrack_key_t key;
+    dns_make_key(&key, packet, packet->dst_ip, packet->dst_port);
     
-    // Try forward direction
     dns_conntrack_entry_t *entry = NULL;
-    HASH_FIND_STR(dns_table, key, entry);
-    
-    if (!entry) {
-        // Try reverse direction
-        snprintf(key, sizeof(key), 
-                 "%08x:%08x:%04x:%04x", 
-                 packet->dst_ip[0], packet->src_ip[0],
-                 packet->dst_port, packet->src_port);
-        HASH_FIND_STR(dns_table, key, entry);
-    }
+    HASH_FIND(hh, dns_table, &key, sizeof(key), entry);
     
     if (entry) {
         // Update last seen time
@@ -132,7 +149,8 @@ int dns_tracker_lookup(const packet_t *packet, dns_conntrack_info_t *info)
         // Copy tracking information
         memcpy(info, &entry->info, sizeof(dns_conntrack_info_t));
         
-        log_debug("Found DNS tracking entry: %s", entry->key);
+        log_debug("Found DNS tracking entry: txid=%04x port=%u",
+                  ntohs(key.txid), packet->dst_port);
         return 0;
     }
     
@@ -160,7 +178,6 @@ int dns_tracker_cleanup_expired(void)
     
     HASH_ITER(hh, dns_table, current, tmp) {
         if (now - current->last_seen > DNS_TRACKING_TIMEOUT) {
-            log_debug("Removing expired DNS entry: %s", current->key);
             HASH_DEL(dns_table, current);
             free(current);
             removed++;
@@ -198,22 +215,20 @@ void dns_tracker_get_stats(size_t *total_entries, size_t *active_entries)
 // Check if DNS traffic should be redirected
 int dns_should_redirect(const packet_t *packet)
 {
-    if (!packet) {
+    if (!dns_packet_valid(packet)) {
         return 0;
     }
     
-    // Only redirect DNS queries (port 53)
-    if (packet->type != PACKET_IPV4_UDP_DATA || packet->dst_port != 53) {
+    // Only redirect outgoing DNS queries (port 53)
+    if (!packet->is_outbound || packet->dst_port != 53) {
         return 0;
     }
     
-    // Check if DNS redirection is enabled
-    if (!config.dns_redirect_ipv4) {
+    // Check if DNS redirection is enabled for this address family
+    if (packet->is_ipv6 ? !config.dns_redirect_ipv6 : !config.dns_redirect_ipv4) {
         return 0;
     }
     
-    // Could add additional checks here (e.g., specific DNS servers)
-    
     return 1;
 }
 
@@ -235,4 +250,4 @@ int dns_get_configured_server(uint32_t *server_ip, uint16_t *server_port)
     
     *server_port = config.dns_port_v4;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,94 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include "../include/config.h"
+#include <time.h>
+
+// Budget for packets we inject (fakes, fragments), so evasion can never
+// multiply the upstream packet rate beyond a fixed bound.
+//
+// Each bucket is a GCRA cell: a single 64-bit "theoretical arrival time"
+// in nanoseconds. Taking n packets moves it n intervals into the future,
+// starting from now if it lies in the past; the take is refused if that
+// would put it more than one second's worth of packets (the burst) ahead.
+// There is one global bucket, and a flow's bucket lives in its conntrack
+// entry. Both are only used from the packet loop in main(), which also
+// logs the statistics, so no locking is needed.
+
+#define NSEC_PER_SEC 1000000000ULL
+
+// Statistics
+static uint64_t inject_allowed = 0;
+static uint64_t throttled_global = 0;
+static uint64_t throttled_flow = 0;
+
+static uint64_t global_tat = 0;
+
+// Monotonic time in nanoseconds
+static uint64_t inject_limit_now(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+// Take count packets from a bucket allowing rate packets per second
+static bool inject_limit_take(uint64_t *tat, uint64_t now, unsigned int rate, unsigned int count)
+{
+    uint64_t interval = NSEC_PER_SEC / rate;
+    uint64_t burst = interval * rate;
+    uint64_t next = (*tat > now ? *tat : now) + interval * count;
+    
+    if (next - now > burst) {
+        return false;
+    }
+    *tat = next;
+    return true;
+}
+
+// Check whether count more packets may be injected for a flow (NULL: no
+// flow) and charge them if so. Refused injections are counted.
+bool inject_limit_allow(conntrack_entry_t *flow, unsigned int count)
+{
+    unsigned int flow_rate = config.inject_flow_rate;
+    unsigned int global_rate = config.inject_rate;
+    
+    if (count == 0 || (flow_rate == 0 && global_rate == 0)) {
+        return true;
+    }
+    
+    uint64_t now = inject_limit_now();
+    bool flow_charged = false;
+    
+    if (flow && flow_rate > 0) {
+        if (!inject_limit_take(&flow->inject_tat, now, flow_rate, count)) {
+            throttled_flow += count;
+            return false;
+        }
+        flow_charged = true;
+    }
+    
+    if (global_rate > 0 && !inject_limit_take(&global_tat, now, global_rate, count)) {
+        // Give the flow back what it was charged
+        if (flow_charged) {
+            flow->inject_tat -= (uint64_t)(NSEC_PER_SEC / flow_rate) * count;
+        }
+        throttled_global += count;
+        return false;
+    }
+    
+    inject_allowed += count;
+    return true;
+}
+
+// Log injection budget statistics
+void inject_limit_log_stats(void)
+{
+    if (config.inject_rate == 0 && config.inject_flow_rate == 0) {
+        return;
+    }
+    
+    log_info("Injection: %lu packets, %lu throttled (global), %lu throttled (per flow)",
+             (unsigned long)inject_allowed, (unsigned long)throttled_global,
+             (unsigned long)throttled_flow);
+}
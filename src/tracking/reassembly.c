@@ -0,0 +1,261 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include "../include/config.h"
+#include "../include/packet.h"
+#include <time.h>
+
+// Reassembly of a flow's first flight (TLS ClientHello or HTTP request
+// headers) when it spans several segments.
+//
+// Buffers come from a fixed pool allocated at startup, so the memory used
+// is bounded by reassembly_buffers * REASM_BUFFER_SIZE whatever the
+// traffic. A buffer is reclaimed when its flow is decided, when it is
+// older than REASM_TIMEOUT, or, with the pool exhausted, by evicting the
+// oldest buffer in use.
+//
+// Only in-order data is accepted. We see the sender's own segments on
+// OUTPUT, in the order it sends them; retransmissions of bytes already
+// held are ignored and anything else gives up on the flow. QUIC CRYPTO
+// data is added by stream offset instead of TCP sequence number.
+
+struct reasm_buffer {
+    conntrack_entry_t *owner;   // Flow using the buffer, NULL when free
+    reasm_buffer_t *next_free;
+    time_t created;
+    uint32_t base_seq;          // Sequence number of data[0]
+    uint32_t len;
+    uint32_t max_segment;       // Largest segment added
+    uint8_t data[REASM_BUFFER_SIZE];
+};
+
+static reasm_buffer_t *pool = NULL;
+static size_t pool_size = 0;
+static reasm_buffer_t *free_list = NULL;
+
+// Statistics
+static uint64_t reasm_evictions = 0;
+static uint64_t reasm_failures = 0;
+
+// Initialize the buffer pool
+int reassembly_init(size_t max_buffers)
+{
+    if (max_buffers == 0) {
+        return 0;
+    }
+    
+    pool = calloc(max_buffers, sizeof(reasm_buffer_t));
+    if (!pool) {
+        log_error("Failed to allocate %zu reassembly buffers", max_buffers);
+        return -1;
+    }
+    
+    pool_size = max_buffers;
+    free_list = NULL;
+    for (size_t i = pool_size; i > 0; i--) {
+        pool[i - 1].next_free = free_list;
+        free_list = &pool[i - 1];
+    }
+    
+    log_info("Reassembly: %zu buffers of %u bytes", pool_size, (unsigned int)REASM_BUFFER_SIZE);
+    return 0;
+}
+
+// Free the buffer pool; flows must no longer reference buffers
+void reassembly_cleanup(void)
+{
+    free(pool);
+    pool = NULL;
+    pool_size = 0;
+    free_list = NULL;
+}
+
+// Return a flow's buffer to the pool
+void reassembly_release(conntrack_entry_t *flow)
+{
+    reasm_buffer_t *buf = flow ? flow->reasm : NULL;
+    
+    if (!buf) {
+        return;
+    }
+    
+    flow->reasm = NULL;
+    buf->owner = NULL;
+    buf->len = 0;
+    buf->max_segment = 0;
+    buf->next_free = free_list;
+    free_list = buf;
+}
+
+// Take a buffer from the pool, reclaiming an expired one or evicting the
+// oldest when none is free
+static reasm_buffer_t *reassembly_alloc(conntrack_entry_t *flow, time_t now)
+{
+    if (!free_list) {
+        reasm_buffer_t *oldest = NULL;
+        
+        for (size_t i = 0; i < pool_size; i++) {
+            if (!oldest || pool[i].created < oldest->created) {
+                oldest = &pool[i];
+            }
+        }
+        
+        if (!oldest) {
+            return NULL;
+        }
+        if (now - oldest->created <= REASM_TIMEOUT) {
+            reasm_evictions++;
+        }
+        reassembly_release(oldest->owner);
+    }
+    
+    reasm_buffer_t *buf = free_list;
+    free_list = buf->next_free;
+    buf->owner = flow;
+    buf->next_free = NULL;
+    buf->created = now;
+    buf->len = 0;
+    buf->max_segment = 0;
+    flow->reasm = buf;
+    return buf;
+}
+
+// Get the flow's buffer, allocating one if needed. *created is set when
+// the buffer is new. Returns NULL if none is available or it timed out.
+static reasm_buffer_t *reassembly_get(conntrack_entry_t *flow, bool *created)
+{
+    time_t now = time(NULL);
+    reasm_buffer_t *buf = flow->reasm;
+    
+    *created = false;
+    
+    if (buf && now - buf->created > REASM_TIMEOUT) {
+        reassembly_release(flow);
+        reasm_failures++;
+        return NULL;
+    }
+    
+    if (!buf) {
+        buf = reassembly_alloc(flow, now);
+        *created = buf != NULL;
+    }
+    
+    return buf;
+}
+
+// Place segment at offset in the flow's buffer (in order, overlaps allowed)
+static int reassembly_store(conntrack_entry_t *flow, reasm_buffer_t *buf, uint32_t offset,
+                            const uint8_t *segment, size_t seg_len,
+                            const uint8_t **data, size_t *len)
+{
+    if (offset > buf->len) {
+        log_debug("Reassembly gap at %u (have %u)", offset, buf->len);
+        reassembly_release(flow);
+        reasm_failures++;
+        return -1;
+    }
+    
+    if (offset + seg_len > buf->len) {
+        if (offset + seg_len > REASM_BUFFER_SIZE) {
+            log_debug("Reassembly exceeds %u bytes", (unsigned int)REASM_BUFFER_SIZE);
+            reassembly_release(flow);
+            reasm_failures++;
+            return -1;
+        }
+        
+        // Skip the part already held (retransmission overlap)
+        size_t skip = buf->len - offset;
+        memcpy(buf->data + buf->len, segment + skip, seg_len - skip);
+        buf->len = (uint32_t)(offset + seg_len);
+    }
+    
+    if (seg_len > buf->max_segment) {
+        buf->max_segment = (uint32_t)seg_len;
+    }
+    
+    *data = buf->data;
+    *len = buf->len;
+    return 0;
+}
+
+// Add a data packet to its flow's buffer. On success *data and *len give
+// everything gathered so far (starting with the flow's first byte).
+// Returns 0 on success, -1 if the flow cannot be reassembled (no buffer,
+// gap in the data, too large or timed out); its buffer is released then.
+int reassembly_add(conntrack_entry_t *flow, const packet_t *packet,
+                   const uint8_t **data, size_t *len)
+{
+    uint32_t seq;
+    bool created;
+    
+    if (!pool || !flow || !packet->payload || packet->payload_len == 0 ||
+        packet_get_tcp_seq(packet, &seq, NULL) < 0) {
+        return -1;
+    }
+    
+    reasm_buffer_t *buf = reassembly_get(flow, &created);
+    if (!buf) {
+        return -1;
+    }
+    if (created) {
+        buf->base_seq = seq;
+    }
+    
+    // Offset of this segment relative to the first byte (wraps correctly)
+    return reassembly_store(flow, buf, seq - buf->base_seq,
+                            packet->payload, packet->payload_len, data, len);
+}
+
+// Add data at a known stream offset (QUIC CRYPTO frames) to the flow's
+// buffer; the stream starts at offset 0. Same results as reassembly_add.
+int reassembly_add_at(conntrack_entry_t *flow, uint32_t offset, const uint8_t *segment,
+                      size_t segment_len, const uint8_t **data, size_t *len)
+{
+    bool created;
+    
+    if (!pool || !flow || !segment || segment_len == 0) {
+        return -1;
+    }
+    
+    reasm_buffer_t *buf = reassembly_get(flow, &created);
+    if (!buf) {
+        return -1;
+    }
+    if (created) {
+        buf->base_seq = 0;
+    }
+    
+    return reassembly_store(flow, buf, offset, segment, segment_len, data, len);
+}
+
+// Get where a flow's gathered TCP data starts and the largest segment it
+// came in. Returns 0 on success, -1 if the flow holds no data.
+int reassembly_held(const conntrack_entry_t *flow, uint32_t *base_seq, size_t *max_segment)
+{
+    const reasm_buffer_t *buf = flow ? flow->reasm : NULL;
+    
+    if (!buf || buf->len == 0) {
+        return -1;
+    }
+    
+    *base_seq = buf->base_seq;
+    *max_segment = buf->max_segment;
+    return 0;
+}
+
+// Log reassembly statistics
+void reassembly_log_stats(void)
+{
+    if (!pool) {
+        return;
+    }
+    
+    size_t in_use = 0;
+    for (size_t i = 0; i < pool_size; i++) {
+        if (pool[i].owner) {
+            in_use++;
+        }
+    }
+    
+    log_info("Reassembly: %zu/%zu buffers in use, %lu evictions, %lu failures",
+             in_use, pool_size, (unsigned long)reasm_evictions, (unsigned long)reasm_failures);
+}
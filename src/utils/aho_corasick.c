@@ -0,0 +1,138 @@
+#include "../include/aho_corasick.h"
+#include "../include/logging.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Largest automaton we build (state indexes are 16-bit)
+#define AC_MAX_STATES 65535
+
+// ASCII lowercase without locale lookups
+static inline uint8_t ac_lower(uint8_t c)
+{
+    return (c >= 'A' && c <= 'Z') ? (uint8_t)(c + ('a' - 'A')) : c;
+}
+
+// Build the automaton. Returns 0 on success, -1 on error.
+int ac_build(ac_automaton_t *ac, const char *const *patterns, size_t count)
+{
+    size_t max_states = 1;
+    
+    memset(ac, 0, sizeof(*ac));
+    
+    // Alphabet: class 0 for bytes in no pattern, then one class per
+    // distinct (lowercased) pattern byte; uppercase maps like lowercase
+    uint32_t classes = 1;
+    for (size_t p = 0; p < count; p++) {
+        const uint8_t *s = (const uint8_t *)patterns[p];
+        for (; *s; s++) {
+            uint8_t c = ac_lower(*s);
+            if (ac->byte_class[c] == 0) {
+                ac->byte_class[c] = (uint8_t)classes++;
+            }
+            max_states++;
+        }
+    }
+    for (int c = 'A'; c <= 'Z'; c++) {
+        ac->byte_class[c] = ac->byte_class[c + ('a' - 'A')];
+    }
+    
+    if (max_states > AC_MAX_STATES || count > INT16_MAX) {
+        log_error("Too many patterns for matcher");
+        return -1;
+    }
+    
+    ac->num_classes = classes;
+    ac->next = calloc(max_states * classes, sizeof(uint16_t));
+    ac->match = malloc(max_states * sizeof(int16_t));
+    uint16_t *fail = calloc(max_states, sizeof(uint16_t));
+    uint16_t *queue = malloc(max_states * sizeof(uint16_t));
+    if (!ac->next || !ac->match || !fail || !queue) {
+        free(fail);
+        free(queue);
+        ac_free(ac);
+        return -1;
+    }
+    
+    // Trie of the patterns (0 transitions mean "none yet", state 0 is root)
+    ac->num_states = 1;
+    ac->match[0] = -1;
+    for (size_t p = 0; p < count; p++) {
+        uint32_t state = 0;
+        for (const uint8_t *s = (const uint8_t *)patterns[p]; *s; s++) {
+            uint16_t *slot = &ac->next[state * classes + ac->byte_class[*s]];
+            if (*slot == 0) {
+                ac->match[ac->num_states] = -1;
+                *slot = (uint16_t)ac->num_states++;
+            }
+            state = *slot;
+        }
+        if (ac->match[state] < 0) {
+            ac->match[state] = (int16_t)p;
+        }
+    }
+    
+    // Breadth-first: fill failure links and turn missing transitions into
+    // DFA transitions, inheriting matches along failure links
+    size_t head = 0, tail = 0;
+    for (uint32_t c = 0; c < classes; c++) {
+        uint16_t child = ac->next[c];
+        if (child != 0) {
+            fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    
+    while (head < tail) {
+        uint16_t state = queue[head++];
+        
+        if (ac->match[state] < 0) {
+            ac->match[state] = ac->match[fail[state]];
+        }
+        
+        for (uint32_t c = 0; c < classes; c++) {
+            uint16_t *slot = &ac->next[state * classes + c];
+            uint16_t via_fail = ac->next[fail[state] * classes + c];
+            
+            if (*slot != 0) {
+                fail[*slot] = via_fail;
+                queue[tail++] = *slot;
+            } else {
+                *slot = via_fail;
+            }
+        }
+    }
+    
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+// Release the automaton's tables
+void ac_free(ac_automaton_t *ac)
+{
+    free(ac->next);
+    free(ac->match);
+    memset(ac, 0, sizeof(*ac));
+}
+
+// Scan data in place. Returns the index of the first pattern found
+// (earliest end position), or -1 if none occurs.
+int ac_search(const ac_automaton_t *ac, const uint8_t *data, size_t len)
+{
+    const uint16_t *next = ac->next;
+    const uint32_t classes = ac->num_classes;
+    uint32_t state = 0;
+    
+    if (!next) {
+        return -1;
+    }
+    
+    for (size_t i = 0; i < len; i++) {
+        state = next[state * classes + ac->byte_class[data[i]]];
+        if (ac->match[state] >= 0) {
+            return ac->match[state];
+        }
+    }
+    
+    return -1;
+}
@@ -0,0 +1,520 @@
+#include "../include/domain_set.h"
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Initial table sizes (grown by doubling)
+#define DOMAIN_SET_INITIAL_EDGES 1024
+#define DOMAIN_SET_INITIAL_LABELS 4096
+
+// Longest line accepted in a list file
+#define DOMAIN_SET_MAX_LINE 512
+
+// ASCII lowercase without locale lookups
+static inline char domain_lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+// Hash a (parent, label) pair; the label is lowercased on the fly so
+// lookups need not copy the hostname. Never returns 0 (free slot marker).
+static uint32_t domain_edge_hash(uint32_t parent, const char *label, size_t len)
+{
+    uint32_t hash = 2166136261u ^ parent;  // FNV-1a
+    
+    hash *= 16777619u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)domain_lower(label[i])) * 16777619u;
+    }
+    
+    return hash ? hash : 1;
+}
+
+// Compare a stored (lowercase) label against a hostname label
+static bool domain_label_equal(const char *stored, const char *label, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (stored[i] != domain_lower(label[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Find the child of `parent` labelled `label`; returns 0 if absent.
+// Indexes are range-checked so a damaged mapped file cannot fault.
+static uint32_t domain_find_child(const domain_set_t *set, uint32_t parent,
+                                  const char *label, size_t len, uint32_t hash)
+{
+    uint32_t mask = set->edge_capacity - 1;
+    uint32_t i = hash & mask;
+    
+    for (uint32_t probes = 0; probes < set->edge_capacity; probes++, i = (i + 1) & mask) {
+        const domain_edge_t *edge = &set->edges[i];
+        
+        if (edge->hash == 0) {
+            return 0;
+        }
+        if (edge->hash == hash && edge->parent == parent && edge->label_len == len &&
+            edge->label_off <= set->labels_len && len <= set->labels_len - edge->label_off &&
+            domain_label_equal(set->labels + edge->label_off, label, len)) {
+            return edge->child < set->node_count ? edge->child : 0;
+        }
+    }
+    
+    return 0;
+}
+
+// Double the edge table and reinsert every edge
+static int domain_grow_edges(domain_set_t *set)
+{
+    uint32_t new_capacity = set->edge_capacity * 2;
+    domain_edge_t *new_edges = calloc(new_capacity, sizeof(domain_edge_t));
+    
+    if (!new_edges) {
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < set->edge_capacity; i++) {
+        const domain_edge_t *edge = &set->edges[i];
+        if (edge->hash == 0) {
+            continue;
+        }
+        
+        uint32_t j = edge->hash & (new_capacity - 1);
+        while (new_edges[j].hash != 0) {
+            j = (j + 1) & (new_capacity - 1);
+        }
+        new_edges[j] = *edge;
+    }
+    
+    free(set->edges);
+    set->edges = new_edges;
+    set->edge_capacity = new_capacity;
+    return 0;
+}
+
+// Make room for one more node
+static int domain_reserve_node(domain_set_t *set)
+{
+    if (set->node_count < set->node_capacity) {
+        return 0;
+    }
+    
+    uint32_t new_capacity = set->node_capacity * 2;
+    uint32_t *new_values = realloc(set->values, new_capacity * sizeof(uint32_t));
+    if (!new_values) {
+        return -1;
+    }
+    
+    set->values = new_values;
+    set->node_capacity = new_capacity;
+    return 0;
+}
+
+// Append a lowercased label to the pool, returning its offset
+static int domain_store_label(domain_set_t *set, const char *label, size_t len, uint32_t *offset)
+{
+    while (set->labels_len + len > set->labels_capacity) {
+        uint32_t new_capacity = set->labels_capacity * 2;
+        char *new_labels = realloc(set->labels, new_capacity);
+        if (!new_labels) {
+            return -1;
+        }
+        set->labels = new_labels;
+        set->labels_capacity = new_capacity;
+    }
+    
+    for (size_t i = 0; i < len; i++) {
+        set->labels[set->labels_len + i] = domain_lower(label[i]);
+    }
+    
+    *offset = set->labels_len;
+    set->labels_len += (uint32_t)len;
+    return 0;
+}
+
+// Return the child of `parent` labelled `label`, creating it if needed
+static int domain_get_or_add_child(domain_set_t *set, uint32_t parent,
+                                   const char *label, size_t len, uint32_t *child)
+{
+    uint32_t hash = domain_edge_hash(parent, label, len);
+    
+    *child = domain_find_child(set, parent, label, len, hash);
+    if (*child != 0) {
+        return 0;
+    }
+    
+    // Keep the load factor at or below one half
+    if ((set->edge_count + 1) * 2 > set->edge_capacity && domain_grow_edges(set) < 0) {
+        return -1;
+    }
+    
+    uint32_t label_off;
+    if (domain_reserve_node(set) < 0 || domain_store_label(set, label, len, &label_off) < 0) {
+        return -1;
+    }
+    
+    uint32_t i = hash & (set->edge_capacity - 1);
+    while (set->edges[i].hash != 0) {
+        i = (i + 1) & (set->edge_capacity - 1);
+    }
+    
+    *child = set->node_count++;
+    set->values[*child] = DOMAIN_SET_NO_VALUE;
+    
+    set->edges[i].hash = hash;
+    set->edges[i].parent = parent;
+    set->edges[i].child = *child;
+    set->edges[i].label_off = label_off;
+    set->edges[i].label_len = (uint32_t)len;
+    set->edge_count++;
+    return 0;
+}
+
+// Initialize an empty set
+int domain_set_init(domain_set_t *set)
+{
+    memset(set, 0, sizeof(*set));
+    
+    set->edges = calloc(DOMAIN_SET_INITIAL_EDGES, sizeof(domain_edge_t));
+    set->values = malloc(DOMAIN_SET_INITIAL_EDGES * sizeof(uint32_t));
+    set->labels = malloc(DOMAIN_SET_INITIAL_LABELS);
+    if (!set->edges || !set->values || !set->labels) {
+        domain_set_free(set);
+        return -1;
+    }
+    
+    set->edge_capacity = DOMAIN_SET_INITIAL_EDGES;
+    set->node_capacity = DOMAIN_SET_INITIAL_EDGES;
+    set->labels_capacity = DOMAIN_SET_INITIAL_LABELS;
+    
+    // Root node
+    set->values[DOMAIN_SET_ROOT] = DOMAIN_SET_NO_VALUE;
+    set->node_count = 1;
+    return 0;
+}
+
+// Release all memory held by the set
+void domain_set_free(domain_set_t *set)
+{
+    if (set->map_base) {
+        munmap(set->map_base, set->map_len);
+    } else {
+        free(set->edges);
+        free(set->values);
+        free(set->labels);
+    }
+    memset(set, 0, sizeof(*set));
+}
+
+// Add a domain. As in GoodbyeDPI, an entry covers the domain itself and
+// all of its subdomains; a leading "*." or "." is accepted and ignored.
+int domain_set_add(domain_set_t *set, const char *domain, uint32_t value)
+{
+    size_t len = strlen(domain);
+    
+    if (set->map_base || !set->edges) {
+        return -1;  // Compiled sets are read-only; set must be initialized
+    }
+    
+    if (strncmp(domain, "*.", 2) == 0) {
+        domain += 2;
+        len -= 2;
+    } else if (domain[0] == '.') {
+        domain++;
+        len--;
+    }
+    
+    // Fully qualified names may end with a dot
+    if (len > 0 && domain[len - 1] == '.') {
+        len--;
+    }
+    
+    if (len == 0 || len > MAX_HOSTNAME_LEN) {
+        return -1;
+    }
+    
+    // Walk labels right to left, creating nodes as needed
+    uint32_t node = DOMAIN_SET_ROOT;
+    size_t end = len;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && domain[start - 1] != '.') {
+            start--;
+        }
+        
+        if (start == end) {
+            return -1;  // Empty label
+        }
+        
+        if (domain_get_or_add_child(set, node, domain + start, end - start, &node) < 0) {
+            log_error("Out of memory while adding domain");
+            return -1;
+        }
+        
+        end = (start > 0) ? start - 1 : 0;
+        if (start > 0 && end == 0) {
+            return -1;  // Leading dot left over
+        }
+    }
+    
+    if (set->values[node] == DOMAIN_SET_NO_VALUE) {
+        set->domain_count++;
+    }
+    set->values[node] = value;
+    return 0;
+}
+
+// Load one domain per line; blank lines and '#' comments are skipped.
+// Returns the number of domains added, or -1 if the file cannot be read.
+int domain_set_load_file(domain_set_t *set, const char *filename, uint32_t value)
+{
+    char line[DOMAIN_SET_MAX_LINE];
+    int added = 0;
+    int line_num = 0;
+    
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        log_error("Cannot open domain list %s", filename);
+        return -1;
+    }
+    
+    while (fgets(line, sizeof(line), file)) {
+        line_num++;
+        
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        
+        char *domain = trim(line);
+        if (domain[0] == '\0') {
+            continue;
+        }
+        
+        if (domain_set_add(set, domain, value) < 0) {
+            log_warning("%s:%d: invalid domain '%s'", filename, line_num, domain);
+            continue;
+        }
+        added++;
+    }
+    
+    fclose(file);
+    return added;
+}
+
+// Round a file offset up to the section alignment
+static uint64_t domain_align(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// Write a compiled set: header, edge table, node values and label pool,
+// each section 8-byte aligned. Written to a temporary file and renamed so
+// a running daemon never maps a partial file.
+int domain_set_save(const domain_set_t *set, const char *filename)
+{
+    domain_set_file_header_t header;
+    static const uint8_t padding[8] = {0};
+    char tmp_name[PATH_MAX];
+    
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DOMAIN_SET_FILE_MAGIC, sizeof(header.magic));
+    header.version = DOMAIN_SET_FILE_VERSION;
+    header.byte_order = DOMAIN_SET_FILE_BYTE_ORDER;
+    header.edge_capacity = set->edge_capacity;
+    header.edge_count = set->edge_count;
+    header.node_count = set->node_count;
+    header.labels_len = set->labels_len;
+    header.domain_count = set->domain_count;
+    header.edges_off = domain_align(sizeof(header));
+    header.values_off = domain_align(header.edges_off + (uint64_t)set->edge_capacity * sizeof(domain_edge_t));
+    header.labels_off = domain_align(header.values_off + (uint64_t)set->node_count * sizeof(uint32_t));
+    header.file_size = header.labels_off + set->labels_len;
+    
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", filename) >= (int)sizeof(tmp_name)) {
+        return -1;
+    }
+    
+    FILE *file = fopen(tmp_name, "wb");
+    if (!file) {
+        log_error("Cannot create %s: %s", tmp_name, strerror(errno));
+        return -1;
+    }
+    
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(padding, 1, header.edges_off - sizeof(header), file) == header.edges_off - sizeof(header);
+    ok = ok && fwrite(set->edges, sizeof(domain_edge_t), set->edge_capacity, file) == set->edge_capacity;
+    
+    uint64_t pos = header.edges_off + (uint64_t)set->edge_capacity * sizeof(domain_edge_t);
+    ok = ok && fwrite(padding, 1, header.values_off - pos, file) == header.values_off - pos;
+    ok = ok && fwrite(set->values, sizeof(uint32_t), set->node_count, file) == set->node_count;
+    
+    pos = header.values_off + (uint64_t)set->node_count * sizeof(uint32_t);
+    ok = ok && fwrite(padding, 1, header.labels_off - pos, file) == header.labels_off - pos;
+    ok = ok && fwrite(set->labels, 1, set->labels_len, file) == set->labels_len;
+    
+    if (fclose(file) != 0 || !ok) {
+        log_error("Failed to write %s", tmp_name);
+        unlink(tmp_name);
+        return -1;
+    }
+    
+    if (rename(tmp_name, filename) < 0) {
+        log_error("Cannot rename %s to %s: %s", tmp_name, filename, strerror(errno));
+        unlink(tmp_name);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Check a section lies inside the mapped file
+static bool domain_section_valid(uint64_t offset, uint64_t size, uint64_t file_size)
+{
+    return offset % 8 == 0 && offset <= file_size && size <= file_size - offset;
+}
+
+// Map a compiled set read-only. Only the header is validated, so startup
+// cost does not depend on the list size; lookups bounds-check the rest.
+// Returns 1 if the file is not a compiled set, -1 on error.
+int domain_set_map_file(domain_set_t *set, const char *filename)
+{
+    domain_set_file_header_t header;
+    struct stat st;
+    
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_error("Cannot open domain list %s: %s", filename, strerror(errno));
+        return -1;
+    }
+    
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header) ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, DOMAIN_SET_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        close(fd);
+        return 1;
+    }
+    
+    if (header.version != DOMAIN_SET_FILE_VERSION || header.byte_order != DOMAIN_SET_FILE_BYTE_ORDER) {
+        log_error("%s: unsupported compiled list (version %u), recompile it", filename, header.version);
+        close(fd);
+        return -1;
+    }
+    
+    uint64_t file_size = (uint64_t)st.st_size;
+    if (header.file_size != file_size || header.node_count == 0 ||
+        header.edge_capacity == 0 || (header.edge_capacity & (header.edge_capacity - 1)) != 0 ||
+        header.edge_count >= header.edge_capacity ||
+        !domain_section_valid(header.edges_off, (uint64_t)header.edge_capacity * sizeof(domain_edge_t), file_size) ||
+        !domain_section_valid(header.values_off, (uint64_t)header.node_count * sizeof(uint32_t), file_size) ||
+        !domain_section_valid(header.labels_off, header.labels_len, file_size)) {
+        log_error("%s: corrupt compiled list", filename);
+        close(fd);
+        return -1;
+    }
+    
+    void *base = mmap(NULL, (size_t)file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        log_error("Cannot map %s: %s", filename, strerror(errno));
+        return -1;
+    }
+    
+    memset(set, 0, sizeof(*set));
+    set->map_base = base;
+    set->map_len = (size_t)file_size;
+    set->edges = (domain_edge_t *)((uint8_t *)base + header.edges_off);
+    set->edge_capacity = header.edge_capacity;
+    set->edge_count = header.edge_count;
+    set->values = (uint32_t *)((uint8_t *)base + header.values_off);
+    set->node_count = header.node_count;
+    set->node_capacity = header.node_count;
+    set->labels = (char *)base + header.labels_off;
+    set->labels_len = header.labels_len;
+    set->labels_capacity = header.labels_len;
+    set->domain_count = header.domain_count;
+    return 0;
+}
+
+// Open a list file: compiled sets are mapped, text lists are parsed.
+// Returns the number of domains, or -1 on error.
+int domain_set_open(domain_set_t *set, const char *filename, uint32_t value)
+{
+    memset(set, 0, sizeof(*set));
+    
+    int ret = domain_set_map_file(set, filename);
+    if (ret == 0) {
+        return (int)set->domain_count;
+    }
+    if (ret < 0) {
+        return -1;
+    }
+    
+    if (domain_set_init(set) < 0) {
+        log_error("Failed to allocate domain set");
+        return -1;
+    }
+    
+    ret = domain_set_load_file(set, filename, value);
+    if (ret < 0) {
+        domain_set_free(set);
+    }
+    return ret;
+}
+
+// Look a hostname up. Matches if the hostname or any parent domain is in
+// the set; `value` receives the value of the most specific match.
+bool domain_set_lookup(const domain_set_t *set, const char *host, size_t host_len,
+                       uint32_t *value)
+{
+    uint32_t node = DOMAIN_SET_ROOT;
+    uint32_t match = DOMAIN_SET_NO_VALUE;
+    size_t end = host_len;
+    
+    if (!set->edges || host_len == 0) {
+        return false;
+    }
+    
+    if (host[end - 1] == '.') {
+        end--;
+    }
+    
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && host[start - 1] != '.') {
+            start--;
+        }
+        
+        size_t len = end - start;
+        node = domain_find_child(set, node, host + start, len,
+                                 domain_edge_hash(node, host + start, len));
+        if (node == 0) {
+            break;
+        }
+        
+        if (set->values[node] != DOMAIN_SET_NO_VALUE) {
+            match = set->values[node];
+        }
+        
+        end = (start > 0) ? start - 1 : 0;
+    }
+    
+    if (match == DOMAIN_SET_NO_VALUE) {
+        return false;
+    }
+    
+    if (value) {
+        *value = match;
+    }
+    return true;
+}
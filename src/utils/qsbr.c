@@ -0,0 +1,91 @@
+#include "../include/goodbyedpi.h"
+#include "../include/logging.h"
+#include <unistd.h>
+
+// Grace-period tracking for data shared with packet workers.
+//
+// Readers bracket each use of shared data with qsbr_online()/qsbr_offline(),
+// which only store the current epoch into the reader's own slot. A writer
+// publishes new data with an atomic pointer swap, then qsbr_synchronize()
+// waits until every reader has been offline or has entered a newer epoch,
+// after which nothing can still reference the old data. Readers never
+// block or take locks.
+
+#define QSBR_MAX_READERS 16
+
+// Reader is not inside a read-side section
+#define QSBR_OFFLINE 0
+
+// Writer poll interval while waiting for readers (microseconds)
+#define QSBR_POLL_US 1000
+
+static uint64_t global_epoch = 1;
+static uint64_t reader_epochs[QSBR_MAX_READERS];
+static int reader_count = 0;
+static __thread int reader_slot = -1;
+
+// Register the calling thread as a reader
+int qsbr_register_reader(void)
+{
+    if (reader_slot >= 0) {
+        return 0;
+    }
+    
+    int slot = __atomic_fetch_add(&reader_count, 1, __ATOMIC_SEQ_CST);
+    if (slot >= QSBR_MAX_READERS) {
+        __atomic_fetch_sub(&reader_count, 1, __ATOMIC_SEQ_CST);
+        log_error("Too many QSBR reader threads");
+        return -1;
+    }
+    
+    __atomic_store_n(&reader_epochs[slot], QSBR_OFFLINE, __ATOMIC_RELEASE);
+    reader_slot = slot;
+    return 0;
+}
+
+// Enter a read-side section
+void qsbr_online(void)
+{
+    if (reader_slot < 0) {
+        return;
+    }
+    
+    __atomic_store_n(&reader_epochs[reader_slot],
+                     __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    
+    // Publish the epoch before any shared pointer is loaded
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// Leave a read-side section; no shared data may be used afterwards
+void qsbr_offline(void)
+{
+    if (reader_slot < 0) {
+        return;
+    }
+    
+    __atomic_store_n(&reader_epochs[reader_slot], QSBR_OFFLINE, __ATOMIC_RELEASE);
+}
+
+// Wait for a grace period: returns once no reader can still hold a
+// pointer that was unpublished before the call. Must not be called from
+// inside a read-side section.
+void qsbr_synchronize(void)
+{
+    uint64_t target = __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+    int readers = __atomic_load_n(&reader_count, __ATOMIC_SEQ_CST);
+    
+    if (readers > QSBR_MAX_READERS) {
+        readers = QSBR_MAX_READERS;
+    }
+    
+    for (int i = 0; i < readers; i++) {
+        for (;;) {
+            uint64_t epoch = __atomic_load_n(&reader_epochs[i], __ATOMIC_SEQ_CST);
+            if (epoch == QSBR_OFFLINE || epoch >= target) {
+                break;
+            }
+            usleep(QSBR_POLL_US);
+        }
+    }
+}
@@ -156,6 +156,29 @@ char *stristr(const char *haystack, const char *needle)
     return NULL;
 }
 
+// Find a byte sequence in a buffer (case insensitive); the buffer need
+// not be NUL-terminated
+const void *memcasemem(const void *haystack, size_t haystack_len,
+                       const void *needle, size_t needle_len)
+{
+    if (!haystack || !needle || needle_len > haystack_len) return NULL;
+    
+    const uint8_t *h = haystack;
+    const uint8_t *n = needle;
+    
+    for (size_t i = 0; i + needle_len <= haystack_len; i++) {
+        size_t j = 0;
+        while (j < needle_len && tolower(h[i + j]) == tolower(n[j])) {
+            j++;
+        }
+        if (j == needle_len) {
+            return h + i;
+        }
+    }
+    
+    return NULL;
+}
+
 // Replace all occurrences of substring
 int string_replace_all(char *str, size_t str_size, const char *find, const char *replace)
 {
@@ -0,0 +1,229 @@
+#include "../src/include/tls_parser.h"
+#include "../src/include/quic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Benchmark of the parsers on the per-request path (ENABLE_BENCHMARKS,
+// see CMakeLists.txt): the ClientHello parser on a browser-sized hello
+// with a post-quantum key share, the six-byte TLS sniff, and for QUIC the
+// header check, Initial decryption and the CRYPTO frame walk.
+//
+// Usage: bench_parsers [iterations]
+
+#define BENCH_HOST "www.example.com"
+
+// Sink for results, so the calls are not optimized away
+static volatile uint64_t bench_sink;
+
+// Store a big-endian 16-bit value
+static size_t put16(uint8_t *p, unsigned int value)
+{
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+    return 2;
+}
+
+// Append an extension with an opaque body of len bytes
+static size_t put_extension(uint8_t *p, unsigned int type, const uint8_t *body, size_t len)
+{
+    size_t n = put16(p, type);
+    n += put16(p + n, (unsigned int)len);
+    memcpy(p + n, body, len);
+    return n + len;
+}
+
+// Build a ClientHello record like a current browser sends. Returns its
+// length.
+static size_t build_client_hello(uint8_t *out)
+{
+    static const uint8_t alpn[] = { 0, 12, 2, 'h', '2', 8, 'h', 't', 't', 'p', '/', '1', '.', '1' };
+    static const uint8_t versions[] = { 4, 0x03, 0x04, 0x03, 0x03 };
+    static uint8_t key_share[2 + 4 + 1216];
+    uint8_t sni[64];
+    uint8_t *body = out + 9;
+    size_t host_len = strlen(BENCH_HOST);
+    size_t n = 0;
+    
+    n += put16(body + n, 0x0303);
+    memset(body + n, 0xab, 32);
+    n += 32;
+    body[n++] = 32;
+    memset(body + n, 0xcd, 32);
+    n += 32;
+    n += put16(body + n, 6);
+    n += put16(body + n, 0x1301);
+    n += put16(body + n, 0x1302);
+    n += put16(body + n, 0x1303);
+    body[n++] = 1;
+    body[n++] = 0;
+    
+    size_t ext_len_at = n;
+    n += 2;
+    
+    size_t s = put16(sni, (unsigned int)host_len + 3);
+    sni[s++] = 0;
+    s += put16(sni + s, (unsigned int)host_len);
+    memcpy(sni + s, BENCH_HOST, host_len);
+    s += host_len;
+    n += put_extension(body + n, TLS_EXT_SERVER_NAME, sni, s);
+    n += put_extension(body + n, TLS_EXT_ALPN, alpn, sizeof(alpn));
+    n += put_extension(body + n, TLS_EXT_SUPPORTED_VERSIONS, versions, sizeof(versions));
+    
+    // X25519MLKEM768 key share
+    put16(key_share, sizeof(key_share) - 2);
+    put16(key_share + 2, 0x11ec);
+    put16(key_share + 4, 1216);
+    n += put_extension(body + n, 0x0033, key_share, sizeof(key_share));
+    
+    put16(body + ext_len_at, (unsigned int)(n - ext_len_at - 2));
+    
+    out[0] = TLS_CONTENT_HANDSHAKE;
+    put16(out + 1, 0x0301);
+    put16(out + 3, (unsigned int)n + 4);
+    out[5] = TLS_HANDSHAKE_CLIENT_HELLO;
+    out[6] = 0;
+    put16(out + 7, (unsigned int)n);
+    return 9 + n;
+}
+
+// Build a padded 1200-byte QUIC v1 client Initial. Its protected part is
+// filler, so decryption runs in full and fails on the tag, which costs
+// the same as a real Initial.
+static size_t build_initial(uint8_t *out)
+{
+    size_t n = 0;
+    
+    out[n++] = 0xc3;
+    out[n++] = 0;
+    out[n++] = 0;
+    out[n++] = 0;
+    out[n++] = 1;
+    out[n++] = 8;
+    memset(out + n, 0x5a, 8);
+    n += 8;
+    out[n++] = 0;
+    out[n++] = 0;
+    n += put16(out + n, 0x4000 | (unsigned int)(1200 - n - 2));
+    memset(out + n, 0x33, 1200 - n);
+    return 1200;
+}
+
+// Build a decrypted Initial payload: the ClientHello handshake message in
+// two CRYPTO frames, out of order, then PADDING. Returns its length.
+static size_t build_crypto_payload(uint8_t *out, const uint8_t *hello, size_t hello_len)
+{
+    const uint8_t *hs = hello + TLS_RECORD_HEADER_LEN;
+    size_t hs_len = hello_len - TLS_RECORD_HEADER_LEN;
+    size_t half = hs_len / 2;
+    size_t n = 0;
+    
+    out[n++] = 0x06;
+    n += put16(out + n, 0x4000 | (unsigned int)half);
+    n += put16(out + n, 0x4000 | (unsigned int)(hs_len - half));
+    memcpy(out + n, hs + half, hs_len - half);
+    n += hs_len - half;
+    
+    out[n++] = 0x06;
+    out[n++] = 0;
+    n += put16(out + n, 0x4000 | (unsigned int)half);
+    memcpy(out + n, hs, half);
+    n += half;
+    
+    memset(out + n, 0, 100);
+    return n + 100;
+}
+
+// Current time in nanoseconds
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Print the time per call of a timed loop
+static void report(const char *name, uint64_t start, unsigned long iterations)
+{
+    double ns = (double)(now_ns() - start) / (double)iterations;
+    
+    printf("%-28s %10.1f ns/op\n", name, ns);
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t hello[4096];
+    static uint8_t initial[1200];
+    static uint8_t payload[4096];
+    uint8_t plain[QUIC_MAX_INITIAL];
+    quic_crypto_frame_t frames[QUIC_MAX_CRYPTO_FRAMES];
+    tls_client_hello_t parsed;
+    size_t plain_len, num_frames;
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    
+    if (iterations == 0) {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    
+    size_t hello_len = build_client_hello(hello);
+    size_t initial_len = build_initial(initial);
+    size_t payload_len = build_crypto_payload(payload, hello, hello_len);
+    
+    if (tls_parse_client_hello(hello, hello_len, &parsed) != TLS_PARSE_OK || parsed.sni_len == 0 ||
+        quic_crypto_frames(payload, payload_len, frames, QUIC_MAX_CRYPTO_FRAMES, &num_frames) < 0 ||
+        num_frames != 2 || !quic_is_initial(initial, initial_len)) {
+        fprintf(stderr, "Benchmark inputs do not parse\n");
+        return 1;
+    }
+    
+    printf("ClientHello %zu bytes, Initial %zu bytes, %lu iterations\n",
+           hello_len, initial_len, iterations);
+    
+    uint64_t start = now_ns();
+    for (unsigned long i = 0; i < iterations; i++) {
+        bench_sink += (uint64_t)tls_parse_client_hello(hello, hello_len, &parsed) + parsed.sni_off;
+    }
+    report("tls_parse_client_hello", start, iterations);
+    
+    start = now_ns();
+    for (unsigned long i = 0; i < iterations; i++) {
+        bench_sink += tls_parse_client_hello(hello, hello_len / 2, &parsed) == TLS_PARSE_INCOMPLETE;
+    }
+    report("tls_parse_client_hello/half", start, iterations);
+    
+    start = now_ns();
+    for (unsigned long i = 0; i < iterations; i++) {
+        bench_sink += tls_is_client_hello(hello, hello_len);
+    }
+    report("tls_is_client_hello", start, iterations);
+    
+    start = now_ns();
+    for (unsigned long i = 0; i < iterations; i++) {
+        bench_sink += quic_is_initial(initial, initial_len);
+    }
+    report("quic_is_initial", start, iterations);
+    
+    start = now_ns();
+    for (unsigned long i = 0; i < iterations; i++) {
+        bench_sink += (uint64_t)quic_crypto_frames(payload, payload_len, frames,
+                                                   QUIC_MAX_CRYPTO_FRAMES, &num_frames);
+    }
+    report("quic_crypto_frames", start, iterations);
+    
+    if (quic_decryption_available()) {
+        // Key derivation and AES-GCM dominate; fewer rounds keep it short
+        unsigned long rounds = iterations / 10 > 0 ? iterations / 10 : 1;
+        
+        start = now_ns();
+        for (unsigned long i = 0; i < rounds; i++) {
+            bench_sink += (uint64_t)quic_decrypt_initial(initial, initial_len, plain,
+                                                         sizeof(plain), &plain_len);
+        }
+        report("quic_decrypt_initial", start, rounds);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "../src/include/quic.h"
+#include <stdlib.h>
+
+// libFuzzer target for the QUIC Initial parser (ENABLE_FUZZING, see
+// CMakeLists.txt). The input is tried as a datagram, which exercises the
+// long header checks, key derivation and header protection removal;
+// authentication fails for nearly any input, so it is also handed to the
+// CRYPTO frame walker as if it were a decrypted payload.
+
+// Collect the CRYPTO frames of a payload and abort unless each lies
+// within it
+static void check_frames(const uint8_t *plain, size_t plain_len)
+{
+    quic_crypto_frame_t frames[QUIC_MAX_CRYPTO_FRAMES];
+    size_t num_frames;
+    
+    if (quic_crypto_frames(plain, plain_len, frames, QUIC_MAX_CRYPTO_FRAMES, &num_frames) < 0) {
+        return;
+    }
+    
+    if (num_frames > QUIC_MAX_CRYPTO_FRAMES) {
+        abort();
+    }
+    
+    for (size_t i = 0; i < num_frames; i++) {
+        if (frames[i].data < plain || frames[i].len > plain_len ||
+            (size_t)(frames[i].data - plain) > plain_len - frames[i].len) {
+            abort();
+        }
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    uint8_t plain[QUIC_MAX_INITIAL];
+    size_t plain_len;
+    
+    if (quic_is_initial(data, size) &&
+        quic_decrypt_initial(data, size, plain, sizeof(plain), &plain_len) == 0) {
+        if (plain_len > sizeof(plain)) {
+            abort();
+        }
+        check_frames(plain, plain_len);
+    }
+    
+    check_frames(data, size);
+    return 0;
+}
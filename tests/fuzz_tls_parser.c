@@ -0,0 +1,60 @@
+#include "../src/include/tls_parser.h"
+#include <stdlib.h>
+
+// libFuzzer target for the ClientHello parser (ENABLE_FUZZING, see
+// CMakeLists.txt). Besides the sanitizers' reports, it aborts when an
+// accepted ClientHello breaks what packet processing relies on: reported
+// fields lie inside the input, the six-byte sniff of --tls-any-port
+// accepts it, and every shorter prefix reads as incomplete, so a
+// ClientHello split across segments is gathered rather than given up on.
+
+// Abort unless the field [off, off + len) lies within size bytes
+static void check_field(uint32_t off, uint32_t len, size_t size)
+{
+    if (off > size || len > size - off) {
+        abort();
+    }
+}
+
+// Check the fields of a parsed ClientHello against the input size
+static void check_hello(const tls_client_hello_t *hello, size_t size)
+{
+    check_field(hello->session_id_off, hello->session_id_len, size);
+    check_field(hello->ciphers_off, hello->ciphers_len, size);
+    check_field(hello->extensions_off, hello->extensions_len, size);
+    check_field(hello->sni_off, hello->sni_len, size);
+    check_field(hello->alpn_off, hello->alpn_len, size);
+    check_field(hello->versions_off, hello->versions_len, size);
+    
+    if (hello->sni_len > 0 && hello->sni_ext_off == 0) {
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    tls_client_hello_t hello;
+    
+    if (tls_parse_client_hello(data, size, &hello) == TLS_PARSE_OK) {
+        check_hello(&hello, size);
+        
+        if (!tls_is_client_hello(data, size)) {
+            abort();
+        }
+        
+        // Prefixes stop before the body is parsed, so this stays cheap
+        size_t record_end = TLS_RECORD_HEADER_LEN + hello.record_len;
+        for (size_t len = 0; len < record_end; len++) {
+            if (tls_parse_client_hello(data, len, &hello) != TLS_PARSE_INCOMPLETE) {
+                abort();
+            }
+        }
+    }
+    
+    // The same bytes as a bare handshake message (QUIC CRYPTO stream)
+    if (tls_parse_handshake(data, size, &hello) == TLS_PARSE_OK) {
+        check_hello(&hello, size);
+    }
+    
+    return 0;
+}